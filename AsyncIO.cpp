@@ -0,0 +1,476 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#include "AsyncIO.h"
+
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define IO_URING_AVAILABLE
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+IOQueue::IOQueue(FileSystem& fileSystem, unsigned int threadCount) : fileSystem(fileSystem)
+{
+    // Потоки в основном ждут диск, поэтому их больше, чем ядер
+    if (threadCount == 0)
+        threadCount = std::min(16u, std::max(4u, std::thread::hardware_concurrency()));
+
+    for (unsigned int i = 0; i < threadCount; i++)
+        workers.emplace_back(&IOQueue::WorkerLoop, this);
+}
+
+IOQueue::~IOQueue()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    taskReady.notify_all();
+
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void IOQueue::WorkerLoop()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            taskReady.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (tasks.empty())
+                return;
+
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void IOQueue::Post(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+        inFlight++;
+    }
+    taskReady.notify_one();
+}
+
+void IOQueue::Complete(std::vector<Completion> results)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& result : results)
+            completions.push_back(std::move(result));
+        inFlight--;
+    }
+    completionReady.notify_one();
+}
+
+void IOQueue::Read(const std::string& path, ReadCallback callback)
+{
+    pendingReads.push_back({ path, std::move(callback) });
+    if (pendingReads.size() >= ReadBatchSize)
+        FlushReads();
+}
+
+void IOQueue::FlushReads()
+{
+    if (pendingReads.empty())
+        return;
+
+    auto batch = std::make_shared<std::vector<PendingRead>>(std::move(pendingReads));
+    pendingReads.clear();
+
+    Post([this, batch]()
+    {
+        std::vector<ReadRequest> requests(batch->size());
+        for (size_t i = 0; i < batch->size(); i++)
+            requests[i].path = (*batch)[i].path;
+
+        fileSystem.ReadBatch(requests);
+
+        // Данные переезжают в общий буфер, который живёт до вызова обработчика
+        auto results = std::make_shared<std::vector<ReadRequest>>(std::move(requests));
+        std::vector<Completion> completed;
+        for (size_t i = 0; i < batch->size(); i++)
+        {
+            completed.push_back([batch, results, i]()
+            {
+                (*batch)[i].callback((*results)[i].result, (*results)[i].data);
+            });
+        }
+        Complete(std::move(completed));
+    });
+}
+
+void IOQueue::Copy(const std::string& source, const std::string& destination, Callback callback)
+{
+    Run([this, source, destination, callback]() -> Completion
+    {
+        bool result = fileSystem.Copy(source, destination);
+        return [callback, result]() { callback(result); };
+    });
+}
+
+void IOQueue::Run(std::function<Completion()> work)
+{
+    Post([this, work]()
+    {
+        Completion completion = work();
+        std::vector<Completion> completed;
+        if (completion)
+            completed.push_back(std::move(completion));
+        Complete(std::move(completed));
+    });
+}
+
+void IOQueue::Wait()
+{
+    while (true)
+    {
+        FlushReads();
+
+        std::deque<Completion> ready;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            completionReady.wait(lock, [this]() { return !completions.empty() || inFlight == 0; });
+            if (completions.empty())
+                return;
+            ready.swap(completions);
+        }
+
+        for (auto& completion : ready)
+            completion();
+    }
+}
+
+#if defined(IO_URING_AVAILABLE)
+
+// Минимальная обёртка над кольцами io_uring на системных вызовах, без liburing:
+// https://man7.org/linux/man-pages/man7/io_uring.7.html
+class IOUring
+{
+private:
+    int ringDescriptor = -1;
+    void* sqRing = nullptr;
+    size_t sqRingSize = 0;
+    void* cqRing = nullptr;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned sqEntries = 0;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+public:
+    IOUring() = default;
+    ~IOUring();
+
+    IOUring(const IOUring&) = delete;
+    IOUring& operator=(const IOUring&) = delete;
+
+    bool Setup(unsigned entries);
+    unsigned GetEntries() const { return sqEntries; }
+
+    // Заполняет следующий элемент очереди отправки; nullptr - очередь полна
+    io_uring_sqe* GetSqe();
+    // consumed - сколько элементов ядро забрало из очереди; остальные ждут следующего вызова
+    bool Submit(unsigned count, unsigned waitFor, unsigned& consumed);
+    bool PeekCqe(io_uring_cqe& cqe);
+};
+
+IOUring::~IOUring()
+{
+    if (sqes)
+        munmap(sqes, sqesSize);
+    if (cqRing && cqRing != sqRing)
+        munmap(cqRing, cqRingSize);
+    if (sqRing)
+        munmap(sqRing, sqRingSize);
+    if (ringDescriptor >= 0)
+        close(ringDescriptor);
+}
+
+bool IOUring::Setup(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringDescriptor = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (ringDescriptor < 0)
+        return false;
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap)
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringDescriptor, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED)
+    {
+        sqRing = nullptr;
+        return false;
+    }
+
+    if (singleMap)
+    {
+        cqRing = sqRing;
+    }
+    else
+    {
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringDescriptor, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED)
+        {
+            cqRing = nullptr;
+            return false;
+        }
+    }
+
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqeMapping = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringDescriptor, IORING_OFF_SQES);
+    if (sqeMapping == MAP_FAILED)
+        return false;
+    sqes = static_cast<io_uring_sqe*>(sqeMapping);
+
+    char* sq = static_cast<char*>(sqRing);
+    sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sqEntries = params.sq_entries;
+
+    char* cq = static_cast<char*>(cqRing);
+    cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+}
+
+io_uring_sqe* IOUring::GetSqe()
+{
+    unsigned tail = *sqTail;
+    if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+        return nullptr;
+
+    unsigned index = tail & *sqMask;
+    io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+
+    // Ядро увидит элемент только после Submit: хвост сдвигается сразу, но вызов io_uring_enter позже
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+bool IOUring::Submit(unsigned count, unsigned waitFor, unsigned& consumed)
+{
+    consumed = 0;
+    while (true)
+    {
+        long result = syscall(__NR_io_uring_enter, ringDescriptor, count, waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        if (result >= 0)
+        {
+            consumed = static_cast<unsigned>(result);
+            return true;
+        }
+        if (errno != EINTR)
+            return false;
+    }
+}
+
+bool IOUring::PeekCqe(io_uring_cqe& cqe)
+{
+    unsigned head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+        return false;
+
+    cqe = cqes[head & *cqMask];
+    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool ReadFilesWithIOUring(std::vector<ReadRequest>& requests)
+{
+    // Ядро без io_uring или запрет в seccomp: один раз узнали - больше не пробуем
+    static std::atomic<bool> unavailable{ false };
+    if (unavailable)
+        return false;
+    if (requests.empty())
+        return true;
+
+    IOUring ring;
+    if (!ring.Setup(static_cast<unsigned>(std::min<size_t>(64, requests.size()))))
+    {
+        unavailable = true;
+        return false;
+    }
+
+    struct Job
+    {
+        int fileDescriptor = -1;
+        size_t done = 0;
+        iovec vector = {};
+    };
+
+    std::vector<Job> jobs(requests.size());
+    std::deque<size_t> queue;
+
+    // Файлы открываются по мере отправки, чтобы открытых дескрипторов было не больше глубины кольца
+    size_t nextRequest = 0;
+    unsigned inFlight = 0;
+    unsigned pending = 0;
+    auto openNext = [&]() -> bool
+    {
+        while (nextRequest < requests.size())
+        {
+            size_t index = nextRequest++;
+            ReadRequest& request = requests[index];
+            request.result = false;
+            request.data.clear();
+
+            int fileDescriptor = open(request.path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fileDescriptor < 0)
+                continue;
+
+            struct stat fileStat;
+            if (fstat(fileDescriptor, &fileStat) != 0 || !S_ISREG(fileStat.st_mode))
+            {
+                close(fileDescriptor);
+                continue;
+            }
+
+            if (fileStat.st_size == 0)
+            {
+                close(fileDescriptor);
+                request.result = true;
+                continue;
+            }
+
+            request.data.resize(static_cast<size_t>(fileStat.st_size));
+            jobs[index].fileDescriptor = fileDescriptor;
+            queue.push_back(index);
+            return true;
+        }
+        return false;
+    };
+
+    auto finish = [&](size_t index, bool result)
+    {
+        close(jobs[index].fileDescriptor);
+        jobs[index].fileDescriptor = -1;
+        requests[index].result = result;
+        if (!result)
+            requests[index].data.clear();
+    };
+
+    while (true)
+    {
+        // Дочитывание после короткого чтения идёт первым, затем новые файлы
+        unsigned submitted = 0;
+        while (inFlight + pending + submitted < ring.GetEntries() && (!queue.empty() || openNext()))
+        {
+            size_t index = queue.front();
+            Job& job = jobs[index];
+
+            io_uring_sqe* sqe = ring.GetSqe();
+            if (!sqe)
+                break;
+            queue.pop_front();
+
+            job.vector.iov_base = requests[index].data.data() + job.done;
+            job.vector.iov_len = requests[index].data.size() - job.done;
+            sqe->opcode = IORING_OP_READV;
+            sqe->fd = job.fileDescriptor;
+            sqe->addr = reinterpret_cast<uint64_t>(&job.vector);
+            sqe->len = 1;
+            sqe->off = job.done;
+            sqe->user_data = index;
+            submitted++;
+        }
+
+        pending += submitted;
+        if (inFlight + pending == 0)
+            break;
+
+        // При коротком приёме ядро не ждёт завершений, а непринятые элементы
+        // остаются в очереди отправки и уходят следующим вызовом
+        unsigned consumed = 0;
+        if (!ring.Submit(pending, 1, consumed))
+        {
+            // Кольцо сломалось посреди пачки: незаконченные файлы дочитает обычный путь
+            for (size_t index = 0; index < jobs.size(); index++)
+            {
+                if (jobs[index].fileDescriptor >= 0)
+                {
+                    close(jobs[index].fileDescriptor);
+                    jobs[index].fileDescriptor = -1;
+                }
+            }
+            unavailable = true;
+            return false;
+        }
+        pending -= consumed;
+        inFlight += consumed;
+
+        io_uring_cqe cqe;
+        while (ring.PeekCqe(cqe))
+        {
+            inFlight--;
+            size_t index = static_cast<size_t>(cqe.user_data);
+            Job& job = jobs[index];
+            if (cqe.res == -EINTR || cqe.res == -EAGAIN)
+            {
+                queue.push_front(index);
+            }
+            else if (cqe.res <= 0)
+            {
+                finish(index, false);
+            }
+            else
+            {
+                job.done += static_cast<size_t>(cqe.res);
+                if (job.done < requests[index].data.size())
+                    queue.push_front(index);
+                else
+                    finish(index, true);
+            }
+        }
+    }
+
+    return true;
+}
+
+#else
+
+bool ReadFilesWithIOUring(std::vector<ReadRequest>& requests)
+{
+    return false;
+}
+
+#endif
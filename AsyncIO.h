@@ -0,0 +1,80 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "FileSystem.h"
+
+// Очередь асинхронных операций с файлами. Чтения копятся и уходят пачками
+// через FileSystem::ReadBatch (на Linux диск читает пачку одним кольцом io_uring),
+// копирования и любая другая работа выполняются на пуле потоков, поэтому очередь
+// диска не простаивает, пока разбирается очередная модель.
+//
+// Обратные вызовы выполняются только в потоке, который вызвал Wait(), и могут
+// ставить новые операции: состояние компилятора не нужно защищать мьютексами.
+// Файловая система должна допускать вызовы из нескольких потоков.
+class IOQueue
+{
+public:
+    using Completion = std::function<void()>;
+    using Callback = std::function<void(bool success)>;
+    using ReadCallback = std::function<void(bool success, std::vector<unsigned char>& data)>;
+
+    static const size_t ReadBatchSize = 32;
+
+private:
+    struct PendingRead
+    {
+        std::string path;
+        ReadCallback callback;
+    };
+
+    FileSystem& fileSystem;
+    std::vector<PendingRead> pendingReads;      // только из потока Wait()
+
+    std::mutex mutex;
+    std::condition_variable taskReady;
+    std::condition_variable completionReady;
+    std::deque<std::function<void()>> tasks;
+    std::deque<Completion> completions;
+    size_t inFlight = 0;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+public:
+    explicit IOQueue(FileSystem& fileSystem, unsigned int threadCount = 0);
+    ~IOQueue();
+
+    IOQueue(const IOQueue&) = delete;
+    IOQueue& operator=(const IOQueue&) = delete;
+
+    void Read(const std::string& path, ReadCallback callback);
+    void Copy(const std::string& source, const std::string& destination, Callback callback);
+
+    // Работа выполняется в рабочем потоке и возвращает то, что надо сделать в потоке Wait()
+    void Run(std::function<Completion()> work);
+
+    // Отправляет накопленные чтения и выполняет обратные вызовы, пока очередь не опустеет
+    void Wait();
+
+private:
+    void Post(std::function<void()> task);
+    void Complete(std::vector<Completion> results);
+    void FlushReads();
+    void WorkerLoop();
+};
+
+// Пачка чтений через io_uring. false - io_uring недоступен, и пачку надо читать обычным способом
+bool ReadFilesWithIOUring(std::vector<ReadRequest>& requests);
@@ -0,0 +1,1223 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#include "BSPFile.h"
+#include "FileSystem.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstddef>
+#include <cctype>
+#include <algorithm>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+
+#if defined(PROPCOLOR_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+#if defined(PROPCOLOR_HAVE_LZMA)
+#include <lzma.h>
+#endif
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Сбрасывает изменённый на месте файл на диск: после этого журнал может считать шаг
+// выполненным и удалить данные отката
+static bool SyncFileToDisk(const std::string& filename)
+{
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    bool success = FlushFileBuffers(file) != 0;
+    CloseHandle(file);
+    return success;
+#else
+    int file = open(filename.c_str(), O_WRONLY | O_CLOEXEC);
+    if (file < 0)
+        return false;
+    bool success = fsync(file) == 0;
+    close(file);
+    return success;
+#endif
+}
+
+uint32_t CRC32(const void* data, size_t size, uint32_t crc)
+{
+    static uint32_t table[256];
+    static bool tableReady = false;
+    if (!tableReady)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t value = i;
+            for (int j = 0; j < 8; j++)
+            {
+                value = (value & 1) ? (0xEDB88320 ^ (value >> 1)) : (value >> 1);
+            }
+            table[i] = value;
+        }
+        tableReady = true;
+    }
+
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+bool ParsePakCodec(const std::string& name, PakCodec& codec)
+{
+    if (name == "store")
+        codec = PakCodec::Store;
+    else if (name == "deflate")
+        codec = PakCodec::Deflate;
+    else if (name == "lzma")
+        codec = PakCodec::LZMA;
+    else
+        return false;
+
+    return true;
+}
+
+const char* GetPakCodecName(PakCodec codec)
+{
+    switch (codec)
+    {
+    case PakCodec::Deflate: return "deflate";
+    case PakCodec::LZMA:    return "lzma";
+    default:                return "store";
+    }
+}
+
+bool IsPakCodecAvailable(PakCodec codec)
+{
+    switch (codec)
+    {
+#if defined(PROPCOLOR_HAVE_ZLIB)
+    case PakCodec::Deflate: return true;
+#endif
+#if defined(PROPCOLOR_HAVE_LZMA)
+    case PakCodec::LZMA:    return true;
+#endif
+    case PakCodec::Store:   return true;
+    default:                return false;
+    }
+}
+
+uint16_t GetZipVersionNeeded(const PakEntry& entry)
+{
+    // 6.3 - минимальная версия спецификации zip с LZMA
+    return entry.compressionMethod == ZIP_METHOD_LZMA ? 63 : 20;
+}
+
+#if defined(PROPCOLOR_HAVE_ZLIB)
+// Raw deflate без заголовка zlib, как требует zip
+static bool CompressDeflate(const std::vector<unsigned char>& input, std::vector<unsigned char>& output)
+{
+    z_stream stream = {};
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    output.resize(deflateBound(&stream, static_cast<uLong>(input.size())));
+    stream.next_in = const_cast<Bytef*>(input.data());
+    stream.avail_in = static_cast<uInt>(input.size());
+    stream.next_out = output.data();
+    stream.avail_out = static_cast<uInt>(output.size());
+
+    int result = deflate(&stream, Z_FINISH);
+    output.resize(stream.total_out);
+    deflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+#endif
+
+#if defined(PROPCOLOR_HAVE_LZMA)
+// LZMA в zip (метод 14): версия LZMA SDK (2 байта), размер свойств (2 байта),
+// свойства (5 байт), затем сырой поток LZMA1 с маркером конца
+static bool CompressLZMA(const std::vector<unsigned char>& input, std::vector<unsigned char>& output)
+{
+    lzma_options_lzma lzmaOptions;
+    if (lzma_lzma_preset(&lzmaOptions, 9))
+        return false;
+
+    lzma_filter filters[2] = {};
+    filters[0].id = LZMA_FILTER_LZMA1;
+    filters[0].options = &lzmaOptions;
+    filters[1].id = LZMA_VLI_UNKNOWN;
+
+    uint32_t propsSize = 0;
+    if (lzma_properties_size(&propsSize, &filters[0]) != LZMA_OK || propsSize != 5)
+        return false;
+
+    output.resize(4 + propsSize + input.size() + input.size() / 2 + 1024);
+    output[0] = 9;
+    output[1] = 20;
+    output[2] = static_cast<unsigned char>(propsSize);
+    output[3] = 0;
+    if (lzma_properties_encode(&filters[0], output.data() + 4) != LZMA_OK)
+        return false;
+
+    size_t outPos = 4 + propsSize;
+    lzma_ret result = lzma_raw_buffer_encode(filters, nullptr, input.data(), input.size(), output.data(), &outPos, output.size());
+    output.resize(outPos);
+    return result == LZMA_OK;
+}
+#endif
+
+static void CompressPakEntry(PakEntry& entry, PakCodec codec)
+{
+    std::vector<unsigned char> compressed;
+    bool success = false;
+    uint16_t method = ZIP_METHOD_STORE;
+    uint16_t flags = 0;
+
+    switch (codec)
+    {
+#if defined(PROPCOLOR_HAVE_ZLIB)
+    case PakCodec::Deflate:
+        success = CompressDeflate(entry.data, compressed);
+        method = ZIP_METHOD_DEFLATE;
+        break;
+#endif
+#if defined(PROPCOLOR_HAVE_LZMA)
+    case PakCodec::LZMA:
+        success = CompressLZMA(entry.data, compressed);
+        method = ZIP_METHOD_LZMA;
+        flags = 0x0002;     // бит 1: поток заканчивается маркером EOS
+        break;
+#endif
+    default:
+        break;
+    }
+
+    if (success && compressed.size() < entry.data.size())
+    {
+        entry.data = std::move(compressed);
+        entry.compressionMethod = method;
+        entry.flags = flags;
+        entry.compressedSize = static_cast<uint32_t>(entry.data.size());
+    }
+}
+
+void CompressPakEntries(std::vector<PakEntry>& entries, PakCodec codec, size_t minSize, unsigned int threadCount)
+{
+    if (codec == PakCodec::Store || !IsPakCodecAvailable(codec))
+        return;
+
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min<unsigned int>(threadCount, static_cast<unsigned int>(entries.size()));
+
+    // Каждый поток берёт следующую запись по общему счётчику; результат
+    // пишется в ту же запись, поэтому порядок в архиве не зависит от потоков
+    std::atomic<size_t> nextEntry{ 0 };
+    auto worker = [&]()
+    {
+        for (size_t i = nextEntry++; i < entries.size(); i = nextEntry++)
+        {
+            if (entries[i].compressionMethod == ZIP_METHOD_STORE && entries[i].data.size() >= minSize)
+            {
+                CompressPakEntry(entries[i], codec);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < threadCount; i++)
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
+}
+
+std::string PakFile::NormalizeName(const std::string& name)
+{
+    std::string result = name;
+    std::replace(result.begin(), result.end(), '\\', '/');
+    return result;
+}
+
+static std::string PakIndexKey(const std::string& name)
+{
+    std::string key = PakFile::NormalizeName(name);
+    std::transform(key.begin(), key.end(), key.begin(),
+        [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return key;
+}
+
+bool PakFile::Parse(const unsigned char* data, size_t size, bool loadData)
+{
+    entries.clear();
+    entryIndex.clear();
+    centralDirectoryOffset = 0;
+
+    if (size == 0)
+    {
+        return true;
+    }
+
+    if (size < sizeof(ZipEndOfCentralDirectory))
+    {
+        std::cout << "Error: Pakfile lump is too small" << std::endl;
+        return false;
+    }
+
+    // EOCD ищем с конца: после него может идти комментарий до 64 КБ
+    size_t eocdPos = std::string::npos;
+    size_t searchEnd = size >= sizeof(ZipEndOfCentralDirectory) + 0xFFFF ? size - sizeof(ZipEndOfCentralDirectory) - 0xFFFF : 0;
+    for (size_t pos = size - sizeof(ZipEndOfCentralDirectory) + 1; pos-- > searchEnd;)
+    {
+        uint32_t signature;
+        memcpy(&signature, data + pos, sizeof(signature));
+        if (signature == 0x06054b50)
+        {
+            eocdPos = pos;
+            break;
+        }
+    }
+
+    if (eocdPos == std::string::npos)
+    {
+        std::cout << "Error: Pakfile lump has no zip end of central directory" << std::endl;
+        return false;
+    }
+
+    ZipEndOfCentralDirectory eocd;
+    memcpy(&eocd, data + eocdPos, sizeof(eocd));
+
+    centralDirectoryOffset = eocd.centralDirectoryOffset;
+    size_t cdPos = eocd.centralDirectoryOffset;
+    for (int i = 0; i < eocd.totalEntries; i++)
+    {
+        if (cdPos + sizeof(ZipCentralDirectoryHeader) > size)
+        {
+            std::cout << "Error: Pakfile central directory is truncated" << std::endl;
+            return false;
+        }
+
+        ZipCentralDirectoryHeader cd;
+        memcpy(&cd, data + cdPos, sizeof(cd));
+        if (cd.signature != 0x02014b50 || cdPos + sizeof(cd) + cd.fileNameLength > size)
+        {
+            std::cout << "Error: Invalid pakfile central directory entry" << std::endl;
+            return false;
+        }
+
+        PakEntry entry;
+        entry.name.assign(reinterpret_cast<const char*>(data + cdPos + sizeof(cd)), cd.fileNameLength);
+        entry.compressionMethod = cd.compressionMethod;
+        entry.flags = cd.flags;
+        entry.lastModifiedTime = cd.lastModifiedTime;
+        entry.lastModifiedDate = cd.lastModifiedDate;
+        entry.crc32 = cd.crc32;
+        entry.uncompressedSize = cd.uncompressedSize;
+
+        ZipLocalFileHeader local;
+        size_t localPos = cd.relativeOffsetOfLocalHeader;
+        if (localPos + sizeof(local) > size)
+        {
+            std::cout << "Error: Invalid pakfile local header for " << entry.name << std::endl;
+            return false;
+        }
+        memcpy(&local, data + localPos, sizeof(local));
+
+        size_t dataPos = localPos + sizeof(local) + local.fileNameLength + local.extraFieldLength;
+        if (local.signature != 0x04034b50 || dataPos + cd.compressedSize > size)
+        {
+            std::cout << "Error: Invalid pakfile local header for " << entry.name << std::endl;
+            return false;
+        }
+        entry.localHeaderOffset = cd.relativeOffsetOfLocalHeader;
+        entry.compressedSize = cd.compressedSize;
+        entry.recordSize = static_cast<uint32_t>(dataPos + cd.compressedSize - localPos);
+        if (loadData)
+        {
+            entry.data.assign(data + dataPos, data + dataPos + cd.compressedSize);
+        }
+
+        entryIndex[PakIndexKey(entry.name)] = entries.size();
+        entries.push_back(std::move(entry));
+
+        cdPos += sizeof(cd) + cd.fileNameLength + cd.extraFieldLength + cd.fileCommentLength;
+    }
+
+    return true;
+}
+
+const PakEntry* PakFile::FindEntry(const std::string& name) const
+{
+    auto it = entryIndex.find(PakIndexKey(name));
+    return it == entryIndex.end() ? nullptr : &entries[it->second];
+}
+
+PakEntry PakFile::MakeEntry(const std::string& name, std::vector<unsigned char> data)
+{
+    PakEntry entry;
+    entry.name = NormalizeName(name);
+    entry.crc32 = CRC32(data.data(), data.size());
+    entry.uncompressedSize = static_cast<uint32_t>(data.size());
+    entry.compressedSize = entry.uncompressedSize;
+    entry.data = std::move(data);
+    return entry;
+}
+
+void PakFile::AddOrReplace(const std::string& name, std::vector<unsigned char> data)
+{
+    AddOrReplace(MakeEntry(name, std::move(data)));
+}
+
+void PakFile::AddOrReplace(PakEntry entry)
+{
+    std::string key = PakIndexKey(entry.name);
+    auto it = entryIndex.find(key);
+    if (it != entryIndex.end())
+    {
+        entries[it->second] = std::move(entry);
+    }
+    else
+    {
+        entryIndex[key] = entries.size();
+        entries.push_back(std::move(entry));
+    }
+}
+
+std::vector<unsigned char> PakFile::Serialize() const
+{
+    size_t totalSize = sizeof(ZipEndOfCentralDirectory);
+    for (const auto& entry : entries)
+    {
+        totalSize += sizeof(ZipLocalFileHeader) + sizeof(ZipCentralDirectoryHeader) + entry.name.size() * 2 + entry.data.size();
+    }
+
+    std::vector<unsigned char> result;
+    result.reserve(totalSize);
+
+    auto append = [&result](const void* data, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        result.insert(result.end(), bytes, bytes + size);
+    };
+
+    std::vector<uint32_t> localOffsets;
+    for (const auto& entry : entries)
+    {
+        localOffsets.push_back(static_cast<uint32_t>(result.size()));
+
+        ZipLocalFileHeader local = {};
+        local.signature = 0x04034b50;
+        local.versionNeeded = GetZipVersionNeeded(entry);
+        local.flags = entry.flags;
+        local.compressionMethod = entry.compressionMethod;
+        local.lastModifiedTime = entry.lastModifiedTime;
+        local.lastModifiedDate = entry.lastModifiedDate;
+        local.crc32 = entry.crc32;
+        local.compressedSize = static_cast<uint32_t>(entry.data.size());
+        local.uncompressedSize = entry.uncompressedSize;
+        local.fileNameLength = static_cast<uint16_t>(entry.name.size());
+
+        append(&local, sizeof(local));
+        append(entry.name.data(), entry.name.size());
+        append(entry.data.data(), entry.data.size());
+    }
+
+    uint32_t cdOffset = static_cast<uint32_t>(result.size());
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const PakEntry& entry = entries[i];
+
+        ZipCentralDirectoryHeader cd = {};
+        cd.signature = 0x02014b50;
+        cd.versionMadeBy = 20;
+        cd.versionNeeded = GetZipVersionNeeded(entry);
+        cd.flags = entry.flags;
+        cd.compressionMethod = entry.compressionMethod;
+        cd.lastModifiedTime = entry.lastModifiedTime;
+        cd.lastModifiedDate = entry.lastModifiedDate;
+        cd.crc32 = entry.crc32;
+        cd.compressedSize = static_cast<uint32_t>(entry.data.size());
+        cd.uncompressedSize = entry.uncompressedSize;
+        cd.fileNameLength = static_cast<uint16_t>(entry.name.size());
+        cd.relativeOffsetOfLocalHeader = localOffsets[i];
+
+        append(&cd, sizeof(cd));
+        append(entry.name.data(), entry.name.size());
+    }
+
+    ZipEndOfCentralDirectory eocd = {};
+    eocd.signature = 0x06054b50;
+    eocd.entriesOnThisDisk = static_cast<uint16_t>(entries.size());
+    eocd.totalEntries = static_cast<uint16_t>(entries.size());
+    eocd.centralDirectorySize = static_cast<uint32_t>(result.size()) - cdOffset;
+    eocd.centralDirectoryOffset = cdOffset;
+    append(&eocd, sizeof(eocd));
+
+    return result;
+}
+
+bool BSPFile::Load(const std::string& filename)
+{
+    path = filename;
+
+    if (!mapping.Open(filename))
+    {
+        std::cout << "Error: Cannot open BSP file " << filename << std::endl;
+        return false;
+    }
+
+    return ValidateHeader();
+}
+
+bool BSPFile::ValidateHeader()
+{
+    if (mapping.GetSize() < sizeof(BSPHeader))
+    {
+        std::cout << "Error: BSP file is too small: " << path << std::endl;
+        return false;
+    }
+
+    memcpy(&header, mapping.GetData(), sizeof(header));
+    if (header.ident != BSP_IDENT)
+    {
+        std::cout << "Error: Invalid BSP file signature!" << std::endl;
+        return false;
+    }
+
+    const BSPLump& pakLump = header.lumps[LUMP_PAKFILE];
+    if (pakLump.fileofs < 0 || pakLump.filelen < 0 || static_cast<size_t>(pakLump.fileofs) + pakLump.filelen > mapping.GetSize())
+    {
+        std::cout << "Error: Invalid pakfile lump in " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool BSPFile::ReadPakfile(PakFile& pak, bool loadData) const
+{
+    const BSPLump& pakLump = header.lumps[LUMP_PAKFILE];
+    return pak.Parse(mapping.GetData() + pakLump.fileofs, pakLump.filelen, loadData);
+}
+
+// Данные записи прямо из отображения; запись должна быть прочитана из этого же файла
+const unsigned char* BSPFile::GetPakEntryData(const PakEntry& entry) const
+{
+    const BSPLump& pakLump = header.lumps[LUMP_PAKFILE];
+    return mapping.GetData() + pakLump.fileofs + entry.localHeaderOffset + entry.recordSize - entry.compressedSize;
+}
+
+bool BSPFile::IsPakfileLastLump() const
+{
+    const BSPLump& pakLump = header.lumps[LUMP_PAKFILE];
+    for (int i = 0; i < BSP_HEADER_LUMPS; i++)
+    {
+        if (i == LUMP_PAKFILE || header.lumps[i].filelen == 0)
+            continue;
+
+        if (header.lumps[i].fileofs + header.lumps[i].filelen > pakLump.fileofs)
+            return false;
+    }
+    return true;
+}
+
+// Записывает BSP с новым pak за один проход через временный файл.
+// Если pak последний (обычный случай), хвост файла заменяется новым архивом;
+// иначе все лампы остаются на своих местах, а архив дописывается в конец,
+// чтобы не сдвигать лампы с абсолютными смещениями (LUMP_GAME_LUMP).
+bool BSPFile::WriteWithPakfile(const std::vector<unsigned char>& pakData)
+{
+    std::string tempPath = MakeTempPath(path);
+
+    BSPHeader newHeader = header;
+    size_t keepSize = mapping.GetSize();
+    if (IsPakfileLastLump() && header.lumps[LUMP_PAKFILE].filelen > 0)
+    {
+        keepSize = header.lumps[LUMP_PAKFILE].fileofs;
+    }
+    else if (header.lumps[LUMP_PAKFILE].filelen > 0)
+    {
+        std::cout << "Pakfile is not the last lump, appending new pakfile to the end of the BSP" << std::endl;
+    }
+
+    size_t padding = (4 - keepSize % 4) % 4;
+    newHeader.lumps[LUMP_PAKFILE].fileofs = static_cast<int>(keepSize + padding);
+    newHeader.lumps[LUMP_PAKFILE].filelen = static_cast<int>(pakData.size());
+
+    {
+        std::ofstream file(tempPath, std::ios::binary);
+        if (!file)
+        {
+            std::cout << "Error: Cannot create file " << tempPath << std::endl;
+            return false;
+        }
+
+        static const char zeros[4] = {};
+        file.write(reinterpret_cast<const char*>(&newHeader), sizeof(newHeader));
+        file.write(reinterpret_cast<const char*>(mapping.GetData()) + sizeof(newHeader), keepSize - sizeof(newHeader));
+        file.write(zeros, padding);
+        file.write(reinterpret_cast<const char*>(pakData.data()), pakData.size());
+
+        if (!file)
+        {
+            std::cout << "Error: Failed to write " << tempPath << std::endl;
+            file.close();
+            fs::remove(tempPath);
+            return false;
+        }
+    }
+
+    // Отображение держит исходный файл открытым, а Windows не даёт заменить такой файл
+    mapping.Close();
+
+    try
+    {
+        fs::rename(tempPath, path);
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "Failed to replace original BSP: " << e.what() << std::endl;
+        fs::remove(tempPath);
+        return false;
+    }
+
+    header = newHeader;
+    return true;
+}
+
+// Обновляет pak на месте, когда он последний ламп в файле. Записи до первой
+// заменяемой остаются на своих местах; переписывается только хвост архива:
+// сдвинутые записи, новые записи, центральный каталог и EOCD. Затем
+// обновляется заголовок BSP и файл обрезается или удлиняется до нового размера.
+#pragma pack(push, 1)
+
+struct PakfileUndoHeader
+{
+    int ident;
+    int mapRevision;            // тот же BSP, а не пересобранный vbsp
+    uint64_t tailOffset;
+    uint64_t fileSize;
+    BSPLump pakLump;
+};
+
+#pragma pack(pop)
+
+#define PAKFILE_UNDO_IDENT  (('U' << 24) + ('K' << 16) + ('A' << 8) + 'P')
+
+bool BSPFile::UpdatePakfileInPlace(const std::vector<PakEntry>& newEntries, size_t& bytesWritten, const PakfileUndoCallback& saveUndo)
+{
+    bytesWritten = 0;
+
+    if (!IsPakfileLastLump())
+    {
+        std::cout << "Pakfile is not the last lump, in-place update is not possible" << std::endl;
+        return false;
+    }
+
+    const BSPLump& pakLump = header.lumps[LUMP_PAKFILE];
+    const unsigned char* pakData = mapping.GetData() + pakLump.fileofs;
+
+    PakFile existing;
+    if (pakLump.filelen > 0 && !existing.Parse(pakData, pakLump.filelen, false))
+    {
+        std::cout << "Failed to read pakfile directory: " << path << std::endl;
+        return false;
+    }
+
+    std::map<std::string, const PakEntry*> replacements;
+    for (const auto& entry : newEntries)
+    {
+        replacements[PakIndexKey(entry.name)] = &entry;
+    }
+
+    // Граница, с которой архив переписывается
+    uint32_t rewriteFrom = pakLump.filelen > 0 ? existing.GetCentralDirectoryOffset() : 0;
+    for (const auto& entry : existing.GetEntries())
+    {
+        if (replacements.find(PakIndexKey(entry.name)) != replacements.end())
+        {
+            rewriteFrom = std::min(rewriteFrom, entry.localHeaderOffset);
+        }
+    }
+
+    // Итоговый порядок записей: нетронутые, сдвинутые, новые
+    std::vector<PakEntry> directory;
+    std::vector<unsigned char> tail;
+
+    auto appendLocal = [&tail](const PakEntry& entry)
+    {
+        ZipLocalFileHeader local = {};
+        local.signature = 0x04034b50;
+        local.versionNeeded = GetZipVersionNeeded(entry);
+        local.flags = entry.flags;
+        local.compressionMethod = entry.compressionMethod;
+        local.lastModifiedTime = entry.lastModifiedTime;
+        local.lastModifiedDate = entry.lastModifiedDate;
+        local.crc32 = entry.crc32;
+        local.compressedSize = static_cast<uint32_t>(entry.data.size());
+        local.uncompressedSize = entry.uncompressedSize;
+        local.fileNameLength = static_cast<uint16_t>(entry.name.size());
+
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&local);
+        tail.insert(tail.end(), bytes, bytes + sizeof(local));
+        tail.insert(tail.end(), entry.name.begin(), entry.name.end());
+        tail.insert(tail.end(), entry.data.begin(), entry.data.end());
+    };
+
+    for (const auto& entry : existing.GetEntries())
+    {
+        if (replacements.find(PakIndexKey(entry.name)) != replacements.end())
+            continue;
+
+        PakEntry kept = entry;
+        if (entry.localHeaderOffset >= rewriteFrom)
+        {
+            // Запись попала в переписываемый хвост: переносим её байты как есть
+            kept.localHeaderOffset = rewriteFrom + static_cast<uint32_t>(tail.size());
+            tail.insert(tail.end(), pakData + entry.localHeaderOffset, pakData + entry.localHeaderOffset + entry.recordSize);
+        }
+        directory.push_back(kept);
+    }
+
+    for (const auto& entry : newEntries)
+    {
+        PakEntry added = entry;
+        added.localHeaderOffset = rewriteFrom + static_cast<uint32_t>(tail.size());
+        added.compressedSize = static_cast<uint32_t>(entry.data.size());
+        appendLocal(entry);
+        added.data.clear();
+        directory.push_back(added);
+    }
+
+    uint32_t cdOffset = rewriteFrom + static_cast<uint32_t>(tail.size());
+    for (const auto& entry : directory)
+    {
+        ZipCentralDirectoryHeader cd = {};
+        cd.signature = 0x02014b50;
+        cd.versionMadeBy = 20;
+        cd.versionNeeded = GetZipVersionNeeded(entry);
+        cd.flags = entry.flags;
+        cd.compressionMethod = entry.compressionMethod;
+        cd.lastModifiedTime = entry.lastModifiedTime;
+        cd.lastModifiedDate = entry.lastModifiedDate;
+        cd.crc32 = entry.crc32;
+        cd.compressedSize = entry.compressedSize;
+        cd.uncompressedSize = entry.uncompressedSize;
+        cd.fileNameLength = static_cast<uint16_t>(entry.name.size());
+        cd.relativeOffsetOfLocalHeader = entry.localHeaderOffset;
+
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&cd);
+        tail.insert(tail.end(), bytes, bytes + sizeof(cd));
+        tail.insert(tail.end(), entry.name.begin(), entry.name.end());
+    }
+
+    ZipEndOfCentralDirectory eocd = {};
+    eocd.signature = 0x06054b50;
+    eocd.entriesOnThisDisk = static_cast<uint16_t>(directory.size());
+    eocd.totalEntries = static_cast<uint16_t>(directory.size());
+    eocd.centralDirectorySize = rewriteFrom + static_cast<uint32_t>(tail.size()) - cdOffset;
+    eocd.centralDirectoryOffset = cdOffset;
+    const unsigned char* eocdBytes = reinterpret_cast<const unsigned char*>(&eocd);
+    tail.insert(tail.end(), eocdBytes, eocdBytes + sizeof(eocd));
+
+    BSPHeader newHeader = header;
+    newHeader.lumps[LUMP_PAKFILE].filelen = static_cast<int>(rewriteFrom + tail.size());
+
+    uint64_t tailOffset = static_cast<uint64_t>(pakLump.fileofs) + rewriteFrom;
+    uint64_t newSize = tailOffset + tail.size();
+
+    // Всё, что будет перезаписано, сохраняется до первой записи
+    if (saveUndo)
+    {
+        PakfileUndoHeader undoHeader = {};
+        undoHeader.ident = PAKFILE_UNDO_IDENT;
+        undoHeader.mapRevision = header.mapRevision;
+        undoHeader.tailOffset = tailOffset;
+        undoHeader.fileSize = mapping.GetSize();
+        undoHeader.pakLump = pakLump;
+
+        std::vector<unsigned char> undo(sizeof(undoHeader));
+        memcpy(undo.data(), &undoHeader, sizeof(undoHeader));
+        undo.insert(undo.end(), mapping.GetData() + tailOffset, mapping.GetData() + mapping.GetSize());
+        if (!saveUndo(undo))
+        {
+            std::cout << "Error: Failed to save pakfile undo data, BSP was not modified: " << path << std::endl;
+            return false;
+        }
+    }
+
+    mapping.Close();
+
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        if (!file)
+        {
+            std::cout << "Error: Cannot open BSP for writing: " << path << std::endl;
+            return false;
+        }
+
+        file.seekp(static_cast<std::streamoff>(tailOffset));
+        file.write(reinterpret_cast<const char*>(tail.data()), tail.size());
+
+        file.seekp(offsetof(BSPHeader, lumps) + LUMP_PAKFILE * sizeof(BSPLump));
+        file.write(reinterpret_cast<const char*>(&newHeader.lumps[LUMP_PAKFILE]), sizeof(BSPLump));
+
+        if (!file)
+        {
+            std::cout << "Error: Failed to write pakfile into " << path << std::endl;
+            return false;
+        }
+    }
+
+    try
+    {
+        fs::resize_file(path, newSize);
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "Failed to resize BSP: " << e.what() << std::endl;
+        return false;
+    }
+
+    if (!SyncFileToDisk(path))
+    {
+        std::cout << "Error: Failed to flush pakfile update to disk: " << path << std::endl;
+        return false;
+    }
+
+    header = newHeader;
+    bytesWritten = tail.size() + sizeof(BSPLump);
+    return true;
+}
+
+bool BSPFile::RevertPakfileUpdate(const std::string& filename, const std::vector<unsigned char>& undo)
+{
+    PakfileUndoHeader undoHeader;
+    if (undo.size() < sizeof(undoHeader))
+    {
+        std::cout << "Error: Invalid pakfile undo data for " << filename << std::endl;
+        return false;
+    }
+
+    memcpy(&undoHeader, undo.data(), sizeof(undoHeader));
+    if (undoHeader.ident != PAKFILE_UNDO_IDENT || undoHeader.tailOffset + (undo.size() - sizeof(undoHeader)) != undoHeader.fileSize)
+    {
+        std::cout << "Error: Invalid pakfile undo data for " << filename << std::endl;
+        return false;
+    }
+
+    std::fstream file(filename, std::ios::binary | std::ios::in | std::ios::out);
+    BSPHeader current;
+    if (!file || !file.read(reinterpret_cast<char*>(&current), sizeof(current)))
+    {
+        std::cout << "Error: Cannot open BSP for writing: " << filename << std::endl;
+        return false;
+    }
+
+    // Заголовок пишется последним, поэтому ламп может указывать на старый или на новый pak,
+    // но начинаться он должен там же
+    if (current.mapRevision != undoHeader.mapRevision || current.lumps[LUMP_PAKFILE].fileofs != undoHeader.pakLump.fileofs)
+    {
+        std::cout << "Error: " << filename << " was rebuilt after the pakfile update, undo data does not apply" << std::endl;
+        return false;
+    }
+
+    file.seekp(static_cast<std::streamoff>(undoHeader.tailOffset));
+    file.write(reinterpret_cast<const char*>(undo.data() + sizeof(undoHeader)), undo.size() - sizeof(undoHeader));
+    file.seekp(offsetof(BSPHeader, lumps) + LUMP_PAKFILE * sizeof(BSPLump));
+    file.write(reinterpret_cast<const char*>(&undoHeader.pakLump), sizeof(BSPLump));
+    file.close();
+
+    if (!file)
+    {
+        std::cout << "Error: Failed to restore pakfile in " << filename << std::endl;
+        return false;
+    }
+
+    try
+    {
+        fs::resize_file(filename, undoHeader.fileSize);
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "Failed to resize BSP: " << e.what() << std::endl;
+        return false;
+    }
+
+    if (!SyncFileToDisk(filename))
+    {
+        std::cout << "Error: Failed to flush restored pakfile to disk: " << filename << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool BSPFile::ReadGameLump(int id, std::vector<unsigned char>& data, uint16_t& version) const
+{
+    const BSPLump& lump = header.lumps[LUMP_GAME_LUMP];
+    if (lump.filelen < static_cast<int>(sizeof(int)) || static_cast<size_t>(lump.fileofs) + lump.filelen > mapping.GetSize())
+    {
+        std::cout << "Error: BSP has no game lump: " << path << std::endl;
+        return false;
+    }
+
+    const unsigned char* lumpData = mapping.GetData() + lump.fileofs;
+    int count;
+    memcpy(&count, lumpData, sizeof(count));
+    if (count < 0 || sizeof(int) + count * sizeof(GameLumpHeader) > static_cast<size_t>(lump.filelen))
+    {
+        std::cout << "Error: Invalid game lump directory in " << path << std::endl;
+        return false;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        GameLumpHeader gameLump;
+        memcpy(&gameLump, lumpData + sizeof(int) + i * sizeof(GameLumpHeader), sizeof(gameLump));
+        if (gameLump.id != id)
+            continue;
+
+        if (gameLump.flags & GAMELUMP_FLAG_COMPRESSED)
+        {
+            std::cout << "Error: Compressed game lumps are not supported: " << path << std::endl;
+            return false;
+        }
+
+        if (gameLump.fileofs < 0 || gameLump.filelen < 0 || static_cast<size_t>(gameLump.fileofs) + gameLump.filelen > mapping.GetSize())
+        {
+            std::cout << "Error: Invalid game lump offset in " << path << std::endl;
+            return false;
+        }
+
+        data.assign(mapping.GetData() + gameLump.fileofs, mapping.GetData() + gameLump.fileofs + gameLump.filelen);
+        version = gameLump.version;
+        return true;
+    }
+
+    std::cout << "Error: Game lump not found in " << path << std::endl;
+    return false;
+}
+
+// Собирает новый LUMP_GAME_LUMP с заменённым игровым лампом. Смещения внутри
+// считаются от начала лампа и переводятся в абсолютные при записи файла.
+bool BSPFile::WriteWithGameLump(int id, const std::vector<unsigned char>& data)
+{
+    const BSPLump& lump = header.lumps[LUMP_GAME_LUMP];
+    const unsigned char* lumpData = mapping.GetData() + lump.fileofs;
+
+    int count;
+    memcpy(&count, lumpData, sizeof(count));
+
+    std::vector<GameLumpHeader> directory(count);
+    memcpy(directory.data(), lumpData + sizeof(int), count * sizeof(GameLumpHeader));
+
+    std::vector<unsigned char> newLump(sizeof(int) + count * sizeof(GameLumpHeader));
+    memcpy(newLump.data(), &count, sizeof(count));
+
+    for (auto& gameLump : directory)
+    {
+        const unsigned char* source = mapping.GetData() + gameLump.fileofs;
+        size_t length = gameLump.filelen;
+        if (gameLump.id == id)
+        {
+            source = data.data();
+            length = data.size();
+        }
+
+        gameLump.fileofs = static_cast<int>(newLump.size());
+        gameLump.filelen = static_cast<int>(length);
+        newLump.insert(newLump.end(), source, source + length);
+    }
+    memcpy(newLump.data() + sizeof(int), directory.data(), count * sizeof(GameLumpHeader));
+
+    std::map<int, std::vector<unsigned char>> replacements;
+    replacements[LUMP_GAME_LUMP] = std::move(newLump);
+    return WriteWithLumps(replacements);
+}
+
+// Полная перезапись BSP: лампы пишутся в прежнем порядке с выравниванием по 4,
+// pak всегда последним, чтобы его дальше можно было обновлять на месте.
+// replacements[LUMP_GAME_LUMP] должен содержать смещения от начала лампа.
+bool BSPFile::WriteWithLumps(const std::map<int, std::vector<unsigned char>>& replacements)
+{
+    std::vector<int> order;
+    for (int i = 0; i < BSP_HEADER_LUMPS; i++)
+    {
+        if (header.lumps[i].filelen > 0 || replacements.find(i) != replacements.end())
+        {
+            order.push_back(i);
+        }
+    }
+
+    std::sort(order.begin(), order.end(), [this](int a, int b)
+    {
+        if ((a == LUMP_PAKFILE) != (b == LUMP_PAKFILE))
+            return b == LUMP_PAKFILE;
+        return header.lumps[a].fileofs < header.lumps[b].fileofs;
+    });
+
+    BSPHeader newHeader = header;
+    for (int i = 0; i < BSP_HEADER_LUMPS; i++)
+    {
+        newHeader.lumps[i].fileofs = 0;
+        newHeader.lumps[i].filelen = 0;
+    }
+
+    std::vector<unsigned char> output(sizeof(BSPHeader));
+    for (int index : order)
+    {
+        output.resize((output.size() + 3) & ~static_cast<size_t>(3));
+
+        std::vector<unsigned char> lumpData;
+        auto replacement = replacements.find(index);
+        if (replacement != replacements.end())
+        {
+            lumpData = replacement->second;
+        }
+        else
+        {
+            const BSPLump& lump = header.lumps[index];
+            lumpData.assign(mapping.GetData() + lump.fileofs, mapping.GetData() + lump.fileofs + lump.filelen);
+        }
+
+        // Смещения игровых лампов абсолютные: переводим их под новое положение лампа
+        if (index == LUMP_GAME_LUMP && lumpData.size() >= sizeof(int))
+        {
+            int base = replacement != replacements.end() ? 0 : header.lumps[index].fileofs;
+            int delta = static_cast<int>(output.size()) - base;
+
+            int count;
+            memcpy(&count, lumpData.data(), sizeof(count));
+            for (int i = 0; i < count && sizeof(int) + (i + 1) * sizeof(GameLumpHeader) <= lumpData.size(); i++)
+            {
+                GameLumpHeader gameLump;
+                unsigned char* entry = lumpData.data() + sizeof(int) + i * sizeof(GameLumpHeader);
+                memcpy(&gameLump, entry, sizeof(gameLump));
+                gameLump.fileofs += delta;
+                memcpy(entry, &gameLump, sizeof(gameLump));
+            }
+        }
+
+        newHeader.lumps[index].fileofs = static_cast<int>(output.size());
+        newHeader.lumps[index].filelen = static_cast<int>(lumpData.size());
+        output.insert(output.end(), lumpData.begin(), lumpData.end());
+    }
+    memcpy(output.data(), &newHeader, sizeof(newHeader));
+
+    std::string tempPath = MakeTempPath(path);
+    {
+        std::ofstream file(tempPath, std::ios::binary);
+        if (!file)
+        {
+            std::cout << "Error: Cannot create file " << tempPath << std::endl;
+            return false;
+        }
+
+        file.write(reinterpret_cast<const char*>(output.data()), output.size());
+        if (!file)
+        {
+            std::cout << "Error: Failed to write " << tempPath << std::endl;
+            file.close();
+            fs::remove(tempPath);
+            return false;
+        }
+    }
+
+    mapping.Close();
+
+    try
+    {
+        fs::rename(tempPath, path);
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "Failed to replace original BSP: " << e.what() << std::endl;
+        fs::remove(tempPath);
+        return false;
+    }
+
+    header = newHeader;
+    return true;
+}
+
+// Смещения полей в записи статического пропа
+#define STATIC_PROP_ORIGIN      0
+#define STATIC_PROP_ANGLES      12
+#define STATIC_PROP_PROPTYPE    24
+#define STATIC_PROP_SKIN        32
+#define STATIC_PROP_DIFFUSE     64
+
+bool StaticPropLump::Parse(const std::vector<unsigned char>& data, uint16_t lumpVersion)
+{
+    version = lumpVersion;
+    modelNames.clear();
+
+    if (version < 4 || version > 11)
+    {
+        std::cout << "Error: Unsupported static prop lump version " << version << std::endl;
+        return false;
+    }
+
+    size_t pos = 0;
+    auto readInt = [&data, &pos](int& value)
+    {
+        if (pos + sizeof(value) > data.size())
+            return false;
+        memcpy(&value, data.data() + pos, sizeof(value));
+        pos += sizeof(value);
+        return true;
+    };
+
+    int nameCount;
+    if (!readInt(nameCount) || nameCount < 0 || pos + static_cast<size_t>(nameCount) * STATIC_PROP_NAME_LENGTH > data.size())
+    {
+        std::cout << "Error: Invalid static prop model dictionary" << std::endl;
+        return false;
+    }
+
+    for (int i = 0; i < nameCount; i++)
+    {
+        const char* name = reinterpret_cast<const char*>(data.data() + pos);
+        modelNames.emplace_back(name, strnlen(name, STATIC_PROP_NAME_LENGTH));
+        pos += STATIC_PROP_NAME_LENGTH;
+    }
+
+    int leafCount;
+    if (!readInt(leafCount) || leafCount < 0 || pos + static_cast<size_t>(leafCount) * sizeof(uint16_t) > data.size())
+    {
+        std::cout << "Error: Invalid static prop leaf list" << std::endl;
+        return false;
+    }
+    leafData.assign(data.begin() + pos, data.begin() + pos + leafCount * sizeof(uint16_t));
+    pos += leafData.size();
+
+    int count;
+    if (!readInt(count) || count < 0)
+    {
+        std::cout << "Error: Invalid static prop count" << std::endl;
+        return false;
+    }
+
+    propCount = count;
+    propData.assign(data.begin() + pos, data.end());
+    propSize = propCount > 0 ? propData.size() / propCount : 0;
+
+    if (propCount > 0 && (propData.size() % propCount != 0 || propSize < STATIC_PROP_SKIN + sizeof(int)))
+    {
+        std::cout << "Error: Unexpected static prop entry size in lump version " << version << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+std::vector<unsigned char> StaticPropLump::Serialize() const
+{
+    std::vector<unsigned char> result;
+    auto appendInt = [&result](int value)
+    {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+        result.insert(result.end(), bytes, bytes + sizeof(value));
+    };
+
+    appendInt(static_cast<int>(modelNames.size()));
+    for (const auto& name : modelNames)
+    {
+        size_t start = result.size();
+        result.resize(start + STATIC_PROP_NAME_LENGTH, 0);
+        memcpy(result.data() + start, name.data(), std::min<size_t>(name.size(), STATIC_PROP_NAME_LENGTH - 1));
+    }
+
+    appendInt(static_cast<int>(leafData.size() / sizeof(uint16_t)));
+    result.insert(result.end(), leafData.begin(), leafData.end());
+
+    appendInt(static_cast<int>(propCount));
+    result.insert(result.end(), propData.begin(), propData.end());
+    return result;
+}
+
+uint16_t StaticPropLump::AddModelName(const std::string& name)
+{
+    for (size_t i = 0; i < modelNames.size(); i++)
+    {
+        if (modelNames[i] == name)
+            return static_cast<uint16_t>(i);
+    }
+
+    modelNames.push_back(name);
+    return static_cast<uint16_t>(modelNames.size() - 1);
+}
+
+void StaticPropLump::GetOrigin(size_t index, float origin[3]) const
+{
+    memcpy(origin, propData.data() + index * propSize + STATIC_PROP_ORIGIN, sizeof(float) * 3);
+}
+
+void StaticPropLump::GetAngles(size_t index, float angles[3]) const
+{
+    memcpy(angles, propData.data() + index * propSize + STATIC_PROP_ANGLES, sizeof(float) * 3);
+}
+
+uint16_t StaticPropLump::GetPropType(size_t index) const
+{
+    uint16_t propType;
+    memcpy(&propType, propData.data() + index * propSize + STATIC_PROP_PROPTYPE, sizeof(propType));
+    return propType;
+}
+
+void StaticPropLump::SetPropType(size_t index, uint16_t propType)
+{
+    memcpy(propData.data() + index * propSize + STATIC_PROP_PROPTYPE, &propType, sizeof(propType));
+}
+
+int StaticPropLump::GetSkin(size_t index) const
+{
+    int skin;
+    memcpy(&skin, propData.data() + index * propSize + STATIC_PROP_SKIN, sizeof(skin));
+    return skin;
+}
+
+void StaticPropLump::SetSkin(size_t index, int skin)
+{
+    memcpy(propData.data() + index * propSize + STATIC_PROP_SKIN, &skin, sizeof(skin));
+}
+
+bool StaticPropLump::HasDiffuseModulation() const
+{
+    if (version == 10 && propSize == 72)
+    {
+        return false;
+    }
+
+    return version >= 7 && propSize >= STATIC_PROP_DIFFUSE + 4;
+}
+
+void StaticPropLump::SetDiffuseModulation(size_t index, const unsigned char rgba[4])
+{
+    if (HasDiffuseModulation())
+    {
+        memcpy(propData.data() + index * propSize + STATIC_PROP_DIFFUSE, rgba, 4);
+    }
+}
@@ -0,0 +1,239 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <map>
+#include <functional>
+#include <cstdint>
+
+#include "MappedFile.h"
+
+// BSP:
+// https://developer.valvesoftware.com/wiki/BSP_(Source)
+//
+#define BSP_IDENT           (('P' << 24) + ('S' << 16) + ('B' << 8) + 'V')
+#define BSP_HEADER_LUMPS    64
+#define LUMP_GAME_LUMP      35
+#define LUMP_PAKFILE        40
+
+// Игровые лампы:
+// https://developer.valvesoftware.com/wiki/BSP_(Source)#Game_lump
+//
+#define GAMELUMP_STATIC_PROPS       (('s' << 24) + ('p' << 16) + ('r' << 8) + 'p')
+#define GAMELUMP_FLAG_COMPRESSED    0x0001
+#define STATIC_PROP_NAME_LENGTH     128
+
+#pragma pack(push, 1)
+
+struct BSPLump
+{
+    int fileofs;
+    int filelen;
+    int version;
+    char fourCC[4];
+};
+
+struct BSPHeader
+{
+    int ident;
+    int version;
+    BSPLump lumps[BSP_HEADER_LUMPS];
+    int mapRevision;
+};
+
+struct ZipLocalFileHeader
+{
+    uint32_t signature;         // 0x04034b50
+    uint16_t versionNeeded;
+    uint16_t flags;
+    uint16_t compressionMethod;
+    uint16_t lastModifiedTime;
+    uint16_t lastModifiedDate;
+    uint32_t crc32;
+    uint32_t compressedSize;
+    uint32_t uncompressedSize;
+    uint16_t fileNameLength;
+    uint16_t extraFieldLength;
+};
+
+struct ZipCentralDirectoryHeader
+{
+    uint32_t signature;         // 0x02014b50
+    uint16_t versionMadeBy;
+    uint16_t versionNeeded;
+    uint16_t flags;
+    uint16_t compressionMethod;
+    uint16_t lastModifiedTime;
+    uint16_t lastModifiedDate;
+    uint32_t crc32;
+    uint32_t compressedSize;
+    uint32_t uncompressedSize;
+    uint16_t fileNameLength;
+    uint16_t extraFieldLength;
+    uint16_t fileCommentLength;
+    uint16_t diskNumberStart;
+    uint16_t internalFileAttributes;
+    uint32_t externalFileAttributes;
+    uint32_t relativeOffsetOfLocalHeader;
+};
+
+struct ZipEndOfCentralDirectory
+{
+    uint32_t signature;         // 0x06054b50
+    uint16_t numberOfThisDisk;
+    uint16_t diskWithCentralDirectory;
+    uint16_t entriesOnThisDisk;
+    uint16_t totalEntries;
+    uint32_t centralDirectorySize;
+    uint32_t centralDirectoryOffset;
+    uint16_t commentLength;
+};
+
+struct GameLumpHeader
+{
+    int id;
+    uint16_t flags;
+    uint16_t version;
+    int fileofs;                // от начала файла BSP, а не лампа
+    int filelen;
+};
+
+#pragma pack(pop)
+
+uint32_t CRC32(const void* data, size_t size, uint32_t crc = 0);
+
+// Методы сжатия zip, которые понимает движок
+#define ZIP_METHOD_STORE    0
+#define ZIP_METHOD_DEFLATE  8
+#define ZIP_METHOD_LZMA     14
+
+enum class PakCodec
+{
+    Store,
+    Deflate,
+    LZMA,
+};
+
+bool ParsePakCodec(const std::string& name, PakCodec& codec);
+const char* GetPakCodecName(PakCodec codec);
+bool IsPakCodecAvailable(PakCodec codec);
+
+struct PakEntry
+{
+    std::string name;                   // путь внутри pak, прямые слеши
+    uint16_t compressionMethod = ZIP_METHOD_STORE;
+    uint16_t flags = 0;
+    uint16_t lastModifiedTime = 0;
+    uint16_t lastModifiedDate = 0x0021; // 01.01.1980: одинаково на всех машинах
+    uint32_t crc32 = 0;
+    uint32_t uncompressedSize = 0;
+    std::vector<unsigned char> data;    // данные в том виде, как они лежат в архиве
+
+    // Заполняются при чтении существующего архива
+    uint32_t localHeaderOffset = 0;
+    uint32_t compressedSize = 0;
+    uint32_t recordSize = 0;            // локальный заголовок + имя + extra + данные
+};
+
+// Zip-архив LUMP_PAKFILE
+class PakFile
+{
+private:
+    std::vector<PakEntry> entries;
+    std::map<std::string, size_t> entryIndex;
+    uint32_t centralDirectoryOffset = 0;
+
+public:
+    // loadData = false читает только центральный каталог, без копирования данных файлов
+    bool Parse(const unsigned char* data, size_t size, bool loadData = true);
+    void AddOrReplace(const std::string& name, std::vector<unsigned char> data);
+    void AddOrReplace(PakEntry entry);
+    std::vector<unsigned char> Serialize() const;
+
+    const std::vector<PakEntry>& GetEntries() const { return entries; }
+    const PakEntry* FindEntry(const std::string& name) const;
+    uint32_t GetCentralDirectoryOffset() const { return centralDirectoryOffset; }
+
+    static PakEntry MakeEntry(const std::string& name, std::vector<unsigned char> data);
+    static std::string NormalizeName(const std::string& name);
+};
+
+// Сжимает записи на пуле потоков. Записи меньше minSize и записи, которые
+// не стали меньше после сжатия, остаются несжатыми. Порядок записей не меняется.
+void CompressPakEntries(std::vector<PakEntry>& entries, PakCodec codec, size_t minSize, unsigned int threadCount = 0);
+
+uint16_t GetZipVersionNeeded(const PakEntry& entry);
+
+// Игровой ламп sprp: словарь моделей, список листьев и записи пропов.
+// Начало записи одинаково во всех версиях (4-11), размер записи
+// вычисляется из размера лампа, поэтому остальные поля переносятся как есть.
+class StaticPropLump
+{
+private:
+    uint16_t version = 0;
+    std::vector<std::string> modelNames;
+    std::vector<unsigned char> leafData;
+    std::vector<unsigned char> propData;
+    size_t propCount = 0;
+    size_t propSize = 0;
+
+public:
+    bool Parse(const std::vector<unsigned char>& data, uint16_t lumpVersion);
+    std::vector<unsigned char> Serialize() const;
+
+    size_t GetPropCount() const { return propCount; }
+    size_t GetPropSize() const { return propSize; }
+    const std::vector<std::string>& GetModelNames() const { return modelNames; }
+    uint16_t AddModelName(const std::string& name);
+
+    void GetOrigin(size_t index, float origin[3]) const;
+    void GetAngles(size_t index, float angles[3]) const;
+    uint16_t GetPropType(size_t index) const;
+    void SetPropType(size_t index, uint16_t propType);
+    int GetSkin(size_t index) const;
+    void SetSkin(size_t index, int skin);
+
+    // color32 m_DiffuseModulation есть в версиях 7-9, 11 и в версии 10 из CS:GO (76 байт).
+    // В версии 10 из SDK 2013 (72 байта) по тому же смещению лежат m_Flags
+    bool HasDiffuseModulation() const;
+    void SetDiffuseModulation(size_t index, const unsigned char rgba[4]);
+};
+
+// Откат обновления pak на месте: прежние байты хвоста, прежняя запись лампа и размер файла
+using PakfileUndoCallback = std::function<bool(const std::vector<unsigned char>& undo)>;
+
+class BSPFile
+{
+private:
+    std::string path;
+    MappedFile mapping;
+    BSPHeader header;
+
+public:
+    bool Load(const std::string& filename);
+    void Close() { mapping.Close(); }
+    bool ReadPakfile(PakFile& pak, bool loadData = true) const;
+    const unsigned char* GetPakEntryData(const PakEntry& entry) const;
+    bool WriteWithPakfile(const std::vector<unsigned char>& pakData);
+    // saveUndo получает данные отката до первой записи в файл; false отменяет обновление
+    bool UpdatePakfileInPlace(const std::vector<PakEntry>& newEntries, size_t& bytesWritten, const PakfileUndoCallback& saveUndo = nullptr);
+    bool ReadGameLump(int id, std::vector<unsigned char>& data, uint16_t& version) const;
+    bool WriteWithGameLump(int id, const std::vector<unsigned char>& data);
+
+    const BSPHeader& GetHeader() const { return header; }
+    bool IsPakfileLastLump() const;
+
+    // Возвращает BSP в состояние до прерванного UpdatePakfileInPlace
+    static bool RevertPakfileUpdate(const std::string& filename, const std::vector<unsigned char>& undo);
+
+private:
+    bool ValidateHeader();
+    bool WriteWithLumps(const std::map<int, std::vector<unsigned char>>& replacements);
+};
@@ -0,0 +1,243 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#include "BufferedWriter.h"
+
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <cerrno>
+#endif
+
+namespace fs = std::filesystem;
+
+bool BufferedWriter::Open(const std::string& filename, size_t bufferSize)
+{
+    this->bufferSize = bufferSize;
+    Abort();
+
+    path = filename;
+    tempPath = MakeTempPath(filename);
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    fileHandle = file == INVALID_HANDLE_VALUE ? nullptr : file;
+#else
+    fileDescriptor = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+
+    if (!IsFileOpen())
+    {
+        std::cout << "Error: Cannot create file " << tempPath << std::endl;
+        tempPath.clear();
+        return false;
+    }
+
+    used = 0;
+    totalWritten = 0;
+    failed = false;
+    return true;
+}
+
+bool BufferedWriter::IsFileOpen() const
+{
+#if defined(_WIN32)
+    return fileHandle != nullptr;
+#else
+    return fileDescriptor >= 0;
+#endif
+}
+
+void BufferedWriter::CloseFile()
+{
+#if defined(_WIN32)
+    if (fileHandle)
+        CloseHandle(fileHandle);
+    fileHandle = nullptr;
+#else
+    if (fileDescriptor >= 0)
+        close(fileDescriptor);
+    fileDescriptor = -1;
+#endif
+}
+
+bool BufferedWriter::WriteDirect(const char* data, size_t size)
+{
+    while (size > 0 && !failed)
+    {
+#if defined(_WIN32)
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+        DWORD written = 0;
+        if (!WriteFile(fileHandle, data, chunk, &written, NULL))
+        {
+            failed = true;
+            break;
+        }
+#else
+        ssize_t written = write(fileDescriptor, data, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            failed = true;
+            break;
+        }
+#endif
+        data += written;
+        size -= written;
+    }
+    return !failed;
+}
+
+void BufferedWriter::Write(const void* data, size_t size)
+{
+    if (failed || !IsFileOpen())
+        return;
+
+    const char* bytes = static_cast<const char*>(data);
+    totalWritten += size;
+
+    // Крупные куски идут мимо буфера, чтобы не копировать их лишний раз
+    if (size >= bufferSize)
+    {
+        if (Flush())
+            WriteDirect(bytes, size);
+        return;
+    }
+
+    if (used + size > bufferSize && !Flush())
+        return;
+
+    if (buffer.empty())
+        buffer.resize(bufferSize);
+
+    memcpy(buffer.data() + used, bytes, size);
+    used += size;
+}
+
+void BufferedWriter::WriteGather(const std::vector<std::string_view>& slices)
+{
+    if (failed || !IsFileOpen() || !Flush())
+        return;
+
+#if defined(_WIN32)
+    // WriteFileGather требует выровненных по странице буферов, поэтому здесь
+    // мелкие куски собираются в буфер, а крупные пишутся напрямую
+    for (const auto& slice : slices)
+    {
+        Write(slice.data(), slice.size());
+    }
+#else
+    std::vector<iovec> vectors;
+    vectors.reserve(std::min<size_t>(slices.size(), IOV_MAX));
+
+    size_t index = 0;
+    while (index < slices.size() && !failed)
+    {
+        vectors.clear();
+        size_t batchSize = 0;
+        for (; index < slices.size() && vectors.size() < IOV_MAX; index++)
+        {
+            if (slices[index].empty())
+                continue;
+            vectors.push_back({ const_cast<char*>(slices[index].data()), slices[index].size() });
+            batchSize += slices[index].size();
+        }
+
+        size_t first = 0;
+        while (batchSize > 0)
+        {
+            ssize_t written = writev(fileDescriptor, vectors.data() + first, static_cast<int>(vectors.size() - first));
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                failed = true;
+                break;
+            }
+
+            totalWritten += written;
+            batchSize -= written;
+
+            // Частичная запись: пропускаем записанные куски и сдвигаем начало текущего
+            size_t remaining = static_cast<size_t>(written);
+            while (first < vectors.size() && remaining >= vectors[first].iov_len)
+            {
+                remaining -= vectors[first].iov_len;
+                first++;
+            }
+            if (first < vectors.size())
+            {
+                vectors[first].iov_base = static_cast<char*>(vectors[first].iov_base) + remaining;
+                vectors[first].iov_len -= remaining;
+            }
+        }
+    }
+#endif
+}
+
+bool BufferedWriter::Flush()
+{
+    if (used > 0)
+    {
+        WriteDirect(buffer.data(), used);
+        used = 0;
+    }
+    return !failed;
+}
+
+bool BufferedWriter::Commit()
+{
+    if (!IsFileOpen())
+        return false;
+
+    Flush();
+    CloseFile();
+
+    if (failed)
+    {
+        std::cout << "Error: Failed to write " << tempPath << std::endl;
+        Abort();
+        return false;
+    }
+
+    try
+    {
+        fs::rename(tempPath, path);
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "Failed to replace " << path << ": " << e.what() << std::endl;
+        Abort();
+        return false;
+    }
+
+    tempPath.clear();
+    return true;
+}
+
+void BufferedWriter::Abort()
+{
+    CloseFile();
+
+    if (!tempPath.empty())
+    {
+        std::error_code error;
+        fs::remove(tempPath, error);
+        tempPath.clear();
+    }
+    used = 0;
+}
@@ -0,0 +1,63 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+
+#include "FileSystem.h"
+
+// Буферизованная двоичная запись через временный файл. Данные уходят на диск
+// крупными блоками, а Commit() заменяет целевой файл атомарным переименованием.
+// Без Commit() временный файл удаляется, и исходный файл остаётся нетронутым.
+class BufferedWriter : public FileWriter
+{
+public:
+    static const size_t DefaultBufferSize = 1 << 20;
+
+private:
+    std::string path;
+    std::string tempPath;
+#if defined(_WIN32)
+    void* fileHandle = nullptr;
+#else
+    int fileDescriptor = -1;
+#endif
+    std::vector<char> buffer;       // выделяется при первой мелкой записи
+    size_t bufferSize = DefaultBufferSize;
+    size_t used = 0;
+    size_t totalWritten = 0;
+    bool failed = false;
+
+public:
+    BufferedWriter() = default;
+    ~BufferedWriter() { Abort(); }
+
+    BufferedWriter(const BufferedWriter&) = delete;
+    BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+    bool Open(const std::string& filename, size_t bufferSize = DefaultBufferSize);
+    using FileWriter::Write;
+    void Write(const void* data, size_t size) override;
+
+    // Записывает куски подряд без копирования в буфер: writev там, где он есть,
+    // иначе по одному. Куски должны оставаться живыми до возврата из функции
+    void WriteGather(const std::vector<std::string_view>& slices) override;
+
+    bool Commit() override;
+    void Abort() override;
+
+    size_t GetTotalWritten() const override { return totalWritten; }
+
+private:
+    bool Flush();
+    bool WriteDirect(const char* data, size_t size);
+    bool IsFileOpen() const;
+    void CloseFile();
+};
@@ -0,0 +1,1101 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#include "FileSystem.h"
+#include "BufferedWriter.h"
+#include "AsyncIO.h"
+
+#include <iostream>
+#include <cstring>
+#include <filesystem>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <cerrno>
+#endif
+
+namespace fs = std::filesystem;
+
+void FileView::Close()
+{
+    mapping.Close();
+    buffer.reset();
+    source.reset();
+    data = nullptr;
+    size = 0;
+}
+
+bool FileSystem::Write(const std::string& path, const void* data, size_t size)
+{
+    std::unique_ptr<FileWriter> writer = OpenWrite(path);
+    if (!writer)
+        return false;
+
+    writer->Write(data, size);
+    return writer->Commit();
+}
+
+uintmax_t FileSystem::GetSize(const std::string& path)
+{
+    FileInfo info;
+    return Stat(path, info) ? info.size : 0;
+}
+
+bool FileSystem::ScanDirectory(const std::string& path, std::vector<DirectoryEntry>& entries)
+{
+    std::vector<std::string> files;
+    std::vector<std::string> directories;
+    if (!ListDirectory(path, files, directories))
+        return false;
+
+    for (const auto& name : directories)
+    {
+        DirectoryEntry entry;
+        entry.name = name;
+        entry.info.isDirectory = true;
+        entries.push_back(std::move(entry));
+    }
+
+    for (const auto& name : files)
+    {
+        DirectoryEntry entry;
+        entry.name = name;
+        if (Stat(path + "/" + name, entry.info))
+            entries.push_back(std::move(entry));
+    }
+    return true;
+}
+
+void FileSystem::ReadBatch(std::vector<ReadRequest>& requests)
+{
+    for (auto& request : requests)
+    {
+        request.result = Read(request.path, request.data);
+    }
+}
+
+bool DiskFileSystem::Exists(const std::string& path)
+{
+    std::error_code ec;
+    return fs::exists(path, ec);
+}
+
+bool DiskFileSystem::Stat(const std::string& path, FileInfo& info)
+{
+    std::error_code ec;
+    fs::file_status status = fs::status(path, ec);
+    if (ec || !fs::exists(status))
+        return false;
+
+    info.isDirectory = fs::is_directory(status);
+    info.size = info.isDirectory ? 0 : fs::file_size(path, ec);
+    info.mtime = fs::last_write_time(path, ec).time_since_epoch().count();
+    return !ec;
+}
+
+bool DiskFileSystem::Read(const std::string& path, std::vector<unsigned char>& data)
+{
+    std::error_code ec;
+    uintmax_t size = fs::file_size(path, ec);
+    if (ec)
+        return false;
+
+    // Пустой файл не отображается, но прочитан успешно
+    data.clear();
+    if (size == 0)
+        return true;
+
+    MappedFile mapping;
+    if (!mapping.Open(path))
+        return false;
+
+    data.assign(mapping.GetData(), mapping.GetData() + mapping.GetSize());
+    return true;
+}
+
+bool DiskFileSystem::Map(const std::string& path, FileView& view)
+{
+    view.Close();
+
+    std::error_code ec;
+    if (fs::file_size(path, ec) == 0 && !ec)
+    {
+        view.buffer = std::make_shared<const std::vector<unsigned char>>();
+        return true;
+    }
+
+    if (!view.mapping.Open(path))
+        return false;
+
+    view.data = view.mapping.GetData();
+    view.size = view.mapping.GetSize();
+    return true;
+}
+
+std::unique_ptr<FileWriter> DiskFileSystem::OpenWrite(const std::string& path)
+{
+    auto writer = std::make_unique<BufferedWriter>();
+    if (!writer->Open(path))
+        return nullptr;
+    return writer;
+}
+
+void DiskFileSystem::ReadBatch(std::vector<ReadRequest>& requests)
+{
+    if (!ReadFilesWithIOUring(requests))
+        FileSystem::ReadBatch(requests);
+}
+
+#if defined(__linux__)
+// Копирование внутри ядра (на NFS 4.2 и SMB - на стороне сервера).
+// false без сообщения - вызов не поддерживается, и копирует std::filesystem
+static bool CopyFileRange(const std::string& source, const std::string& destination, bool& failed)
+{
+    failed = false;
+    int sourceDescriptor = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (sourceDescriptor < 0)
+        return false;
+
+    struct stat sourceStat;
+    if (fstat(sourceDescriptor, &sourceStat) != 0 || !S_ISREG(sourceStat.st_mode))
+    {
+        close(sourceDescriptor);
+        return false;
+    }
+
+    int destinationDescriptor = open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, sourceStat.st_mode & 0777);
+    if (destinationDescriptor < 0)
+    {
+        close(sourceDescriptor);
+        return false;
+    }
+
+    off_t remaining = sourceStat.st_size;
+    int error = 0;
+    while (remaining > 0)
+    {
+        ssize_t result = copy_file_range(sourceDescriptor, nullptr, destinationDescriptor, nullptr, static_cast<size_t>(remaining), 0);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+        {
+            error = result < 0 ? errno : EIO;
+            break;
+        }
+        remaining -= result;
+    }
+
+    close(sourceDescriptor);
+    close(destinationDescriptor);
+    if (remaining == 0)
+        return true;
+
+    // Ничего не скопировано и вызов не поддерживается файловой системой - не ошибка
+    bool unsupported = error == EXDEV || error == ENOSYS || error == EINVAL || error == EOPNOTSUPP;
+    if (remaining != sourceStat.st_size || !unsupported)
+    {
+        std::cout << "Failed to copy file: " << source << " - " << strerror(error) << std::endl;
+        failed = true;
+    }
+    return false;
+}
+#endif
+
+// Копия, как и запись, заменяет цель переименованием: другой процесс, который
+// пишет или читает тот же файл, никогда не видит его наполовину скопированным
+bool DiskFileSystem::Copy(const std::string& source, const std::string& destination)
+{
+    std::string tempPath = MakeTempPath(destination);
+    bool copied = false;
+    std::error_code ec;
+
+#if defined(__linux__)
+    bool failed = false;
+    copied = CopyFileRange(source, tempPath, failed);
+    if (failed)
+    {
+        fs::remove(tempPath, ec);
+        return false;
+    }
+#endif
+
+    if (!copied)
+    {
+        fs::copy_file(source, tempPath, fs::copy_options::overwrite_existing, ec);
+        if (ec)
+        {
+            std::cout << "Failed to copy file: " << source << " - " << ec.message() << std::endl;
+            fs::remove(tempPath, ec);
+            return false;
+        }
+    }
+
+    fs::rename(tempPath, destination, ec);
+    if (ec)
+    {
+        std::cout << "Failed to replace " << destination << ": " << ec.message() << std::endl;
+        fs::remove(tempPath, ec);
+        return false;
+    }
+    return true;
+}
+
+bool DiskFileSystem::Remove(const std::string& path)
+{
+    std::error_code ec;
+    return fs::remove(path, ec);
+}
+
+uintmax_t DiskFileSystem::RemoveAll(const std::string& path)
+{
+    std::error_code ec;
+    uintmax_t removedCount = fs::remove_all(path, ec);
+    if (ec)
+    {
+        std::cout << "Failed to remove " << path << ": " << ec.message() << std::endl;
+        return 0;
+    }
+    return removedCount;
+}
+
+bool DiskFileSystem::Rename(const std::string& from, const std::string& to)
+{
+    std::error_code ec;
+    fs::rename(from, to, ec);
+    if (ec)
+    {
+        std::cout << "Failed to rename " << from << " to " << to << ": " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool DiskFileSystem::CreateDirectories(const std::string& path)
+{
+    std::error_code ec;
+    fs::create_directories(path, ec);
+    return !ec;
+}
+
+bool DiskFileSystem::ListDirectory(const std::string& path, std::vector<std::string>& files, std::vector<std::string>& directories)
+{
+    std::error_code ec;
+    fs::directory_iterator it(path, fs::directory_options::skip_permission_denied, ec);
+    if (ec)
+        return false;
+
+    for (; it != fs::directory_iterator(); it.increment(ec))
+    {
+        if (ec)
+            return false;
+
+        std::error_code typeError;
+        if (it->is_directory(typeError))
+            directories.push_back(it->path().filename().string());
+        else if (it->is_regular_file(typeError))
+            files.push_back(it->path().filename().string());
+    }
+    return true;
+}
+
+// Метаданные берутся из записей обхода: в Windows они приходят вместе с именами
+bool DiskFileSystem::ScanDirectory(const std::string& path, std::vector<DirectoryEntry>& entries)
+{
+    std::error_code ec;
+    fs::directory_iterator it(path, fs::directory_options::skip_permission_denied, ec);
+    if (ec)
+        return false;
+
+    for (; it != fs::directory_iterator(); it.increment(ec))
+    {
+        if (ec)
+            return false;
+
+        std::error_code entryError;
+        DirectoryEntry entry;
+        entry.name = it->path().filename().string();
+        if (it->is_directory(entryError))
+        {
+            entry.info.isDirectory = true;
+        }
+        else if (it->is_regular_file(entryError))
+        {
+            entry.info.size = it->file_size(entryError);
+            entry.info.mtime = it->last_write_time(entryError).time_since_epoch().count();
+        }
+        else
+        {
+            continue;
+        }
+
+        if (!entryError)
+            entries.push_back(std::move(entry));
+    }
+    return true;
+}
+
+// Запись в память: буфер публикуется по пути только в Commit()
+class MemoryFileWriter : public FileWriter
+{
+private:
+    MemoryFileSystem& owner;
+    std::string path;
+    std::vector<unsigned char> data;
+    size_t totalWritten = 0;    // data уходит в файловую систему при Commit()
+    bool open = true;
+
+public:
+    MemoryFileWriter(MemoryFileSystem& owner, const std::string& path) : owner(owner), path(path) {}
+
+    using FileWriter::Write;
+    void Write(const void* bytes, size_t size) override
+    {
+        const unsigned char* begin = static_cast<const unsigned char*>(bytes);
+        data.insert(data.end(), begin, begin + size);
+        totalWritten += size;
+    }
+
+    void WriteGather(const std::vector<std::string_view>& slices) override
+    {
+        for (const auto& slice : slices)
+            Write(slice.data(), slice.size());
+    }
+
+    bool Commit() override
+    {
+        if (!open)
+            return false;
+
+        owner.Store(path, std::move(data));
+        open = false;
+        return true;
+    }
+
+    void Abort() override
+    {
+        data.clear();
+        open = false;
+    }
+
+    size_t GetTotalWritten() const override { return totalWritten; }
+};
+
+std::string MemoryFileSystem::NormalizePath(const std::string& path)
+{
+    std::string result = fs::path(path).lexically_normal().generic_string();
+    while (result.size() > 1 && result.back() == '/')
+        result.pop_back();
+    return result;
+}
+
+bool MemoryFileSystem::IsDirectory(const std::string& path) const
+{
+    std::string prefix = path + "/";
+    auto it = files.lower_bound(prefix);
+    return it != files.end() && it->first.compare(0, prefix.size(), prefix) == 0;
+}
+
+void MemoryFileSystem::Store(const std::string& path, std::vector<unsigned char> data)
+{
+    std::lock_guard<std::mutex> lock(filesMutex);
+    Entry& entry = files[NormalizePath(path)];
+    entry.data = std::make_shared<const std::vector<unsigned char>>(std::move(data));
+    entry.mtime = ++generation;
+}
+
+bool MemoryFileSystem::Exists(const std::string& path)
+{
+    std::string key = NormalizePath(path);
+    std::lock_guard<std::mutex> lock(filesMutex);
+    return files.find(key) != files.end() || IsDirectory(key);
+}
+
+bool MemoryFileSystem::Stat(const std::string& path, FileInfo& info)
+{
+    std::string key = NormalizePath(path);
+    std::lock_guard<std::mutex> lock(filesMutex);
+    auto it = files.find(key);
+    if (it != files.end())
+    {
+        info.size = it->second.data->size();
+        info.mtime = it->second.mtime;
+        info.isDirectory = false;
+        return true;
+    }
+
+    if (IsDirectory(key))
+    {
+        info = FileInfo();
+        info.isDirectory = true;
+        return true;
+    }
+    return false;
+}
+
+bool MemoryFileSystem::Read(const std::string& path, std::vector<unsigned char>& data)
+{
+    std::lock_guard<std::mutex> lock(filesMutex);
+    auto it = files.find(NormalizePath(path));
+    if (it == files.end())
+        return false;
+
+    data = *it->second.data;
+    return true;
+}
+
+bool MemoryFileSystem::Map(const std::string& path, FileView& view)
+{
+    view.Close();
+
+    std::lock_guard<std::mutex> lock(filesMutex);
+    auto it = files.find(NormalizePath(path));
+    if (it == files.end())
+        return false;
+
+    // Вид держит свою ссылку на буфер: перезапись файла его не затрагивает
+    view.buffer = it->second.data;
+    view.data = view.buffer->data();
+    view.size = view.buffer->size();
+    return true;
+}
+
+std::unique_ptr<FileWriter> MemoryFileSystem::OpenWrite(const std::string& path)
+{
+    return std::make_unique<MemoryFileWriter>(*this, path);
+}
+
+bool MemoryFileSystem::Copy(const std::string& source, const std::string& destination)
+{
+    std::lock_guard<std::mutex> lock(filesMutex);
+    auto it = files.find(NormalizePath(source));
+    if (it == files.end())
+    {
+        std::cout << "Failed to copy file: " << source << " - not found" << std::endl;
+        return false;
+    }
+
+    // Данные не меняются после записи, поэтому копия делит буфер с источником
+    Entry copy = it->second;
+    copy.mtime = ++generation;
+    files[NormalizePath(destination)] = copy;
+    return true;
+}
+
+bool MemoryFileSystem::Remove(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(filesMutex);
+    return files.erase(NormalizePath(path)) > 0;
+}
+
+uintmax_t MemoryFileSystem::RemoveAll(const std::string& path)
+{
+    std::string key = NormalizePath(path);
+    std::lock_guard<std::mutex> lock(filesMutex);
+    uintmax_t removedCount = files.erase(key);
+
+    std::string prefix = key + "/";
+    auto it = files.lower_bound(prefix);
+    while (it != files.end() && it->first.compare(0, prefix.size(), prefix) == 0)
+    {
+        it = files.erase(it);
+        removedCount++;
+    }
+    return removedCount;
+}
+
+bool MemoryFileSystem::Rename(const std::string& from, const std::string& to)
+{
+    std::lock_guard<std::mutex> lock(filesMutex);
+    auto it = files.find(NormalizePath(from));
+    if (it == files.end())
+    {
+        std::cout << "Failed to rename " << from << " to " << to << ": not found" << std::endl;
+        return false;
+    }
+
+    Entry entry = it->second;
+    files.erase(it);
+    files[NormalizePath(to)] = entry;
+    return true;
+}
+
+// Каталоги появляются сами вместе с первым файлом
+bool MemoryFileSystem::CreateDirectories(const std::string&)
+{
+    return true;
+}
+
+bool MemoryFileSystem::ListDirectory(const std::string& path, std::vector<std::string>& fileNames, std::vector<std::string>& directoryNames)
+{
+    std::string key = NormalizePath(path);
+    std::string prefix = key == "." ? "" : key + "/";
+    std::lock_guard<std::mutex> lock(filesMutex);
+    if (!prefix.empty() && !IsDirectory(key))
+        return false;
+
+    auto it = files.lower_bound(prefix);
+    while (it != files.end() && it->first.compare(0, prefix.size(), prefix) == 0)
+    {
+        std::string rest = it->first.substr(prefix.size());
+        size_t slash = rest.find('/');
+        if (slash == std::string::npos)
+        {
+            fileNames.push_back(rest);
+            ++it;
+            continue;
+        }
+
+        // Все файлы подкаталога идут подряд: перескакиваем их одним поиском
+        std::string directory = rest.substr(0, slash);
+        directoryNames.push_back(directory);
+        it = files.lower_bound(prefix + directory + "0");   // '0' следует сразу за '/'
+    }
+    return true;
+}
+
+// Считает байты, которые прошли через писатель вложенной файловой системы
+class CountingFileWriter : public FileWriter
+{
+private:
+    std::unique_ptr<FileWriter> inner;
+    FileSystemStats& counters;
+
+public:
+    CountingFileWriter(std::unique_ptr<FileWriter> inner, FileSystemStats& counters) : inner(std::move(inner)), counters(counters) {}
+
+    using FileWriter::Write;
+    void Write(const void* data, size_t size) override { inner->Write(data, size); }
+    void WriteGather(const std::vector<std::string_view>& slices) override { inner->WriteGather(slices); }
+    void Abort() override { inner->Abort(); }
+    size_t GetTotalWritten() const override { return inner->GetTotalWritten(); }
+
+    bool Commit() override
+    {
+        counters.bytesWritten += inner->GetTotalWritten();
+        return inner->Commit();
+    }
+};
+
+void CountingFileSystem::Trace(const char* operation, const std::string& path, bool result) const
+{
+    if (trace)
+    {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        std::cout << "[fs] " << operation << " " << path << (result ? "" : " (failed)") << std::endl;
+    }
+}
+
+bool CountingFileSystem::Exists(const std::string& path)
+{
+    counters.exists++;
+    bool result = inner.Exists(path);
+    Trace("exists", path, result);
+    return result;
+}
+
+bool CountingFileSystem::Stat(const std::string& path, FileInfo& info)
+{
+    counters.stats++;
+    bool result = inner.Stat(path, info);
+    Trace("stat", path, result);
+    return result;
+}
+
+bool CountingFileSystem::Read(const std::string& path, std::vector<unsigned char>& data)
+{
+    counters.reads++;
+    bool result = inner.Read(path, data);
+    if (result)
+        counters.bytesRead += data.size();
+    Trace("read", path, result);
+    return result;
+}
+
+bool CountingFileSystem::Map(const std::string& path, FileView& view)
+{
+    counters.maps++;
+    bool result = inner.Map(path, view);
+    if (result)
+        counters.bytesRead += view.GetSize();
+    Trace("map", path, result);
+    return result;
+}
+
+std::unique_ptr<FileWriter> CountingFileSystem::OpenWrite(const std::string& path)
+{
+    counters.writes++;
+    std::unique_ptr<FileWriter> writer = inner.OpenWrite(path);
+    Trace("write", path, writer != nullptr);
+    if (!writer)
+        return nullptr;
+    return std::make_unique<CountingFileWriter>(std::move(writer), counters);
+}
+
+bool CountingFileSystem::Copy(const std::string& source, const std::string& destination)
+{
+    counters.copies++;
+    bool result = inner.Copy(source, destination);
+    Trace("copy", source + " -> " + destination, result);
+    return result;
+}
+
+bool CountingFileSystem::Remove(const std::string& path)
+{
+    counters.removes++;
+    bool result = inner.Remove(path);
+    Trace("remove", path, result);
+    return result;
+}
+
+uintmax_t CountingFileSystem::RemoveAll(const std::string& path)
+{
+    counters.removes++;
+    uintmax_t removedCount = inner.RemoveAll(path);
+    Trace("remove-all", path, true);
+    return removedCount;
+}
+
+bool CountingFileSystem::Rename(const std::string& from, const std::string& to)
+{
+    counters.renames++;
+    bool result = inner.Rename(from, to);
+    Trace("rename", from + " -> " + to, result);
+    return result;
+}
+
+bool CountingFileSystem::CreateDirectories(const std::string& path)
+{
+    counters.directories++;
+    bool result = inner.CreateDirectories(path);
+    Trace("mkdir", path, result);
+    return result;
+}
+
+bool CountingFileSystem::ListDirectory(const std::string& path, std::vector<std::string>& files, std::vector<std::string>& directories)
+{
+    counters.listings++;
+    bool result = inner.ListDirectory(path, files, directories);
+    Trace("list", path, result);
+    return result;
+}
+
+bool CountingFileSystem::ScanDirectory(const std::string& path, std::vector<DirectoryEntry>& entries)
+{
+    counters.scans++;
+    bool result = inner.ScanDirectory(path, entries);
+    Trace("scan", path, result);
+    return result;
+}
+
+void CountingFileSystem::ReadBatch(std::vector<ReadRequest>& requests)
+{
+    counters.reads += requests.size();
+    inner.ReadBatch(requests);
+    for (const auto& request : requests)
+    {
+        if (request.result)
+            counters.bytesRead += request.data.size();
+        Trace("read", request.path, request.result);
+    }
+}
+
+void CountingFileSystem::PrintStats() const
+{
+    std::cout << "File system: " << counters.exists << " exists, " << counters.stats << " stat, "
+        << counters.reads << " read, " << counters.maps << " map, " << counters.writes << " write, "
+        << counters.copies << " copy, " << counters.removes << " remove, " << counters.renames << " rename, "
+        << counters.directories << " mkdir, " << counters.listings << " list, " << counters.scans << " scan; "
+        << counters.bytesRead << " bytes read, "
+        << counters.bytesWritten << " bytes written" << std::endl;
+}
+
+// Запись через кеш: после Commit() файл отмечается в снимке каталога
+class CachingFileWriter : public FileWriter
+{
+private:
+    std::unique_ptr<FileWriter> inner;
+    CachingFileSystem& owner;
+    std::string path;
+
+public:
+    CachingFileWriter(std::unique_ptr<FileWriter> inner, CachingFileSystem& owner, const std::string& path)
+        : inner(std::move(inner)), owner(owner), path(path) {}
+
+    void Write(const void* data, size_t size) override { inner->Write(data, size); }
+    void WriteGather(const std::vector<std::string_view>& slices) override { inner->WriteGather(slices); }
+    void Abort() override { inner->Abort(); }
+    size_t GetTotalWritten() const override { return inner->GetTotalWritten(); }
+
+    bool Commit() override
+    {
+        if (!inner->Commit())
+            return false;
+        owner.MarkWritten(path);
+        return true;
+    }
+};
+
+std::string CachingFileSystem::NormalizePath(const std::string& path)
+{
+    std::string result = fs::path(path).lexically_normal().generic_string();
+    while (result.size() > 1 && result.back() == '/' && result[result.size() - 2] != ':')
+        result.pop_back();
+    if (result.empty())
+        result = ".";
+
+#if defined(_WIN32)
+    // Регистр имён в Windows не важен
+    for (char& c : result)
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+#endif
+    return result;
+}
+
+// Корень, "." и ".." в снимках не описаны: такие пути идут во вложенную систему
+bool CachingFileSystem::SplitPath(const std::string& path, std::string& parent, std::string& name)
+{
+    size_t slash = path.find_last_of('/');
+    if (slash == std::string::npos)
+    {
+        parent = ".";
+        name = path;
+    }
+    else
+    {
+        parent = path.substr(0, slash);
+        name = path.substr(slash + 1);
+        if (parent.empty() || parent.back() == ':')
+            parent += '/';
+    }
+    return !name.empty() && name != "." && name != "..";
+}
+
+CachingFileSystem::Snapshot& CachingFileSystem::GetSnapshot(const std::string& directory)
+{
+    auto it = snapshots.find(directory);
+    if (it != snapshots.end())
+        return it->second;
+
+    // Каталога нет в уже прочитанном родителе: он не существует, обход не нужен
+    bool knownMissing = false;
+    std::string parent;
+    std::string name;
+    if (SplitPath(directory, parent, name))
+    {
+        auto parentIt = snapshots.find(parent);
+        if (parentIt != snapshots.end())
+        {
+            auto entryIt = parentIt->second.entries.find(name);
+            knownMissing = entryIt == parentIt->second.entries.end()
+                || (!entryIt->second.stale && !entryIt->second.info.isDirectory);
+        }
+    }
+
+    Snapshot snapshot;
+    if (!knownMissing)
+    {
+        scans++;
+        std::vector<DirectoryEntry> entries;
+        snapshot.exists = inner.ScanDirectory(directory, entries);
+        snapshot.entries.reserve(entries.size());
+        for (const auto& entry : entries)
+        {
+            snapshot.entries[NormalizePath(entry.name)].info = entry.info;
+        }
+    }
+
+    return snapshots.emplace(directory, std::move(snapshot)).first->second;
+}
+
+CachingFileSystem::CachedEntry* CachingFileSystem::FindEntry(const std::string& parent, const std::string& name)
+{
+    Snapshot& snapshot = GetSnapshot(parent);
+    if (!snapshot.exists)
+        return nullptr;
+
+    auto it = snapshot.entries.find(name);
+    return it != snapshot.entries.end() ? &it->second : nullptr;
+}
+
+void CachingFileSystem::MarkWritten(const std::string& path)
+{
+    std::string parent;
+    std::string name;
+    if (!SplitPath(NormalizePath(path), parent, name))
+        return;
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = snapshots.find(parent);
+    if (it == snapshots.end())
+        return;
+
+    it->second.exists = true;
+    CachedEntry& entry = it->second.entries[name];
+    entry.info = FileInfo();
+    entry.stale = true;
+}
+
+void CachingFileSystem::MarkDirectory(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    std::string current = NormalizePath(path);
+    std::string parent;
+    std::string name;
+    while (SplitPath(current, parent, name))
+    {
+        auto it = snapshots.find(parent);
+        if (it != snapshots.end())
+        {
+            it->second.exists = true;
+            CachedEntry& entry = it->second.entries[name];
+            entry.info.isDirectory = true;
+            entry.stale = false;
+        }
+        current = parent;
+    }
+}
+
+void CachingFileSystem::MarkRemoved(const std::string& path)
+{
+    std::string key = NormalizePath(path);
+    std::string parent;
+    std::string name;
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (SplitPath(key, parent, name))
+    {
+        auto it = snapshots.find(parent);
+        if (it != snapshots.end())
+            it->second.entries.erase(name);
+    }
+
+    // Вместе с каталогом уходят снимки всех вложенных каталогов
+    std::string prefix = key + "/";
+    for (auto it = snapshots.begin(); it != snapshots.end(); )
+    {
+        if (it->first == key || it->first.compare(0, prefix.size(), prefix) == 0)
+            it = snapshots.erase(it);
+        else
+            ++it;
+    }
+}
+
+bool CachingFileSystem::Exists(const std::string& path)
+{
+    std::string parent;
+    std::string name;
+    if (!SplitPath(NormalizePath(path), parent, name))
+        return inner.Exists(path);
+
+    queries++;
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return FindEntry(parent, name) != nullptr;
+}
+
+bool CachingFileSystem::Stat(const std::string& path, FileInfo& info)
+{
+    std::string parent;
+    std::string name;
+    if (!SplitPath(NormalizePath(path), parent, name))
+        return inner.Stat(path, info);
+
+    queries++;
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    CachedEntry* entry = FindEntry(parent, name);
+    if (!entry)
+        return false;
+
+    if (entry->stale)
+    {
+        refreshes++;
+        if (!inner.Stat(path, entry->info))
+        {
+            snapshots[parent].entries.erase(name);
+            return false;
+        }
+        entry->stale = false;
+    }
+
+    info = entry->info;
+    return true;
+}
+
+bool CachingFileSystem::Read(const std::string& path, std::vector<unsigned char>& data)
+{
+    return inner.Read(path, data);
+}
+
+bool CachingFileSystem::Map(const std::string& path, FileView& view)
+{
+    return inner.Map(path, view);
+}
+
+std::unique_ptr<FileWriter> CachingFileSystem::OpenWrite(const std::string& path)
+{
+    std::unique_ptr<FileWriter> writer = inner.OpenWrite(path);
+    if (!writer)
+        return nullptr;
+    return std::make_unique<CachingFileWriter>(std::move(writer), *this, path);
+}
+
+bool CachingFileSystem::Copy(const std::string& source, const std::string& destination)
+{
+    if (!inner.Copy(source, destination))
+        return false;
+
+    MarkWritten(destination);
+    return true;
+}
+
+bool CachingFileSystem::Remove(const std::string& path)
+{
+    if (!inner.Remove(path))
+        return false;
+
+    MarkRemoved(path);
+    return true;
+}
+
+uintmax_t CachingFileSystem::RemoveAll(const std::string& path)
+{
+    uintmax_t removedCount = inner.RemoveAll(path);
+    MarkRemoved(path);
+    return removedCount;
+}
+
+bool CachingFileSystem::Rename(const std::string& from, const std::string& to)
+{
+    if (!inner.Rename(from, to))
+        return false;
+
+    MarkRemoved(from);
+    MarkRemoved(to);
+    MarkWritten(to);
+    return true;
+}
+
+bool CachingFileSystem::CreateDirectories(const std::string& path)
+{
+    if (!inner.CreateDirectories(path))
+        return false;
+
+    MarkDirectory(path);
+    return true;
+}
+
+bool CachingFileSystem::ListDirectory(const std::string& path, std::vector<std::string>& files, std::vector<std::string>& directories)
+{
+    return inner.ListDirectory(path, files, directories);
+}
+
+bool CachingFileSystem::ScanDirectory(const std::string& path, std::vector<DirectoryEntry>& entries)
+{
+    return inner.ScanDirectory(path, entries);
+}
+
+void CachingFileSystem::ReadBatch(std::vector<ReadRequest>& requests)
+{
+    inner.ReadBatch(requests);
+}
+
+void CachingFileSystem::PrintStats() const
+{
+    std::cout << "Metadata cache: " << queries << " exists/stat queries answered with " << scans
+        << " directory scans and " << refreshes << " stats" << std::endl;
+}
+
+FileSystem& GetDiskFileSystem()
+{
+    static DiskFileSystem disk;
+    return disk;
+}
+
+std::string MakeTempPath(const std::string& path)
+{
+    static std::atomic<uint32_t> counter{ 0 };
+#if defined(_WIN32)
+    unsigned long processId = GetCurrentProcessId();
+#else
+    unsigned long processId = static_cast<unsigned long>(getpid());
+#endif
+    return path + "." + std::to_string(processId) + "_" + std::to_string(counter++) + ".tmp";
+}
+
+bool FileLock::Lock(const std::string& path, Mode mode)
+{
+    Unlock();
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        std::cout << "Error: Cannot open lock file " << path << std::endl;
+        return false;
+    }
+
+    OVERLAPPED overlapped = {};
+    if (!LockFileEx(file, mode == Mode::Exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0, 0, MAXDWORD, MAXDWORD, &overlapped))
+    {
+        std::cout << "Error: Cannot lock " << path << std::endl;
+        CloseHandle(file);
+        return false;
+    }
+    fileHandle = file;
+#else
+    int file = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (file < 0)
+    {
+        std::cout << "Error: Cannot open lock file " << path << std::endl;
+        return false;
+    }
+
+    int result;
+    while ((result = flock(file, mode == Mode::Exclusive ? LOCK_EX : LOCK_SH)) != 0 && errno == EINTR)
+    {
+    }
+    if (result != 0)
+    {
+        std::cout << "Error: Cannot lock " << path << ": " << strerror(errno) << std::endl;
+        close(file);
+        return false;
+    }
+    fileDescriptor = file;
+#endif
+    return true;
+}
+
+void FileLock::Unlock()
+{
+#if defined(_WIN32)
+    if (fileHandle)
+    {
+        OVERLAPPED overlapped = {};
+        UnlockFileEx(fileHandle, 0, MAXDWORD, MAXDWORD, &overlapped);
+        CloseHandle(fileHandle);
+    }
+    fileHandle = nullptr;
+#else
+    if (fileDescriptor >= 0)
+        close(fileDescriptor);
+    fileDescriptor = -1;
+#endif
+}
+
+bool FileLock::IsLocked() const
+{
+#if defined(_WIN32)
+    return fileHandle != nullptr;
+#else
+    return fileDescriptor >= 0;
+#endif
+}
@@ -0,0 +1,328 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <map>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+
+#include "MappedFile.h"
+
+// Виртуальная файловая система: весь доступ к файлам MDLFile и HammerCompiler
+// идёт через этот интерфейс. Реализации: реальный диск, архивы VPK поверх диска
+// и хранилище в памяти. CountingFileSystem оборачивает любую из них
+// и считает (и при желании печатает) каждое обращение, CachingFileSystem
+// отвечает на Exists и Stat из снимков каталогов.
+// Архивы VPK подключаются обёрткой VPKFileSystem из VPKFile.h.
+
+struct FileInfo
+{
+    uintmax_t size = 0;
+    int64_t mtime = 0;          // только для сравнения между запусками, не время в секундах
+    bool isDirectory = false;
+};
+
+struct DirectoryEntry
+{
+    std::string name;
+    FileInfo info;
+};
+
+struct ReadRequest
+{
+    std::string path;
+    std::vector<unsigned char> data;
+    bool result = false;
+};
+
+// Запись файла целиком: данные видны по пути только после Commit()
+class FileWriter
+{
+public:
+    virtual ~FileWriter() = default;
+
+    virtual void Write(const void* data, size_t size) = 0;
+    void Write(std::string_view data) { Write(data.data(), data.size()); }
+    virtual void WriteGather(const std::vector<std::string_view>& slices) = 0;
+    virtual bool Commit() = 0;
+    virtual void Abort() = 0;
+    virtual size_t GetTotalWritten() const = 0;
+};
+
+// Содержимое файла только для чтения: отображение с диска или буфер из памяти
+class FileView
+{
+private:
+    MappedFile mapping;
+    std::shared_ptr<const std::vector<unsigned char>> buffer;
+    std::shared_ptr<const FileView> source;     // вид целого архива, внутри которого лежат данные
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+
+    friend class DiskFileSystem;
+    friend class MemoryFileSystem;
+    friend class VPKFileSystem;
+
+public:
+    FileView() = default;
+    FileView(const FileView&) = delete;
+    FileView& operator=(const FileView&) = delete;
+
+    void Close();
+    bool IsOpen() const { return data != nullptr || buffer != nullptr || source != nullptr; }
+    const unsigned char* GetData() const { return data; }
+    size_t GetSize() const { return size; }
+};
+
+class FileSystem
+{
+public:
+    virtual ~FileSystem() = default;
+
+    virtual bool Exists(const std::string& path) = 0;
+    virtual bool Stat(const std::string& path, FileInfo& info) = 0;
+    virtual bool Read(const std::string& path, std::vector<unsigned char>& data) = 0;
+    virtual bool Map(const std::string& path, FileView& view) = 0;
+    virtual std::unique_ptr<FileWriter> OpenWrite(const std::string& path) = 0;
+    virtual bool Copy(const std::string& source, const std::string& destination) = 0;
+    virtual bool Remove(const std::string& path) = 0;          // файл или пустой каталог
+    virtual uintmax_t RemoveAll(const std::string& path) = 0;  // каталог целиком, число удалённых записей
+    virtual bool Rename(const std::string& from, const std::string& to) = 0;
+    virtual bool CreateDirectories(const std::string& path) = 0;
+
+    // Имена файлов и подкаталогов без рекурсии. Может вызываться из нескольких потоков
+    virtual bool ListDirectory(const std::string& path, std::vector<std::string>& files, std::vector<std::string>& directories) = 0;
+
+    // Имена и метаданные всех записей каталога за один обход.
+    // По умолчанию ListDirectory и Stat для каждой записи
+    virtual bool ScanDirectory(const std::string& path, std::vector<DirectoryEntry>& entries);
+
+    // Чтение нескольких файлов сразу; результат каждого в ReadRequest::result.
+    // По умолчанию Read по очереди
+    virtual void ReadBatch(std::vector<ReadRequest>& requests);
+
+    bool Write(const std::string& path, const void* data, size_t size);
+    uintmax_t GetSize(const std::string& path);
+};
+
+// Реальный диск: отображение в память для чтения, атомарная запись через BufferedWriter,
+// пачки чтений через io_uring и copy_file_range для копирования там, где они есть
+class DiskFileSystem : public FileSystem
+{
+public:
+    bool Exists(const std::string& path) override;
+    bool Stat(const std::string& path, FileInfo& info) override;
+    bool Read(const std::string& path, std::vector<unsigned char>& data) override;
+    bool Map(const std::string& path, FileView& view) override;
+    std::unique_ptr<FileWriter> OpenWrite(const std::string& path) override;
+    bool Copy(const std::string& source, const std::string& destination) override;
+    bool Remove(const std::string& path) override;
+    uintmax_t RemoveAll(const std::string& path) override;
+    bool Rename(const std::string& from, const std::string& to) override;
+    bool CreateDirectories(const std::string& path) override;
+    bool ListDirectory(const std::string& path, std::vector<std::string>& files, std::vector<std::string>& directories) override;
+    bool ScanDirectory(const std::string& path, std::vector<DirectoryEntry>& entries) override;
+    void ReadBatch(std::vector<ReadRequest>& requests) override;
+};
+
+// Файлы в памяти: сгенерированные файлы --overlay до упаковки и тесты без диска.
+// Каталоги не хранятся: каталог существует, пока в нём есть файлы
+class MemoryFileSystem : public FileSystem
+{
+private:
+    struct Entry
+    {
+        std::shared_ptr<const std::vector<unsigned char>> data;
+        int64_t mtime = 0;
+    };
+
+    // Потоки IOQueue обращаются к файлам одновременно
+    mutable std::mutex filesMutex;
+    std::map<std::string, Entry> files;
+    int64_t generation = 0;     // вместо mtime: растёт с каждой записью
+
+public:
+    bool Exists(const std::string& path) override;
+    bool Stat(const std::string& path, FileInfo& info) override;
+    bool Read(const std::string& path, std::vector<unsigned char>& data) override;
+    bool Map(const std::string& path, FileView& view) override;
+    std::unique_ptr<FileWriter> OpenWrite(const std::string& path) override;
+    bool Copy(const std::string& source, const std::string& destination) override;
+    bool Remove(const std::string& path) override;
+    uintmax_t RemoveAll(const std::string& path) override;
+    bool Rename(const std::string& from, const std::string& to) override;
+    bool CreateDirectories(const std::string& path) override;
+    bool ListDirectory(const std::string& path, std::vector<std::string>& files, std::vector<std::string>& directories) override;
+
+    void Store(const std::string& path, std::vector<unsigned char> data);
+
+private:
+    static std::string NormalizePath(const std::string& path);
+
+    // Вызывается под filesMutex
+    bool IsDirectory(const std::string& path) const;
+};
+
+// Счётчики атомарные: каталоги поисковых путей обходятся параллельно
+struct FileSystemStats
+{
+    std::atomic<uint64_t> exists{ 0 };
+    std::atomic<uint64_t> stats{ 0 };
+    std::atomic<uint64_t> reads{ 0 };
+    std::atomic<uint64_t> maps{ 0 };
+    std::atomic<uint64_t> writes{ 0 };
+    std::atomic<uint64_t> copies{ 0 };
+    std::atomic<uint64_t> removes{ 0 };
+    std::atomic<uint64_t> renames{ 0 };
+    std::atomic<uint64_t> directories{ 0 };
+    std::atomic<uint64_t> listings{ 0 };
+    std::atomic<uint64_t> scans{ 0 };
+    std::atomic<uint64_t> bytesRead{ 0 };   // Read и Map
+    std::atomic<uint64_t> bytesWritten{ 0 };
+};
+
+// Обёртка, которая считает обращения к вложенной файловой системе и с trace печатает каждое
+class CountingFileSystem : public FileSystem
+{
+private:
+    FileSystem& inner;
+    FileSystemStats counters;
+    bool trace = false;
+    mutable std::mutex traceMutex;
+
+public:
+    explicit CountingFileSystem(FileSystem& inner, bool trace = false) : inner(inner), trace(trace) {}
+
+    bool Exists(const std::string& path) override;
+    bool Stat(const std::string& path, FileInfo& info) override;
+    bool Read(const std::string& path, std::vector<unsigned char>& data) override;
+    bool Map(const std::string& path, FileView& view) override;
+    std::unique_ptr<FileWriter> OpenWrite(const std::string& path) override;
+    bool Copy(const std::string& source, const std::string& destination) override;
+    bool Remove(const std::string& path) override;
+    uintmax_t RemoveAll(const std::string& path) override;
+    bool Rename(const std::string& from, const std::string& to) override;
+    bool CreateDirectories(const std::string& path) override;
+    bool ListDirectory(const std::string& path, std::vector<std::string>& files, std::vector<std::string>& directories) override;
+    bool ScanDirectory(const std::string& path, std::vector<DirectoryEntry>& entries) override;
+    void ReadBatch(std::vector<ReadRequest>& requests) override;
+
+    const FileSystemStats& GetStats() const { return counters; }
+    void PrintStats() const;
+
+private:
+    void Trace(const char* operation, const std::string& path, bool result) const;
+};
+
+// Кеш метаданных на один запуск: каталог читается одним обходом (ScanDirectory),
+// после чего Exists и Stat для всех его записей отвечают из памяти. Собственные
+// записи, копирования и удаления обновляют снимки; время изменения записанного
+// файла неизвестно, поэтому Stat такого файла один раз уходит во вложенную систему.
+// Чтение содержимого и ListDirectory не кешируются.
+class CachingFileSystem : public FileSystem
+{
+private:
+    struct CachedEntry
+    {
+        FileInfo info;
+        bool stale = false;     // файл есть, но метаданные надо перечитать
+    };
+
+    struct Snapshot
+    {
+        bool exists = false;
+        std::unordered_map<std::string, CachedEntry> entries;
+    };
+
+    FileSystem& inner;
+    std::mutex cacheMutex;
+    std::unordered_map<std::string, Snapshot> snapshots;    // нормализованный путь каталога
+
+    std::atomic<uint64_t> queries{ 0 };
+    std::atomic<uint64_t> scans{ 0 };
+    std::atomic<uint64_t> refreshes{ 0 };
+
+    friend class CachingFileWriter;
+
+public:
+    explicit CachingFileSystem(FileSystem& inner) : inner(inner) {}
+
+    bool Exists(const std::string& path) override;
+    bool Stat(const std::string& path, FileInfo& info) override;
+    bool Read(const std::string& path, std::vector<unsigned char>& data) override;
+    bool Map(const std::string& path, FileView& view) override;
+    std::unique_ptr<FileWriter> OpenWrite(const std::string& path) override;
+    bool Copy(const std::string& source, const std::string& destination) override;
+    bool Remove(const std::string& path) override;
+    uintmax_t RemoveAll(const std::string& path) override;
+    bool Rename(const std::string& from, const std::string& to) override;
+    bool CreateDirectories(const std::string& path) override;
+    bool ListDirectory(const std::string& path, std::vector<std::string>& files, std::vector<std::string>& directories) override;
+    bool ScanDirectory(const std::string& path, std::vector<DirectoryEntry>& entries) override;
+    void ReadBatch(std::vector<ReadRequest>& requests) override;
+
+    void PrintStats() const;
+
+private:
+    static std::string NormalizePath(const std::string& path);
+    static bool SplitPath(const std::string& path, std::string& parent, std::string& name);
+
+    // Вызываются под cacheMutex
+    Snapshot& GetSnapshot(const std::string& directory);
+    CachedEntry* FindEntry(const std::string& parent, const std::string& name);
+
+    // Берут cacheMutex сами: вызываются после операции на диске, в том числе из писателя
+    void MarkWritten(const std::string& path);
+    void MarkDirectory(const std::string& path);
+    void MarkRemoved(const std::string& path);
+};
+
+// Общий экземпляр диска для кода, которому файловую систему не передали
+FileSystem& GetDiskFileSystem();
+
+// Уникальное имя временного файла рядом с path (номер процесса и счётчик): несколько
+// процессов могут одновременно заменять один и тот же файл, каждый своим временным
+std::string MakeTempPath(const std::string& path);
+
+// Рекомендательная блокировка между процессами: flock или LockFileEx на файле блокировки.
+// Файл создаётся при необходимости и никогда не удаляется, иначе два процесса могли бы
+// заблокировать разные файлы с одним именем. Снимается в деструкторе или при завершении процесса
+class FileLock
+{
+public:
+    enum class Mode
+    {
+        Shared,
+        Exclusive
+    };
+
+private:
+#if defined(_WIN32)
+    void* fileHandle = nullptr;
+#else
+    int fileDescriptor = -1;
+#endif
+
+public:
+    FileLock() = default;
+    ~FileLock() { Unlock(); }
+
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+
+    // Ждёт, пока блокировка освободится
+    bool Lock(const std::string& path, Mode mode);
+    void Unlock();
+    bool IsLocked() const;
+};
@@ -0,0 +1,285 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#include "Journal.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <filesystem>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace fs = std::filesystem;
+
+bool Journal::Load(const std::string& filename)
+{
+    Close();
+    path = filename;
+    records.clear();
+    tornTail = false;
+
+    std::ifstream file(filename, std::ios::binary);
+    if (!file)
+        return false;
+
+    std::ostringstream content;
+    content << file.rdbuf();
+    std::string text = content.str();
+
+    size_t lineStart = 0;
+    size_t lineEnd;
+    while ((lineEnd = text.find('\n', lineStart)) != std::string::npos)
+    {
+        std::string line = text.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+
+        size_t stepStart = line.find('\t');
+        if (stepStart == std::string::npos)
+            continue;
+        size_t pathStart = line.find('\t', stepStart + 1);
+
+        Record record;
+        record.done = line.compare(0, stepStart, "done") == 0;
+        record.step = line.substr(stepStart + 1, pathStart == std::string::npos ? std::string::npos : pathStart - stepStart - 1);
+        if (pathStart != std::string::npos)
+            record.path = line.substr(pathStart + 1);
+        records.push_back(std::move(record));
+    }
+
+    // Процесс завершился посреди записи строки: её шаг считается незапланированным
+    tornTail = lineStart < text.size();
+    return true;
+}
+
+bool Journal::Open(const std::string& filename)
+{
+    Close();
+    if (filename != path)
+    {
+        records.clear();
+        tornTail = false;
+    }
+    path = filename;
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    fileHandle = file == INVALID_HANDLE_VALUE ? nullptr : file;
+#else
+    fileDescriptor = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+#endif
+
+    if (!IsOpen())
+    {
+        std::cout << "Error: Cannot open journal " << path << std::endl;
+        return false;
+    }
+
+    if (tornTail)
+    {
+        WriteLine("\n");
+        tornTail = false;
+    }
+    return true;
+}
+
+bool Journal::IsOpen() const
+{
+#if defined(_WIN32)
+    return fileHandle != nullptr;
+#else
+    return fileDescriptor >= 0;
+#endif
+}
+
+void Journal::Close()
+{
+#if defined(_WIN32)
+    if (fileHandle)
+        CloseHandle(fileHandle);
+    fileHandle = nullptr;
+#else
+    if (fileDescriptor >= 0)
+        close(fileDescriptor);
+    fileDescriptor = -1;
+#endif
+}
+
+void Journal::Remove()
+{
+    Close();
+    RemoveUndo();
+
+    std::error_code error;
+    fs::remove(path, error);
+    records.clear();
+}
+
+void Journal::Plan(const std::string& step, const std::string& stepPath)
+{
+    Append(false, step, stepPath);
+}
+
+void Journal::Done(const std::string& step, const std::string& stepPath)
+{
+    Append(true, step, stepPath);
+}
+
+void Journal::Append(bool done, const std::string& step, const std::string& stepPath)
+{
+    if (!IsOpen())
+        return;
+
+    records.push_back({ done, step, stepPath });
+
+    // Строка уходит целиком одним вызовом: при падении процесса она либо есть, либо обрезана
+    std::string line = (done ? "done\t" : "plan\t") + step + "\t" + stepPath + "\n";
+    if (!WriteLine(line))
+    {
+        std::cout << "Warning: Failed to write journal " << path << std::endl;
+    }
+}
+
+bool Journal::WriteLine(const std::string& line)
+{
+#if defined(_WIN32)
+    DWORD written = 0;
+    return WriteFile(fileHandle, line.data(), static_cast<DWORD>(line.size()), &written, NULL) && written == line.size();
+#else
+    const char* data = line.data();
+    size_t size = line.size();
+    while (size > 0)
+    {
+        ssize_t written = write(fileDescriptor, data, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+#endif
+}
+
+bool Journal::Sync()
+{
+    if (!IsOpen())
+        return true;
+
+#if defined(_WIN32)
+    return FlushFileBuffers(fileHandle) != 0;
+#else
+    return fsync(fileDescriptor) == 0;
+#endif
+}
+
+const Journal::Record* Journal::FindLast(const std::string& step) const
+{
+    for (auto record = records.rbegin(); record != records.rend(); ++record)
+    {
+        if (record->step == step)
+            return &*record;
+    }
+    return nullptr;
+}
+
+bool Journal::IsDone(const std::string& step) const
+{
+    const Record* record = FindLast(step);
+    return record && record->done;
+}
+
+bool Journal::IsInterrupted(const std::string& step) const
+{
+    const Record* record = FindLast(step);
+    return record && !record->done;
+}
+
+// Данные отката пишутся во временный файл, сбрасываются на диск и только потом
+// получают своё имя: наполовину записанный откат никогда не будет применён
+bool Journal::SaveUndo(const std::vector<unsigned char>& data)
+{
+    std::string undoPath = path + ".undo";
+    std::string tempPath = undoPath + ".tmp";
+    bool success = false;
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        DWORD written = 0;
+        success = WriteFile(file, data.data(), static_cast<DWORD>(data.size()), &written, NULL) && written == data.size()
+            && FlushFileBuffers(file);
+        CloseHandle(file);
+    }
+    if (success)
+    {
+        success = MoveFileExA(tempPath.c_str(), undoPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+    }
+#else
+    int file = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file >= 0)
+    {
+        const unsigned char* bytes = data.data();
+        size_t size = data.size();
+        success = true;
+        while (size > 0)
+        {
+            ssize_t written = write(file, bytes, size);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                success = false;
+                break;
+            }
+            bytes += written;
+            size -= written;
+        }
+        success = success && fsync(file) == 0;
+        close(file);
+    }
+    success = success && rename(tempPath.c_str(), undoPath.c_str()) == 0;
+#endif
+
+    if (!success)
+    {
+        std::cout << "Error: Cannot write journal undo data: " << undoPath << std::endl;
+        std::error_code error;
+        fs::remove(tempPath, error);
+        return false;
+    }
+
+    return true;
+}
+
+bool Journal::LoadUndo(std::vector<unsigned char>& data) const
+{
+    std::ifstream file(path + ".undo", std::ios::binary);
+    if (!file)
+        return false;
+
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+void Journal::RemoveUndo()
+{
+    std::error_code error;
+    fs::remove(path + ".undo", error);
+    fs::remove(path + ".undo.tmp", error);
+}
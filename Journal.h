@@ -0,0 +1,90 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#pragma once
+
+#include <vector>
+#include <string>
+
+// Журнал шагов одного этапа (<map>.vmf.journal). Перед шагом, который меняет
+// файлы на диске, дописывается запись "plan", после него - "done":
+//
+//   plan create <путь>     файл создаётся (done - файл записан целиком)
+//   plan vmf <путь>        исходный VMF заменяется раскрашенным
+//   plan manifest <путь>   пишется манифест pak
+//   plan pak <путь BSP>    в BSP дописываются файлы
+//   plan restore <путь>    VMF возвращается к исходному виду
+//   plan rename <путь>     BSP производного VMF получает имя карты
+//
+// Поля записи разделены табуляцией, одна запись на строку.
+// Первая запись - имя этапа (precompile или postcompile), её "done" пишется
+// перед удалением журнала. Каждая запись сразу уходит в ОС одним вызовом write
+// и переживает аварийное завершение процесса; Sync() на границах пачек сбрасывает
+// журнал на диск. Успешно завершённый этап удаляет журнал, поэтому его наличие
+// означает, что запуск был прерван.
+//
+// Журнал пишется только из одного потока.
+class Journal
+{
+public:
+    struct Record
+    {
+        bool done = false;
+        std::string step;
+        std::string path;
+    };
+
+private:
+    std::string path;
+#if defined(_WIN32)
+    void* fileHandle = nullptr;
+#else
+    int fileDescriptor = -1;
+#endif
+    std::vector<Record> records;
+    bool tornTail = false;          // последняя строка прерванного запуска не дописана
+
+public:
+    Journal() = default;
+    ~Journal() { Close(); }
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // Читает записи существующего журнала; недописанная последняя строка отбрасывается
+    bool Load(const std::string& filename);
+
+    // Открывает журнал на дозапись, создавая файл при необходимости
+    bool Open(const std::string& filename);
+    void Close();
+    bool IsOpen() const;
+
+    // Закрывает и удаляет журнал вместе с данными отката
+    void Remove();
+
+    void Plan(const std::string& step, const std::string& stepPath = "");
+    void Done(const std::string& step, const std::string& stepPath = "");
+    bool Sync();
+
+    // Состояние шага берётся из последней записи о нём
+    const Record* FindLast(const std::string& step) const;
+    bool IsDone(const std::string& step) const;
+    bool IsInterrupted(const std::string& step) const;
+
+    const std::vector<Record>& GetRecords() const { return records; }
+    const std::string& GetPath() const { return path; }
+
+    // Данные для отката шага, который меняет файл на месте: лежат рядом с журналом
+    // (<journal>.undo) и сбрасываются на диск до начала шага
+    bool SaveUndo(const std::vector<unsigned char>& data);
+    bool LoadUndo(std::vector<unsigned char>& data) const;
+    void RemoveUndo();
+
+private:
+    void Append(bool done, const std::string& step, const std::string& stepPath);
+    bool WriteLine(const std::string& line);
+};
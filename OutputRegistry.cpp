@@ -0,0 +1,182 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#include "OutputRegistry.h"
+#include "BufferedWriter.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+OutputRegistry::OutputRegistry(const std::string& gameDir)
+    : registryPath(gameDir + "/propcolor_refs.txt"),
+    registryLockPath(gameDir + "/propcolor_refs.lock"),
+    outputsLockPath(gameDir + "/propcolor_outputs.lock")
+{
+}
+
+bool OutputRegistry::BeginOutputs()
+{
+    return outputsLock.Lock(outputsLockPath, FileLock::Mode::Shared);
+}
+
+bool OutputRegistry::BeginCleanup()
+{
+    return outputsLock.Lock(outputsLockPath, FileLock::Mode::Exclusive);
+}
+
+void OutputRegistry::End()
+{
+    outputsLock.Unlock();
+}
+
+// Карты запускаются из разных рабочих каталогов, поэтому пути хранятся абсолютными
+std::string OutputRegistry::NormalizePath(const std::string& path)
+{
+    std::error_code error;
+    fs::path absolutePath = fs::absolute(path, error);
+    std::string normalized = (error ? fs::path(path) : absolutePath).lexically_normal().generic_string();
+#if defined(_WIN32)
+    std::transform(normalized.begin(), normalized.end(), normalized.begin(),
+        [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+#endif
+    return normalized;
+}
+
+bool OutputRegistry::AddReferences(const std::string& owner, const std::vector<std::string>& files)
+{
+    FileLock registryLock;
+    if (!registryLock.Lock(registryLockPath, FileLock::Mode::Exclusive))
+        return false;
+
+    References references;
+    Load(references);
+
+    std::string ownerKey = NormalizePath(owner);
+    for (const auto& file : files)
+    {
+        references[NormalizePath(file)].insert(ownerKey);
+    }
+
+    return Save(references);
+}
+
+bool OutputRegistry::RemoveReferences(const std::string& owner, const std::vector<std::string>& files, std::vector<std::string>& unreferenced)
+{
+    FileLock registryLock;
+    if (!registryLock.Lock(registryLockPath, FileLock::Mode::Exclusive))
+        return false;
+
+    References references;
+    Load(references);
+
+    std::string ownerKey = NormalizePath(owner);
+    for (const auto& file : files)
+    {
+        // Файл, которого нет в счётчике, записан версией без него: он принадлежит только этой карте
+        auto entry = references.find(NormalizePath(file));
+        if (entry != references.end())
+        {
+            entry->second.erase(ownerKey);
+            if (!entry->second.empty())
+            {
+                std::cout << "Kept shared file: " << file << " (used by " << entry->second.size() << " other maps)" << std::endl;
+                continue;
+            }
+            references.erase(entry);
+        }
+        unreferenced.push_back(file);
+    }
+
+    return Save(references);
+}
+
+bool OutputRegistry::ClaimOutputs(const std::string& owner, const std::vector<std::string>& files,
+    std::vector<std::pair<std::string, std::string>>& conflicts)
+{
+    FileLock registryLock;
+    if (!registryLock.Lock(registryLockPath, FileLock::Mode::Exclusive))
+        return false;
+
+    References references;
+    Load(references);
+
+    std::string ownerKey = NormalizePath(owner);
+    for (const auto& file : files)
+    {
+        auto entry = references.find(NormalizePath(file));
+        if (entry == references.end())
+            continue;
+
+        for (const auto& other : entry->second)
+        {
+            if (other != ownerKey)
+                conflicts.emplace_back(file, other);
+        }
+    }
+
+    if (!conflicts.empty())
+        return true;
+
+    for (const auto& file : files)
+    {
+        references[NormalizePath(file)].insert(ownerKey);
+    }
+    return Save(references);
+}
+
+// Формат: одна строка на ссылку, путь файла и путь карты через табуляцию
+bool OutputRegistry::Load(References& references) const
+{
+    std::ifstream file(registryPath);
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos)
+            continue;
+        references[line.substr(0, tab)].insert(line.substr(tab + 1));
+    }
+    return true;
+}
+
+// Счётчик заменяется целиком переименованием, поэтому читать его можно без блокировки
+bool OutputRegistry::Save(const References& references) const
+{
+    if (references.empty())
+    {
+        std::error_code error;
+        fs::remove(registryPath, error);
+        return true;
+    }
+
+    BufferedWriter writer;
+    if (!writer.Open(registryPath))
+        return false;
+
+    for (const auto& [file, owners] : references)
+    {
+        for (const auto& owner : owners)
+        {
+            writer.Write(file + "\t" + owner + "\n");
+        }
+    }
+
+    if (!writer.Commit())
+    {
+        std::cout << "Failed to write output registry: " << registryPath << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,62 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <map>
+#include <set>
+
+#include "FileSystem.h"
+
+// Счётчик ссылок на сгенерированные файлы, общий для всех карт одного игрового
+// каталога (<gameDir>/propcolor_refs.txt, строка на пару "файл - карта").
+// Карта, которая создала или переиспользовала файл, добавляет на него ссылку;
+// уборка снимает свои ссылки и удаляет только файлы, на которые не ссылается никто.
+//
+// Две блокировки рядом со счётчиком:
+//   propcolor_refs.lock     - чтение и замена самого счётчика, берётся ненадолго
+//   propcolor_outputs.lock  - разделяемая у шага, который создаёт файлы, пока его
+//                             ссылки не записаны; монопольная у уборки, поэтому она
+//                             не удалит файл, который другая карта только что создала
+class OutputRegistry
+{
+private:
+    std::string registryPath;
+    std::string registryLockPath;
+    std::string outputsLockPath;
+    FileLock outputsLock;
+
+    // Нормализованный путь файла -> карты, которые на него ссылаются
+    using References = std::map<std::string, std::set<std::string>>;
+
+public:
+    explicit OutputRegistry(const std::string& gameDir);
+
+    bool BeginOutputs();
+    bool BeginCleanup();
+    void End();
+
+    bool AddReferences(const std::string& owner, const std::vector<std::string>& files);
+
+    // Снимает ссылки owner; в unreferenced попадают файлы, на которые больше никто не ссылается.
+    // Вызывается между BeginCleanup() и End(), удалять файлы нужно до End()
+    bool RemoveReferences(const std::string& owner, const std::vector<std::string>& files, std::vector<std::string>& unreferenced);
+
+    // Проверка и запись ссылок под одной блокировкой: из двух карт, начавших одновременно,
+    // файлы займёт только одна. В conflicts попадают пары (файл, другая карта); если они
+    // есть, ссылки owner не добавляются
+    bool ClaimOutputs(const std::string& owner, const std::vector<std::string>& files,
+        std::vector<std::pair<std::string, std::string>>& conflicts);
+
+    static std::string NormalizePath(const std::string& path);
+
+private:
+    bool Load(References& references) const;
+    bool Save(const References& references) const;
+};
@@ -0,0 +1,166 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#include "PakManifest.h"
+
+#include <iostream>
+#include <cstring>
+
+bool PakManifest::Write(FileSystem& fileSystem, const std::string& path, uint64_t vmfHash, const std::vector<Model>& models)
+{
+    std::vector<PakManifestModel> modelRecords;
+    std::vector<PakManifestFile> fileRecords;
+    std::string strings;
+    std::string data;
+
+    auto addString = [&strings](const std::string& value)
+    {
+        uint32_t offset = static_cast<uint32_t>(strings.size());
+        strings.append(value);
+        strings.push_back('\0');
+        return offset;
+    };
+
+    for (const auto& model : models)
+    {
+        PakManifestModel record;
+        record.nameOffset = addString(model.name);
+        record.firstFile = static_cast<uint32_t>(fileRecords.size());
+        record.fileCount = static_cast<uint32_t>(model.files.size());
+        modelRecords.push_back(record);
+
+        for (const auto& file : model.files)
+        {
+            PakManifestFile fileRecord = {};
+            fileRecord.pakPathOffset = addString(file.pakPath);
+            fileRecord.fullPathOffset = addString(file.fullPath);
+            fileRecord.size = file.size;
+            fileRecord.hash = file.hash;
+            if (file.isInline)
+            {
+                fileRecord.flags = PAK_MANIFEST_FILE_INLINE;
+                fileRecord.size = file.content.size();
+                fileRecord.dataOffset = data.size();
+                data.append(file.content);
+            }
+            fileRecords.push_back(fileRecord);
+        }
+    }
+
+    PakManifestHeader header = {};
+    header.ident = PAK_MANIFEST_IDENT;
+    header.version = PAK_MANIFEST_VERSION;
+    header.vmfHash = vmfHash;
+    header.modelCount = static_cast<uint32_t>(modelRecords.size());
+    header.fileCount = static_cast<uint32_t>(fileRecords.size());
+    header.stringTableSize = static_cast<uint32_t>(strings.size());
+    header.dataSize = data.size();
+
+    std::unique_ptr<FileWriter> file = fileSystem.OpenWrite(path);
+    if (!file)
+    {
+        return false;
+    }
+
+    file->Write(&header, sizeof(header));
+    file->Write(modelRecords.data(), modelRecords.size() * sizeof(PakManifestModel));
+    file->Write(fileRecords.data(), fileRecords.size() * sizeof(PakManifestFile));
+    file->Write(strings);
+    file->Write(data);
+
+    if (!file->Commit())
+    {
+        std::cout << "Error: Failed to write pak manifest " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool PakManifest::Open(FileSystem& fileSystem, const std::string& path)
+{
+    if (!fileSystem.Map(path, mapping))
+    {
+        return false;
+    }
+
+    if (mapping.GetSize() < sizeof(header))
+    {
+        std::cout << "Error: Pak manifest is too small: " << path << std::endl;
+        return false;
+    }
+
+    memcpy(&header, mapping.GetData(), sizeof(header));
+    if (header.ident != PAK_MANIFEST_IDENT || header.version != PAK_MANIFEST_VERSION)
+    {
+        std::cout << "Pak manifest has unknown format or version: " << path << std::endl;
+        return false;
+    }
+
+    modelsOffset = sizeof(header);
+    filesOffset = modelsOffset + static_cast<size_t>(header.modelCount) * sizeof(PakManifestModel);
+    stringsOffset = filesOffset + static_cast<size_t>(header.fileCount) * sizeof(PakManifestFile);
+    dataOffset = stringsOffset + header.stringTableSize;
+    if (dataOffset > mapping.GetSize() || mapping.GetSize() - dataOffset != header.dataSize
+        || (header.stringTableSize > 0 && mapping.GetData()[dataOffset - 1] != '\0'))
+    {
+        std::cout << "Error: Pak manifest is truncated: " << path << std::endl;
+        return false;
+    }
+
+    for (uint32_t i = 0; i < header.modelCount; i++)
+    {
+        PakManifestModel model = GetModel(i);
+        if (model.nameOffset >= header.stringTableSize || static_cast<uint64_t>(model.firstFile) + model.fileCount > header.fileCount)
+        {
+            std::cout << "Error: Invalid model record in pak manifest: " << path << std::endl;
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < header.fileCount; i++)
+    {
+        PakManifestFile file = GetFile(i);
+        if (file.pakPathOffset >= header.stringTableSize || file.fullPathOffset >= header.stringTableSize)
+        {
+            std::cout << "Error: Invalid string offset in pak manifest: " << path << std::endl;
+            return false;
+        }
+
+        if ((file.flags & PAK_MANIFEST_FILE_INLINE) && (file.dataOffset > header.dataSize || file.size > header.dataSize - file.dataOffset))
+        {
+            std::cout << "Error: Invalid inline file in pak manifest: " << path << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+PakManifestModel PakManifest::GetModel(uint32_t index) const
+{
+    PakManifestModel model;
+    memcpy(&model, mapping.GetData() + modelsOffset + index * sizeof(PakManifestModel), sizeof(model));
+    return model;
+}
+
+PakManifestFile PakManifest::GetFile(uint32_t index) const
+{
+    PakManifestFile file;
+    memcpy(&file, mapping.GetData() + filesOffset + index * sizeof(PakManifestFile), sizeof(file));
+    return file;
+}
+
+const char* PakManifest::GetString(uint32_t offset) const
+{
+    return reinterpret_cast<const char*>(mapping.GetData() + stringsOffset + offset);
+}
+
+const unsigned char* PakManifest::GetFileData(const PakManifestFile& file) const
+{
+    return mapping.GetData() + dataOffset + file.dataOffset;
+}
@@ -0,0 +1,101 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "FileSystem.h"
+
+// Бинарный манифест, который pre-compile оставляет для -postcompile:
+// уникальные цветные модели, их материалы и сопутствующие файлы с путями
+// внутри pak, размерами и хешами. Post-compile отображает его в память
+// и пакует файлы прямо по нему, не разбирая VMF и модели заново.
+//
+// Формат: заголовок, массив моделей, массив файлов, таблица строк
+// (строки с нулём в конце, в записях хранятся смещения в таблице)
+// и блок данных файлов, которые существуют только в манифесте (--overlay).
+//
+#define PAK_MANIFEST_IDENT      (('F' << 24) + ('M' << 16) + ('C' << 8) + 'P')
+#define PAK_MANIFEST_VERSION    2
+
+#define PAK_MANIFEST_FILE_INLINE    0x0001  // содержимое лежит в блоке данных, а не на диске
+
+#pragma pack(push, 1)
+
+struct PakManifestHeader
+{
+    int ident;
+    int version;
+    uint64_t vmfHash;           // хеш VMF, который будет компилировать vbsp
+    uint32_t modelCount;
+    uint32_t fileCount;
+    uint32_t stringTableSize;
+    uint64_t dataSize;
+};
+
+struct PakManifestModel
+{
+    uint32_t nameOffset;        // путь цветной модели
+    uint32_t firstFile;
+    uint32_t fileCount;
+};
+
+struct PakManifestFile
+{
+    uint32_t pakPathOffset;
+    uint32_t fullPathOffset;    // пустая строка у встроенных файлов
+    uint32_t flags;
+    uint64_t size;
+    uint64_t hash;              // FNV-1a 64 содержимого
+    uint64_t dataOffset;        // смещение в блоке данных для PAK_MANIFEST_FILE_INLINE
+};
+
+#pragma pack(pop)
+
+class PakManifest
+{
+public:
+    struct File
+    {
+        std::string pakPath;
+        std::string fullPath;
+        uint64_t size = 0;
+        uint64_t hash = 0;
+        bool isInline = false;
+        std::string content;    // для встроенных файлов
+    };
+
+    struct Model
+    {
+        std::string name;
+        std::vector<File> files;
+    };
+
+    static bool Write(FileSystem& fileSystem, const std::string& path, uint64_t vmfHash, const std::vector<Model>& models);
+
+    bool Open(FileSystem& fileSystem, const std::string& path);
+    void Close() { mapping.Close(); }
+
+    uint64_t GetVMFHash() const { return header.vmfHash; }
+    uint32_t GetModelCount() const { return header.modelCount; }
+    uint32_t GetFileCount() const { return header.fileCount; }
+    PakManifestModel GetModel(uint32_t index) const;
+    PakManifestFile GetFile(uint32_t index) const;
+    const char* GetString(uint32_t offset) const;
+    const unsigned char* GetFileData(const PakManifestFile& file) const;
+
+private:
+    FileView mapping;
+    PakManifestHeader header = {};
+    size_t modelsOffset = 0;
+    size_t filesOffset = 0;
+    size_t stringsOffset = 0;
+    size_t dataOffset = 0;
+};
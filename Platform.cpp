@@ -0,0 +1,147 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#include "Platform.h"
+
+#include <iostream>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#if defined(__APPLE__)
+#include <mach-o/dyld.h>
+#endif
+
+extern char** environ;
+#endif
+
+void InitConsole()
+{
+#if defined(_WIN32)
+    SetConsoleOutputCP(1251);
+    SetConsoleCP(1251);
+#endif
+}
+
+std::string GetExecutablePath()
+{
+#if defined(_WIN32)
+    char modulePath[MAX_PATH];
+    DWORD length = GetModuleFileNameA(NULL, modulePath, MAX_PATH);
+    return std::string(modulePath, length);
+#elif defined(__APPLE__)
+    char modulePath[4096];
+    uint32_t size = sizeof(modulePath);
+    return _NSGetExecutablePath(modulePath, &size) == 0 ? std::string(modulePath) : std::string();
+#else
+    char modulePath[4096];
+    ssize_t length = readlink("/proc/self/exe", modulePath, sizeof(modulePath));
+    return length > 0 ? std::string(modulePath, length) : std::string();
+#endif
+}
+
+std::string GetExecutableName(const std::string& name)
+{
+#if defined(_WIN32)
+    return name + ".exe";
+#else
+    return name;
+#endif
+}
+
+#if defined(_WIN32)
+// Командная строка по правилам CommandLineToArgvW: обратные слэши перед кавычкой удваиваются
+static std::string QuoteArgument(const std::string& argument)
+{
+    if (!argument.empty() && argument.find_first_of(" \t\"") == std::string::npos)
+        return argument;
+
+    std::string quoted = "\"";
+    size_t backslashes = 0;
+    for (char c : argument)
+    {
+        if (c == '\\')
+        {
+            backslashes++;
+            continue;
+        }
+
+        if (c == '"')
+            quoted.append(backslashes * 2 + 1, '\\');
+        else
+            quoted.append(backslashes, '\\');
+        backslashes = 0;
+        quoted += c;
+    }
+    quoted.append(backslashes * 2, '\\');
+    quoted += '"';
+    return quoted;
+}
+#endif
+
+int RunProcess(const std::string& program, const std::vector<std::string>& arguments)
+{
+    // Вывод дочернего процесса идёт в ту же консоль и не должен обгонять наш
+    std::cout.flush();
+
+#if defined(_WIN32)
+    std::string commandLine = QuoteArgument(program);
+    for (const auto& argument : arguments)
+    {
+        commandLine += ' ';
+        commandLine += QuoteArgument(argument);
+    }
+
+    STARTUPINFOA startupInfo = {};
+    startupInfo.cb = sizeof(startupInfo);
+    PROCESS_INFORMATION processInfo = {};
+
+    if (!CreateProcessA(program.c_str(), &commandLine[0], NULL, NULL, FALSE, 0, NULL, NULL, &startupInfo, &processInfo))
+    {
+        std::cout << "Error: Cannot start " << program << " (error " << GetLastError() << ")" << std::endl;
+        return -1;
+    }
+
+    WaitForSingleObject(processInfo.hProcess, INFINITE);
+
+    DWORD exitCode = 0;
+    GetExitCodeProcess(processInfo.hProcess, &exitCode);
+    CloseHandle(processInfo.hThread);
+    CloseHandle(processInfo.hProcess);
+    return static_cast<int>(exitCode);
+#else
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(program.c_str()));
+    for (const auto& argument : arguments)
+    {
+        argv.push_back(const_cast<char*>(argument.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid = 0;
+    int error = posix_spawn(&pid, program.c_str(), nullptr, nullptr, argv.data(), environ);
+    if (error != 0)
+    {
+        std::cout << "Error: Cannot start " << program << ": " << strerror(error) << std::endl;
+        return -1;
+    }
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+            return -1;
+    }
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+}
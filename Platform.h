@@ -0,0 +1,29 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#pragma once
+
+#include <vector>
+#include <string>
+
+// Всё, что зависит от ОС, кроме файлов: консоль, путь к программе и запуск других программ.
+// Работа с файлами и отображения - в FileSystem, MappedFile и Journal
+
+// Кодовая страница 1251 для консоли Windows; в терминалах Linux и macOS ничего не нужно
+void InitConsole();
+
+// Полный путь к запущенной программе: bspzip, vbsp, vvis и vrad ищутся рядом с ней
+std::string GetExecutablePath();
+
+// Имя исполняемого файла на этой платформе: "vbsp" -> "vbsp.exe" на Windows
+std::string GetExecutableName(const std::string& name);
+
+// Запуск программы напрямую, без командной оболочки: CreateProcess или posix_spawn.
+// Аргументы передаются списком, поэтому пробелы и кавычки в путях не ломают вызов.
+// Процесс наследует консоль и работает, пока не завершится. Возвращает код выхода
+// или -1, если программу не удалось запустить (или она завершилась по сигналу)
+int RunProcess(const std::string& program, const std::vector<std::string>& arguments);
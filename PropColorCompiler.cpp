@@ -7,25 +7,176 @@
 
 #include "PropColorCompiler.h"
 #include "colored_cout.h"
+#include "VPKFile.h"
+#include "Platform.h"
+
+#include <chrono>
+#include <string_view>
+#include <cmath>
+#include <cstdio>
+#include <thread>
 
 namespace fs = std::filesystem;
 
+// Файлы модели, которые копируются вместе с MDL (пропы из CS:GO имеют лишь эти)
+static const std::vector<std::string> modelCompanionExtensions = { ".dx90.vtx", ".vvd", ".phy" };
+
+// FNV-1a 64: детерминированный хеш, одинаковый на всех машинах
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string HashToHex(uint64_t hash)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string result(16, '0');
+    for (int i = 15; i >= 0; i--)
+    {
+        result[i] = digits[hash & 0xF];
+        hash >>= 4;
+    }
+    return result;
+}
+
+uint32_t PackColor(const std::string& color)
+{
+    std::istringstream iss(color);
+    int r = 0, g = 0, b = 0;
+    iss >> r >> g >> b;
+    r = std::clamp(r, 0, 255);
+    g = std::clamp(g, 0, 255);
+    b = std::clamp(b, 0, 255);
+    return (static_cast<uint32_t>(r) << 16) | (static_cast<uint32_t>(g) << 8) | static_cast<uint32_t>(b);
+}
+
+// Упакованный цвет хешируется байтами от младшего к старшему, поэтому имена
+// --hashnames не зависят от порядка байтов машины
+static uint64_t HashColor(uint32_t color, uint64_t hash)
+{
+    const unsigned char bytes[4] = {
+        static_cast<unsigned char>(color & 0xFF),
+        static_cast<unsigned char>((color >> 8) & 0xFF),
+        static_cast<unsigned char>((color >> 16) & 0xFF),
+        static_cast<unsigned char>((color >> 24) & 0xFF)
+    };
+    return HashBytes(bytes, sizeof(bytes), hash);
+}
+
+// Приводит путь к виду, одинаковому на всех машинах: нижний регистр и прямые слеши
+std::string NormalizeAssetPath(const std::string& path)
+{
+    std::string result = path;
+    for (auto& c : result)
+    {
+        if (c == '\\')
+            c = '/';
+        else
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return result;
+}
+
+// Результат записи, которая не трогает файл с теми же байтами (mtime остаётся стабильным).
+// Функции ничего не печатают: они выполняются и в рабочих потоках IOQueue
+enum class WriteResult
+{
+    Written,
+    Unchanged,
+    Failed,
+};
+
+static WriteResult WriteFileIfChanged(FileSystem& fileSystem, const std::string& path, const void* data, size_t size)
+{
+    FileInfo info;
+    if (fileSystem.Stat(path, info) && info.size == size)
+    {
+        FileView existing;
+        if (fileSystem.Map(path, existing) && (size == 0 || memcmp(existing.GetData(), data, size) == 0))
+            return WriteResult::Unchanged;
+    }
+
+    return fileSystem.Write(path, data, size) ? WriteResult::Written : WriteResult::Failed;
+}
+
+static WriteResult CopyFileIfChanged(FileSystem& fileSystem, const std::string& source, const std::string& destination)
+{
+    FileInfo sourceInfo;
+    FileInfo destinationInfo;
+    if (fileSystem.Stat(source, sourceInfo) && fileSystem.Stat(destination, destinationInfo)
+        && sourceInfo.size == destinationInfo.size)
+    {
+        FileView sourceView;
+        FileView destinationView;
+        if (fileSystem.Map(source, sourceView) && fileSystem.Map(destination, destinationView)
+            && (sourceView.GetSize() == 0 || memcmp(sourceView.GetData(), destinationView.GetData(), sourceView.GetSize()) == 0))
+        {
+            return WriteResult::Unchanged;
+        }
+    }
+
+    return fileSystem.Copy(source, destination) ? WriteResult::Written : WriteResult::Failed;
+}
+
+// Текстовый режим Windows: CRLF в файле, LF в памяти
+static std::string DecodeText(std::string content)
+{
+#if defined(_WIN32)
+    size_t length = 0;
+    for (size_t i = 0; i < content.size(); i++)
+    {
+        if (content[i] == '\r' && i + 1 < content.size() && content[i + 1] == '\n')
+            continue;
+        content[length++] = content[i];
+    }
+    content.resize(length);
+#endif
+    return content;
+}
+
+static std::string EncodeText(const std::string& content)
+{
+#if defined(_WIN32)
+    std::string bytes;
+    bytes.reserve(content.size());
+    for (char c : content)
+    {
+        if (c == '\n')
+            bytes.push_back('\r');
+        bytes.push_back(c);
+    }
+    return bytes;
+#else
+    return content;
+#endif
+}
+
 bool MDLFile::Load(const std::string& filename)
 {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file)
+    std::vector<unsigned char> data;
+    if (!fileSystem->Read(filename, data))
     {
         std::cout << "Error: Cannot open file " << filename << std::endl;
         return false;
     }
 
-    file.seekg(0, std::ios::end);
-    size_t size = file.tellg();
-    file.seekg(0, std::ios::beg);
+    return Load(filename, std::move(data));
+}
 
-    fileData.resize(size);
-    file.read(reinterpret_cast<char*>(fileData.data()), size);
-    file.close();
+bool MDLFile::Load(const std::string& filename, std::vector<unsigned char> data)
+{
+    fileData = std::move(data);
+    if (fileData.size() < sizeof(StudioHdr))
+    {
+        std::cout << "Error: MDL file is too small: " << filename << std::endl;
+        return false;
+    }
 
     header = reinterpret_cast<StudioHdr*>(fileData.data());
 
@@ -53,23 +204,84 @@ bool MDLFile::Save(const std::string& filename)
         return false;
     }
 
-    std::ofstream file(filename, std::ios::binary);
-    if (!file)
+    WriteResult result = WriteFileIfChanged(*fileSystem, filename, newFileData.data(), newFileData.size());
+    if (result == WriteResult::Failed)
     {
         std::cout << "Error: Cannot create file " << filename << std::endl;
         return false;
     }
 
-    file.write(reinterpret_cast<char*>(newFileData.data()), newFileData.size());
-    file.close();
+    if (result == WriteResult::Unchanged)
+        std::cout << "Unchanged, skipped write: " << filename << std::endl;
+    else
+        std::cout << "Successfully saved: " << filename << std::endl;
+    return true;
+}
+
+bool MDLFile::Validate(const std::vector<unsigned char>& data, std::string& error)
+{
+    if (data.size() < sizeof(StudioHdr))
+    {
+        error = "file is too small";
+        return false;
+    }
+
+    const StudioHdr* hdr = reinterpret_cast<const StudioHdr*>(data.data());
+    if (hdr->id != 'TSDI' && hdr->id != 'IDST')
+    {
+        error = "invalid MDL file signature";
+        return false;
+    }
+
+    // 44 - первые игры на Source, 49 - CS:GO и Portal 2
+    if (hdr->version < 44 || hdr->version > 49)
+    {
+        error = "unsupported MDL version " + std::to_string(hdr->version);
+        return false;
+    }
+
+    if (hdr->length != static_cast<int64_t>(data.size()))
+    {
+        error = "header length " + std::to_string(hdr->length) + " does not match file size " + std::to_string(data.size());
+        return false;
+    }
+
+    auto fits = [&data](int offset, int64_t count, size_t itemSize)
+    {
+        return offset >= 0 && count >= 0 && static_cast<uint64_t>(offset) + count * itemSize <= data.size();
+    };
+
+    if (hdr->numtextures <= 0)
+    {
+        error = "model has no materials";
+        return false;
+    }
+
+    if (!fits(hdr->textureindex, hdr->numtextures, sizeof(Texture)) ||
+        !fits(hdr->cdtextureindex, hdr->numcdtextures, sizeof(int)) ||
+        !fits(hdr->skinindex, static_cast<int64_t>(hdr->numskinref) * hdr->numskinfamilies, sizeof(short)))
+    {
+        error = "material or skin table is outside the file";
+        return false;
+    }
+
+    const Texture* textures = reinterpret_cast<const Texture*>(data.data() + hdr->textureindex);
+    for (int i = 0; i < hdr->numtextures; i++)
+    {
+        int64_t nameOffset = hdr->textureindex + static_cast<int64_t>(i) * sizeof(Texture) + textures[i].sznameindex;
+        if (nameOffset < 0 || nameOffset >= static_cast<int64_t>(data.size()))
+        {
+            error = "material name is outside the file";
+            return false;
+        }
+    }
 
-    std::cout << "Successfully saved: " << filename << std::endl;
     return true;
 }
 
 std::string MDLFile::ReadString(int offset)
 {
-    if (offset < 0 || offset >= fileData.size())
+    if (offset < 0 || static_cast<size_t>(offset) >= fileData.size())
         return "";
 
     const char* str = reinterpret_cast<const char*>(fileData.data() + offset);
@@ -365,8 +577,60 @@ void MDLFile::RebuildMDLFile(const std::vector<std::string>& newTextureNames,
     newHeader->keyvaluesize = static_cast<int>(keyValues.length());
 }
 
-HammerCompiler::HammerCompiler(const std::string& vmfPath, const std::string& gameDir)
-    : vmfPath(vmfPath), gameDir(gameDir) {
+HammerCompiler::HammerCompiler(const std::string& vmfPath, const std::string& gameDir, const CompilerOptions& options, FileSystem& fileSystem)
+    : vmfPath(vmfPath), gameDir(gameDir), options(options), fileSystem(fileSystem), searchPaths(fileSystem), outputRegistry(gameDir) {
+    outputDir = options.overlay ? GetOverlayDir() : gameDir;
+}
+
+// Исходная модель или материал по поисковым путям gameinfo.txt; пустая строка, если файла нет
+std::string HammerCompiler::FindGameFile(const std::string& relativePath)
+{
+    if (!searchPathsBuilt)
+    {
+        searchPaths.Build(gameDir);
+        searchPathsBuilt = true;
+    }
+
+    const std::string* fullPath = searchPaths.Find(relativePath);
+    return fullPath ? *fullPath : std::string();
+}
+
+// Каталог --overlay: custom/* подключается gameinfo.txt, поэтому vbsp находит модели там,
+// а сам каталог принадлежит только этой карте и удаляется целиком
+// Имя каталога включает хеш абсолютного пути VMF: карты с одинаковым именем
+// из разных папок не должны делить и удалять один overlay
+std::string HammerCompiler::GetOverlayDir() const
+{
+    std::string normalizedPath = OutputRegistry::NormalizePath(vmfPath);
+    uint64_t hash = HashBytes(normalizedPath.data(), normalizedPath.size());
+    return gameDir + "/custom/_propcolor_" + fs::path(vmfPath).stem().string() + "_" + HashToHex(hash).substr(8);
+}
+
+bool HammerCompiler::RemoveOverlay()
+{
+    std::string overlayDir = GetOverlayDir();
+    uintmax_t removedCount = fileSystem.RemoveAll(overlayDir);
+    if (fileSystem.Exists(overlayDir))
+    {
+        std::cout << "Failed to remove overlay " << overlayDir << std::endl;
+        return false;
+    }
+
+    if (removedCount > 0)
+    {
+        std::cout << "Removed overlay: " << overlayDir << " (" << removedCount << " entries)" << std::endl;
+    }
+    return true;
+}
+
+// VMF, который компилирует vbsp: исходный или <map>.colored.vmf в режиме --derivedvmf
+std::string HammerCompiler::GetCompileVMFPath() const
+{
+    if (!options.derivedVmf)
+        return vmfPath;
+
+    fs::path path(vmfPath);
+    return (path.parent_path() / (path.stem().string() + ".colored" + path.extension().string())).string();
 }
 
 bool HammerCompiler::ProcessVMF()
@@ -379,6 +643,12 @@ bool HammerCompiler::ProcessVMF()
         return false;
     }
 
+    // Проверка идёт до первой записи: ошибка останавливает этап до vbsp, а не после vrad
+    if (options.check && !CheckAssets())
+    {
+        return false;
+    }
+
     if (!ProcessModels())
     {
         std::cout << "Failed to process models" << std::endl;
@@ -395,13 +665,142 @@ bool HammerCompiler::ProcessVMF()
     return true;
 }
 
+// Только проверка, без изменений: -check и первый шаг --patchbsp
+bool HammerCompiler::CheckVMF()
+{
+    std::cout << "Checking VMF file: " << vmfPath << std::endl;
+
+    if (!ParseVMF())
+    {
+        std::cout << "Failed to parse VMF file" << std::endl;
+        return false;
+    }
+
+    return CheckAssets();
+}
+
+// Все модели карты ищутся и читаются разом, затем так же их материалы. Ошибки
+// собираются в короткий отчёт, а не теряются среди строк ProcessModels
+bool HammerCompiler::CheckAssets()
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    std::vector<std::string> errors;
+    std::map<std::string, std::vector<std::string>> materialUsage;   // VMT -> модели
+
+    IOQueue io(fileSystem);
+    for (const auto& [modelPath, colorInfo] : modelData)
+    {
+        std::string usedBy = " (" + std::to_string(colorInfo.entities.size()) + " props)";
+
+        if (IsColoredModelPath(modelPath))
+        {
+            errors.push_back("VMF is already colored: " + modelPath + usedBy + ", run -postcompile or --rollback first");
+            continue;
+        }
+
+        std::string fullModelPath = FindGameFile(modelPath);
+        if (fullModelPath.empty())
+        {
+            errors.push_back("Model not found: " + modelPath + usedBy);
+            continue;
+        }
+
+        size_t colorCount = colorInfo.colors.size();
+        io.Read(fullModelPath, [this, &errors, &materialUsage, modelPath, fullModelPath, colorCount](bool success, std::vector<unsigned char>& data)
+        {
+            std::string error;
+            if (!success)
+            {
+                errors.push_back("Cannot read model: " + fullModelPath);
+                return;
+            }
+            if (!MDLFile::Validate(data, error))
+            {
+                errors.push_back("Broken model: " + fullModelPath + ": " + error);
+                return;
+            }
+
+            // --tint не добавляет ни скинов, ни материалов
+            if (options.tint)
+                return;
+
+            int skinFamilies = std::max(reinterpret_cast<const StudioHdr*>(data.data())->numskinfamilies, 1);
+            if (skinFamilies + colorCount > MAXSTUDIOSKINS)
+            {
+                errors.push_back("Too many colors: " + modelPath + " has " + std::to_string(skinFamilies) + " skins and " +
+                    std::to_string(colorCount) + " colors, the limit is " + std::to_string(MAXSTUDIOSKINS) + " skins");
+            }
+
+            MDLFile mdl(fileSystem);
+            if (mdl.Load(fullModelPath, std::move(data)))
+            {
+                std::string baseTexturePath = mdl.GetTextureNames()[0];
+                size_t textureDotPos = baseTexturePath.find_last_of('.');
+                if (textureDotPos != std::string::npos)
+                    baseTexturePath = baseTexturePath.substr(0, textureDotPos);
+                materialUsage["materials/" + baseTexturePath + ".vmt"].push_back(modelPath);
+            }
+        });
+    }
+    io.Wait();
+
+    for (const auto& [vmtPath, models] : materialUsage)
+    {
+        std::string usedBy = " (used by " + models.front() + (models.size() > 1 ? " and " + std::to_string(models.size() - 1) + " more" : "") + ")";
+
+        std::string originalVmtPath = FindGameFile(vmtPath);
+        if (originalVmtPath.empty())
+        {
+            errors.push_back("Material not found: " + vmtPath + usedBy);
+            continue;
+        }
+
+        io.Read(originalVmtPath, [&errors, originalVmtPath, usedBy](bool success, std::vector<unsigned char>& data)
+        {
+            if (!success || DecodeText(std::string(data.begin(), data.end())).find_first_not_of(" \t\r\n") == std::string::npos)
+                errors.push_back("Material is empty or unreadable: " + originalVmtPath + usedBy);
+        });
+    }
+    io.Wait();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime);
+    std::cout << "Pre-flight check: " << modelData.size() << " models, " << materialUsage.size() << " materials, "
+        << errors.size() << " errors in " << elapsed.count() << " ms" << std::endl;
+
+    for (const auto& error : errors)
+    {
+        std::cout << clr::red << "  Error: " << error << clr::white << std::endl;
+    }
+
+    if (!errors.empty())
+    {
+        std::cout << clr::red << "Pre-flight check failed, nothing was changed" << clr::white << std::endl;
+        return false;
+    }
+    return true;
+}
+
 bool HammerCompiler::ParseVMF()
 {
-    std::string content = ReadFileContent(vmfPath);
+    // Двоичный режим: смещения сущностей должны совпадать с байтами файла для UpdateVMF
+    std::string content = ReadFileContent(vmfPath, std::ios::binary);
     if (content.empty())
     {
         return false;
     }
+    TrackInput(vmfPath, content.data(), content.size());
+
+    std::map<int, EntityFingerprint> previousEntities;
+    if (options.incremental && LoadEntityCache())
+    {
+        previousEntities.swap(entityCache);
+    }
+
+    int reusedCount = 0;
+    int addedCount = 0;
+    int changedCount = 0;
+    std::set<int> seenIds;
 
     size_t pos = 0;
     while (pos < content.length())
@@ -428,12 +827,49 @@ bool HammerCompiler::ParseVMF()
 
         if (braceCount == 0)
         {
-            std::string entityContent = content.substr(entityStart, currentPos - entityStart);
-
             EntityInfo entity;
             entity.startPos = entityStart;
             entity.endPos = currentPos;
 
+            // Первый ключ "id" после открывающей скобки принадлежит самой сущности
+            size_t idPos = content.find("\"id\"", braceStart);
+            if (idPos != std::string::npos && idPos < currentPos)
+            {
+                size_t valueStart = content.find("\"", idPos + 4);
+                if (valueStart != std::string::npos && valueStart < currentPos)
+                    entity.id = std::atoi(content.c_str() + valueStart + 1);
+            }
+
+            if (options.incremental)
+            {
+                entity.contentHash = HashBytes(content.data() + entityStart, currentPos - entityStart);
+
+                auto previous = previousEntities.find(entity.id);
+                if (entity.id != 0 && previous != previousEntities.end() && previous->second.contentHash == entity.contentHash)
+                {
+                    // Сущность не изменилась с прошлой компиляции: берём разобранные значения из таблицы
+                    entity.model = previous->second.model;
+                    entity.rendercolor = previous->second.rendercolor;
+                    entity.skin = previous->second.skin;
+                    entity.origin = previous->second.origin;
+                    entity.angles = previous->second.angles;
+                    entityCache[entity.id] = previous->second;
+                    seenIds.insert(entity.id);
+                    reusedCount++;
+
+                    if (!entity.model.empty() && !entity.rendercolor.empty() && entity.rendercolor != "255 255 255")
+                    {
+                        entities.push_back(entity);
+                        modelData[entity.model].colors.insert(entity.rendercolor);
+                    }
+
+                    pos = currentPos;
+                    continue;
+                }
+            }
+
+            std::string entityContent = content.substr(entityStart, currentPos - entityStart);
+
             size_t classnamePos = entityContent.find("\"classname\"");
             if (classnamePos != std::string::npos)
             {
@@ -442,7 +878,25 @@ bool HammerCompiler::ParseVMF()
                 if (valueStart != std::string::npos && valueEnd != std::string::npos)
                 {
                     std::string classname = entityContent.substr(valueStart + 1, valueEnd - valueStart - 1);
-                    if (classname == "prop_static")
+                    if (classname == "func_instance")
+                    {
+                        // Инстансы сами не обрабатываются, но являются входами компиляции
+                        size_t filePos = entityContent.find("\"file\"");
+                        if (filePos != std::string::npos)
+                        {
+                            size_t valueStart = entityContent.find("\"", filePos + 6);
+                            size_t valueEnd = entityContent.find("\"", valueStart + 1);
+                            if (valueStart != std::string::npos && valueEnd != std::string::npos)
+                            {
+                                fs::path instancePath = fs::path(vmfPath).parent_path() / entityContent.substr(valueStart + 1, valueEnd - valueStart - 1);
+                                if (fileSystem.Exists(instancePath.string()))
+                                {
+                                    TrackInput(instancePath.string());
+                                }
+                            }
+                        }
+                    }
+                    else if (classname == "prop_static")
                     {
                         size_t modelPos = entityContent.find("\"model\"");
                         if (modelPos != std::string::npos)
@@ -475,11 +929,63 @@ bool HammerCompiler::ParseVMF()
                             }
                         }
 
-                        if (!entity.model.empty() && !entity.rendercolor.empty() && entity.rendercolor != "255 255 255")
+                        size_t originPos = entityContent.find("\"origin\"");
+                        if (originPos != std::string::npos) {
+                            size_t valueStart = entityContent.find("\"", originPos + 8);
+                            size_t valueEnd = entityContent.find("\"", valueStart + 1);
+                            if (valueStart != std::string::npos && valueEnd != std::string::npos) {
+                                entity.origin = entityContent.substr(valueStart + 1, valueEnd - valueStart - 1);
+                            }
+                        }
+
+                        size_t anglesPos = entityContent.find("\"angles\"");
+                        if (anglesPos != std::string::npos) {
+                            size_t valueStart = entityContent.find("\"", anglesPos + 8);
+                            size_t valueEnd = entityContent.find("\"", valueStart + 1);
+                            if (valueStart != std::string::npos && valueEnd != std::string::npos) {
+                                entity.angles = entityContent.substr(valueStart + 1, valueEnd - valueStart - 1);
+                            }
+                        }
+
+                        bool isColored = !entity.model.empty() && !entity.rendercolor.empty() && entity.rendercolor != "255 255 255";
+
+                        if (options.incremental && entity.id != 0)
+                        {
+                            EntityFingerprint fingerprint;
+                            fingerprint.contentHash = entity.contentHash;
+                            fingerprint.model = entity.model;
+                            fingerprint.rendercolor = entity.rendercolor;
+                            fingerprint.skin = entity.skin;
+                            fingerprint.origin = entity.origin;
+                            fingerprint.angles = entity.angles;
+                            entityCache[entity.id] = fingerprint;
+                            seenIds.insert(entity.id);
+
+                            auto previous = previousEntities.find(entity.id);
+                            if (previous == previousEntities.end())
+                            {
+                                if (isColored)
+                                {
+                                    addedCount++;
+                                    dirtyModels.insert(entity.model);
+                                }
+                            }
+                            else
+                            {
+                                bool wasColored = !previous->second.rendercolor.empty() && previous->second.rendercolor != "255 255 255";
+                                if (isColored || wasColored)
+                                {
+                                    changedCount++;
+                                    dirtyModels.insert(entity.model);
+                                    dirtyModels.insert(previous->second.model);
+                                }
+                            }
+                        }
+
+                        if (isColored)
                         {
                             entities.push_back(entity);
                             modelData[entity.model].colors.insert(entity.rendercolor);
-                            modelData[entity.model].entities.push_back(&entities.back());
                         }
                     }
                 }
@@ -493,36 +999,234 @@ bool HammerCompiler::ParseVMF()
         }
     }
 
+    // Указатели берём после разбора: при росте вектора они бы стали недействительными
+    for (auto& entity : entities)
+    {
+        modelData[entity.model].entities.push_back(&entity);
+    }
+
+    if (options.incremental)
+    {
+        int removedCount = 0;
+        for (const auto& [id, previous] : previousEntities)
+        {
+            if (seenIds.find(id) != seenIds.end())
+                continue;
+
+            if (!previous.rendercolor.empty() && previous.rendercolor != "255 255 255")
+            {
+                removedCount++;
+                dirtyModels.insert(previous.model);
+            }
+        }
+
+        std::cout << "Entity diff: " << reusedCount << " unchanged, " << addedCount << " added, "
+            << changedCount << " changed, " << removedCount << " removed colored props" << std::endl;
+
+        SaveEntityCache();
+    }
+
     std::cout << "Found " << modelData.size() << " models with custom colors" << std::endl;
     return true;
 }
 
-bool HammerCompiler::ProcessModels()
+// Формат таблицы: одна строка на prop_static, поля через табуляцию:
+// id, хеш байтов сущности, модель, цвет, скин, origin, angles
+bool HammerCompiler::LoadEntityCache()
 {
-    std::map<std::string, std::map<std::string, std::set<std::string>>> textureUsage;
+    entityCache.clear();
 
-    for (const auto& [modelPath, colorInfo] : modelData)
+    std::string cachePath = vmfPath + ".entity_cache.txt";
+    if (!fileSystem.Exists(cachePath))
     {
-        std::string fullModelPath = gameDir + "/" + modelPath;
+        return false;
+    }
+
+    std::istringstream file(ReadFileContent(cachePath));
 
-        if (!CopyModelFiles(modelPath))
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::vector<std::string> fields;
+        std::istringstream iss(line);
+        std::string field;
+        while (std::getline(iss, field, '\t'))
         {
-            std::cout << "Failed to copy model files for: " << modelPath << std::endl;
-            continue;
+            fields.push_back(field);
         }
 
-        MDLFile mdl;
-        if (mdl.Load(fullModelPath))
-        {
-            std::vector<std::string> textureNames = mdl.GetTextureNames();
-            if (!textureNames.empty())
-            {
-                std::string baseTexture = textureNames[0];
-                textureUsage[baseTexture][modelPath] = colorInfo.colors;
+        if (fields.size() < 7)
+            continue;
+
+        EntityFingerprint fingerprint;
+        fingerprint.contentHash = std::strtoull(fields[1].c_str(), nullptr, 16);
+        fingerprint.model = fields[2];
+        fingerprint.rendercolor = fields[3];
+        fingerprint.skin = std::atoi(fields[4].c_str());
+        fingerprint.origin = fields[5];
+        fingerprint.angles = fields[6];
+        entityCache[std::atoi(fields[0].c_str())] = fingerprint;
+    }
+
+    return true;
+}
+
+bool HammerCompiler::SaveEntityCache()
+{
+    std::ostringstream oss;
+    for (const auto& [id, fingerprint] : entityCache)
+    {
+        oss << id << "\t" << HashToHex(fingerprint.contentHash) << "\t" << fingerprint.model << "\t"
+            << fingerprint.rendercolor << "\t" << fingerprint.skin << "\t" << fingerprint.origin << "\t" << fingerprint.angles << "\n";
+    }
+
+    std::string cachePath = vmfPath + ".entity_cache.txt";
+    TrackOutput(cachePath);
+    return WriteFileContent(cachePath, oss.str());
+}
+
+bool HammerCompiler::ProcessModels()
+{
+    std::map<std::string, std::map<std::string, std::set<std::string>>> textureUsage;
+    std::map<std::string, ModelFingerprint> pendingFingerprints;
+    int upToDateCount = 0;
+
+    if (options.incremental)
+    {
+        LoadModelCache();
+
+        // Выходы моделей, которых больше нет на карте
+        for (const auto& [modelPath, fingerprint] : modelCache)
+        {
+            if (modelData.find(modelPath) == modelData.end())
+                staleOutputs.insert(staleOutputs.end(), fingerprint.outputs.begin(), fingerprint.outputs.end());
+        }
+    }
+
+    // Остатки прошлого запуска не должны оказаться в поиске vbsp
+    if (options.overlay)
+    {
+        RemoveOverlay();
+    }
+
+    // Другие карты того же каталога могут писать файлы одновременно, но уборка
+    // ждёт, пока эта карта не запишет ссылки на свои файлы (SaveCreatedFilesList).
+    // Файлы --overlay лежат в личном каталоге карты, а в каталог мода ничего не пишется
+    if (!options.overlay && !outputRegistry.BeginOutputs())
+    {
+        return false;
+    }
+
+    // Без --hashnames имя цветной модели не зависит от набора цветов, и карта с той же
+    // моделью перепишет её своими цветами. Модели занимаются до первой записи, поэтому
+    // одновременно начатые карты тоже видят друг друга
+    if (!options.hashNames)
+    {
+        std::vector<std::string> coloredModels;
+        for (const auto& [modelPath, colorInfo] : modelData)
+        {
+            coloredModels.push_back(gameDir + "/" + GetColoredModelPath(modelPath));
+        }
+
+        std::vector<std::pair<std::string, std::string>> conflicts;
+        if (!outputRegistry.ClaimOutputs(vmfPath, coloredModels, conflicts))
+        {
+            std::cout << "Error: Cannot update output registry in " << gameDir << std::endl;
+            outputRegistry.End();
+            return false;
+        }
+
+        for (const auto& [file, owner] : conflicts)
+        {
+            std::cout << clr::red << "Error: " << file << " is also generated by " << owner << clr::white << std::endl;
+        }
+
+        if (!conflicts.empty())
+        {
+            std::cout << "Compile maps that share models with --hashnames, or finish the other map with -postcompile or --rollback first" << std::endl;
+            outputRegistry.End();
+            return false;
+        }
+    }
+
+    // Файлы моделей и материалов читаются и пишутся пачками на пуле потоков.
+    // Исходная модель загружается один раз: материалы добавляются к ней, а не к
+    // уже существующей цветной копии, иначе повторный запуск дублирует скины
+    IOQueue io(fileSystem);
+    std::map<std::string, MDLFile> models;
+
+    // С --hashnames имя VMT не зависит от модели: модели с общей текстурой и цветом
+    // делят один файл, и он пишется один раз
+    struct MaterialWrite
+    {
+        std::vector<std::string> owners;
+        bool written = false;
+    };
+    std::map<std::string, MaterialWrite> materialWrites;
+
+    for (const auto& [modelPath, colorInfo] : modelData)
+    {
+        if (options.incremental)
+        {
+            // Ни одна сущность этой модели не менялась: хватает сверки размеров и mtime исходников
+            if (dirtyModels.find(modelPath) == dirtyModels.end() && IsCleanModelUpToDate(modelPath, colorInfo.colors))
+            {
+                std::cout << "Model is up to date, skipped: " << modelPath << std::endl;
+                upToDateCount++;
+                continue;
+            }
+
+            ModelFingerprint fingerprint;
+            if (ComputeModelFingerprint(modelPath, colorInfo.colors, fingerprint))
+            {
+                if (IsModelUpToDate(modelPath, fingerprint))
+                {
+                    std::cout << "Model is up to date, skipped: " << modelPath << std::endl;
+                    upToDateCount++;
+                    continue;
+                }
+                pendingFingerprints[modelPath] = fingerprint;
             }
         }
+
+        if (!CopyModelFiles(modelPath, io))
+        {
+            std::cout << "Failed to copy model files for: " << modelPath << std::endl;
+            continue;
+        }
+
+        std::string fullModelPath = FindGameFile(modelPath);
+        const std::set<std::string>& colors = colorInfo.colors;
+        io.Read(fullModelPath, [this, &models, &textureUsage, modelPath, fullModelPath, &colors](bool success, std::vector<unsigned char>& data)
+        {
+            if (!success)
+            {
+                std::cout << "Error: Cannot open file " << fullModelPath << std::endl;
+                return;
+            }
+
+            MDLFile& mdl = models.try_emplace(modelPath, fileSystem).first->second;
+            if (!mdl.Load(fullModelPath, std::move(data)))
+            {
+                models.erase(modelPath);
+                return;
+            }
+
+            TrackInput(fullModelPath, mdl.GetFileData().data(), mdl.GetFileData().size());
+
+            std::vector<std::string> textureNames = mdl.GetTextureNames();
+            if (!textureNames.empty())
+            {
+                std::string baseTexture = textureNames[0];
+                textureUsage[baseTexture][modelPath] = colors;
+            }
+        });
     }
 
+    // Копии компаньонов и чтение всех исходных моделей идут одновременно
+    io.Wait();
+    journal.Sync();
+
     for (const auto& [texturePath, modelColors] : textureUsage)
     {
         std::cout << "Processing texture: " << texturePath << " used by " << modelColors.size() << " models" << std::endl;
@@ -535,548 +1239,2150 @@ bool HammerCompiler::ProcessModels()
             baseTexturePath = baseTexturePath.substr(0, textureDotPos);
         }
 
-        std::string originalVmtPath = gameDir + "/materials/" + baseTexturePath + ".vmt";
-        std::string originalVmtContent = ReadFileContent(originalVmtPath);
-
-        if (originalVmtContent.empty())
+        std::string originalVmtPath = FindGameFile("materials/" + baseTexturePath + ".vmt");
+        if (originalVmtPath.empty())
         {
-            std::cout << "Warning: Original VMT file not found or empty: " << originalVmtPath << std::endl;
+            std::cout << "Warning: Original VMT file not found or empty: materials/" << baseTexturePath << ".vmt" << std::endl;
             continue;
         }
 
-        for (const auto& [modelPath, colors] : modelColors)
+        io.Read(originalVmtPath, [this, &io, &models, &materialWrites, &modelColors = modelColors, baseTexturePath, originalVmtPath](bool success, std::vector<unsigned char>& data)
         {
-            fs::path modelFilePath(modelPath);
-            std::string modelName = modelFilePath.stem().string();
-            std::string uniqueSuffix = "_" + modelName;
+            std::string originalVmtContent = success ? DecodeText(std::string(data.begin(), data.end())) : "";
+            if (originalVmtContent.empty())
+            {
+                std::cout << "Warning: Original VMT file not found or empty: " << originalVmtPath << std::endl;
+                return;
+            }
+            TrackInput(originalVmtPath, originalVmtContent.data(), originalVmtContent.size());
 
-            std::cout << "Creating materials for model: " << modelPath << " with " << colors.size() << " colors" << std::endl;
+            for (const auto& [modelPath, colors] : modelColors)
+            {
+                fs::path modelFilePath(modelPath);
+                std::string modelName = modelFilePath.stem().string();
 
-            std::vector<std::string> materialPaths;
-            std::vector<std::string> orderedColors(colors.begin(), colors.end());
+                std::cout << "Creating materials for model: " << modelPath << " with " << colors.size() << " colors" << std::endl;
 
-            for (size_t i = 0; i < orderedColors.size(); i++)
-            {
-                std::string newBaseTexture = baseTexturePath + uniqueSuffix + "_color" + std::to_string(i + 1);
-                std::string vmtContent = CreateVMTContent(originalVmtContent, newBaseTexture, orderedColors[i]);
+                std::vector<std::string> materialPaths;
+                std::vector<std::string> orderedColors(colors.begin(), colors.end());
+
+                for (size_t i = 0; i < orderedColors.size(); i++)
+                {
+                    std::string newBaseTexture = GetColoredMaterialName(baseTexturePath, modelName, i, orderedColors[i]);
+                    std::string vmtContent = CreateVMTContent(originalVmtContent, newBaseTexture, orderedColors[i]);
+                    materialPaths.push_back(newBaseTexture);
+
+                    // vbsp материалы не нужны: они уходят в pak прямо из памяти
+                    if (options.overlay)
+                    {
+                        generatedFiles.Store("materials/" + newBaseTexture + ".vmt", std::vector<unsigned char>(vmtContent.begin(), vmtContent.end()));
+                        continue;
+                    }
+
+                    std::string vmtPath = gameDir + "/materials/" + newBaseTexture + ".vmt";
+
+                    // Файл уже пишется для другой модели: достаточно стать его владельцем
+                    auto existing = materialWrites.find(vmtPath);
+                    if (existing != materialWrites.end())
+                    {
+                        existing->second.owners.push_back(modelPath);
+                        if (existing->second.written)
+                            modelOutputs[modelPath].push_back(vmtPath);
+                        continue;
+                    }
+                    materialWrites[vmtPath].owners.push_back(modelPath);
+
+                    std::cout << "Creating VMT: " << vmtPath << " with color " << orderedColors[i] << std::endl;
 
-                std::string vmtPath = gameDir + "/materials/" + newBaseTexture + ".vmt";
-                std::cout << "Creating VMT: " << vmtPath << " with color " << orderedColors[i] << std::endl;
+                    PlanCreatedFile(vmtPath);
+                    io.Run([this, &materialWrites, vmtPath, vmtContent]() -> IOQueue::Completion
+                    {
+                        fileSystem.CreateDirectories(fs::path(vmtPath).parent_path().string());
+                        std::string bytes = EncodeText(vmtContent);
+                        WriteResult result = WriteFileIfChanged(fileSystem, vmtPath, bytes.data(), bytes.size());
+                        return [this, &materialWrites, vmtPath, result, size = vmtContent.size()]()
+                        {
+                            if (result == WriteResult::Failed)
+                            {
+                                std::cout << "Failed to create file: " << vmtPath << std::endl;
+                                std::cout << "Failed to write VMT file: " << vmtPath << std::endl;
+                                return;
+                            }
+
+                            if (result == WriteResult::Unchanged)
+                                std::cout << "Unchanged, skipped write: " << vmtPath << std::endl;
+                            else
+                                std::cout << "Successfully wrote file: " << vmtPath << " (" << size << " bytes)" << std::endl;
+                            AddCreatedFile(vmtPath);
+
+                            MaterialWrite& write = materialWrites[vmtPath];
+                            write.written = true;
+                            for (const auto& owner : write.owners)
+                            {
+                                modelOutputs[owner].push_back(vmtPath);
+                            }
+                        };
+                    });
+                }
+
+                auto model = models.find(modelPath);
+                if (model == models.end())
+                    continue;
 
-                if (!WriteFileContent(vmtPath, vmtContent))
+                std::string coloredModelPath = outputDir + "/" + GetColoredModelPath(modelPath);
+                MDLFile& mdl = model->second;
+                if (!mdl.AddMultipleMaterialsWithSkins(materialPaths))
                 {
-                    std::cout << "Failed to write VMT file: " << vmtPath << std::endl;
+                    std::cout << "Failed to add materials to model: " << coloredModelPath << std::endl;
                     continue;
                 }
 
-                materialPaths.push_back(newBaseTexture);
-                AddCreatedFile(vmtPath);
+                std::string modelKey = modelPath;
+                io.Run([this, &mdl, modelKey, coloredModelPath]() -> IOQueue::Completion
+                {
+                    const std::vector<unsigned char>& newData = mdl.GetNewFileData();
+                    WriteResult result = WriteFileIfChanged(fileSystem, coloredModelPath, newData.data(), newData.size());
+                    return [this, modelKey, coloredModelPath, result]()
+                    {
+                        if (result == WriteResult::Failed)
+                        {
+                            std::cout << "Error: Cannot create file " << coloredModelPath << std::endl;
+                            return;
+                        }
+
+                        if (result == WriteResult::Unchanged)
+                            std::cout << "Unchanged, skipped write: " << coloredModelPath << std::endl;
+                        else
+                            std::cout << "Successfully saved: " << coloredModelPath << std::endl;
+                        if (!options.overlay)
+                            AddCreatedFile(coloredModelPath);
+                        modelOutputs[modelKey].push_back(coloredModelPath);
+                    };
+                });
             }
+        });
+    }
+
+    // Исходные VMT читаются пачкой; новые VMT и цветные модели пишутся параллельно
+    io.Wait();
+    journal.Sync();
 
-            std::string fullModelPath = gameDir + "/" + modelPath;
-            fs::path modelFilePathObj(fullModelPath);
-            std::string coloredModelPath = (modelFilePathObj.parent_path() / (modelFilePathObj.stem().string() + "_colored.mdl")).string();
+    if (options.incremental)
+    {
+        for (auto& [modelPath, fingerprint] : pendingFingerprints)
+        {
+            auto outputs = modelOutputs.find(modelPath);
+            if (outputs == modelOutputs.end())
+                continue;
 
-            MDLFile mdl;
-            if (mdl.Load(coloredModelPath))
+            fingerprint.outputs = outputs->second;
+            fingerprint.outputHashes.clear();
+            for (const auto& output : fingerprint.outputs)
             {
-                if (!mdl.AddMultipleMaterialsWithSkins(materialPaths))
-                {
-                    std::cout << "Failed to add materials to model: " << coloredModelPath << std::endl;
-                }
-                else
+                fingerprint.outputHashes.push_back(HashFile(output));
+            }
+
+            // Выходы прошлого набора цветов, которых нет в новом (например, _color2 после удаления цвета)
+            auto cached = modelCache.find(modelPath);
+            if (cached != modelCache.end())
+            {
+                for (const auto& output : cached->second.outputs)
                 {
-                    mdl.Save(coloredModelPath);
+                    if (std::find(fingerprint.outputs.begin(), fingerprint.outputs.end(), output) == fingerprint.outputs.end())
+                        staleOutputs.push_back(output);
                 }
             }
+
+            modelCache[modelPath] = fingerprint;
+        }
+
+        std::cout << "Incremental build: " << upToDateCount << " models up to date, "
+            << pendingFingerprints.size() << " models rebuilt" << std::endl;
+
+        SaveModelCache();
+    }
+
+    return true;
+}
+
+bool HammerCompiler::ComputeModelFingerprint(const std::string& modelPath, const std::set<std::string>& colors, ModelFingerprint& fingerprint)
+{
+    std::string fullModelPath = FindGameFile(modelPath);
+    if (fullModelPath.empty())
+    {
+        return false;
+    }
+
+    MDLFile mdl(fileSystem);
+    if (!mdl.Load(fullModelPath))
+    {
+        return false;
+    }
+
+    const auto& mdlData = mdl.GetFileData();
+    TrackInput(fullModelPath, mdlData.data(), mdlData.size());
+    fingerprint.toolVersion = PROPCOLOR_TOOL_VERSION;
+    if (options.hashNames)
+        fingerprint.toolVersion += "+hashnames";
+    fingerprint.mdlHash = HashToHex(HashBytes(mdlData.data(), mdlData.size()));
+
+    std::string vmtContent;
+    std::vector<std::string> textureNames = mdl.GetTextureNames();
+    if (!textureNames.empty())
+    {
+        std::string baseTexturePath = textureNames[0];
+        size_t textureDotPos = baseTexturePath.find_last_of('.');
+        if (textureDotPos != std::string::npos)
+        {
+            baseTexturePath = baseTexturePath.substr(0, textureDotPos);
+        }
+
+        fingerprint.vmtPath = FindGameFile("materials/" + baseTexturePath + ".vmt");
+        if (!fingerprint.vmtPath.empty())
+        {
+            vmtContent = ReadFileContent(fingerprint.vmtPath);
+            TrackInput(fingerprint.vmtPath, vmtContent.data(), vmtContent.size());
+        }
+    }
+    fingerprint.vmtHash = HashToHex(HashBytes(vmtContent.data(), vmtContent.size()));
+
+    std::string basePath = modelPath.substr(0, modelPath.find_last_of('.'));
+    for (const auto& ext : modelCompanionExtensions)
+    {
+        std::string companionPath = FindGameFile(basePath + ext);
+        if (companionPath.empty())
+            continue;
+
+        // Пропущенная модель не дойдёт до CopyModelFiles, поэтому компаньоны учитываются здесь
+        std::string companionHash = HashFile(companionPath);
+        TrackInput(companionPath, companionHash, fileSystem.GetSize(companionPath));
+        fingerprint.companionHashes += ext + "=" + companionHash + ";";
+    }
+
+    fingerprint.colors = PackColorList(colors);
+    fingerprint.sourceStamp = GetSourceStamp(modelPath, fingerprint.vmtPath);
+
+    return true;
+}
+
+std::string HammerCompiler::PackColorList(const std::set<std::string>& colors)
+{
+    std::vector<uint32_t> packedColors;
+    for (const auto& color : colors)
+    {
+        packedColors.push_back(PackColor(color));
+    }
+    std::sort(packedColors.begin(), packedColors.end());
+
+    std::ostringstream oss;
+    for (size_t i = 0; i < packedColors.size(); i++)
+    {
+        if (i > 0)
+            oss << ",";
+        oss << HashToHex(packedColors[i]).substr(10);
+    }
+    return oss.str();
+}
+
+std::string HammerCompiler::GetSourceStamp(const std::string& modelPath, const std::string& vmtPath)
+{
+    std::vector<std::string> paths = { FindGameFile(modelPath), vmtPath };
+    std::string basePath = modelPath.substr(0, modelPath.find_last_of('.'));
+    for (const auto& ext : modelCompanionExtensions)
+    {
+        paths.push_back(FindGameFile(basePath + ext));
+    }
+
+    std::ostringstream oss;
+    for (const auto& path : paths)
+    {
+        FileInfo info;
+        if (!fileSystem.Stat(path, info))
+        {
+            oss << "-;";
+            continue;
+        }
+        oss << info.size << ":" << info.mtime << ";";
+    }
+    return oss.str();
+}
+
+bool HammerCompiler::IsCleanModelUpToDate(const std::string& modelPath, const std::set<std::string>& colors)
+{
+    auto cached = modelCache.find(modelPath);
+    if (cached == modelCache.end() || cached->second.sourceStamp.empty())
+    {
+        return false;
+    }
+
+    const ModelFingerprint& fingerprint = cached->second;
+    std::string toolVersion = PROPCOLOR_TOOL_VERSION;
+    if (options.hashNames)
+        toolVersion += "+hashnames";
+
+    if (fingerprint.toolVersion != toolVersion || fingerprint.colors != PackColorList(colors) ||
+        fingerprint.sourceStamp != GetSourceStamp(modelPath, fingerprint.vmtPath))
+    {
+        return false;
+    }
+
+    // Хеши берём из кеша: по размеру и mtime исходники совпадают с прошлой компиляцией
+    std::string fullModelPath = FindGameFile(modelPath);
+    TrackInput(fullModelPath, fingerprint.mdlHash, fileSystem.GetSize(fullModelPath));
+    if (!fingerprint.vmtPath.empty())
+        TrackInput(fingerprint.vmtPath, fingerprint.vmtHash, fileSystem.GetSize(fingerprint.vmtPath));
+
+    std::string basePath = modelPath.substr(0, modelPath.find_last_of('.'));
+    std::istringstream companions(fingerprint.companionHashes);
+    std::string companion;
+    while (std::getline(companions, companion, ';'))
+    {
+        size_t separator = companion.find('=');
+        if (separator == std::string::npos)
+            continue;
+
+        std::string companionPath = FindGameFile(basePath + companion.substr(0, separator));
+        if (!companionPath.empty())
+            TrackInput(companionPath, companion.substr(separator + 1), fileSystem.GetSize(companionPath));
+    }
+
+    return IsModelUpToDate(modelPath, fingerprint);
+}
+
+bool HammerCompiler::IsModelUpToDate(const std::string& modelPath, const ModelFingerprint& fingerprint)
+{
+    auto cached = modelCache.find(modelPath);
+    if (cached == modelCache.end() || !cached->second.SameInputs(fingerprint))
+    {
+        return false;
+    }
+
+    // Выход мог переписать кто-то другой (например, карта с той же моделью без --hashnames),
+    // поэтому сверяется содержимое, а не только наличие
+    const ModelFingerprint& cachedFingerprint = cached->second;
+    if (cachedFingerprint.outputHashes.size() != cachedFingerprint.outputs.size())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < cachedFingerprint.outputs.size(); i++)
+    {
+        if (HashFile(cachedFingerprint.outputs[i]) != cachedFingerprint.outputHashes[i])
+        {
+            std::cout << "Output changed since the last compile: " << cachedFingerprint.outputs[i] << std::endl;
+            return false;
+        }
+    }
+
+    std::string coloredModelPath = gameDir + "/" + GetColoredModelPath(modelPath);
+    if (!fileSystem.Exists(coloredModelPath))
+    {
+        return false;
+    }
+
+    AddCreatedFile(coloredModelPath);
+    for (const auto& output : cached->second.outputs)
+    {
+        if (output != coloredModelPath)
+        {
+            AddCreatedFile(output);
+        }
+    }
+
+    return true;
+}
+
+// Формат кеша: одна строка на модель, поля разделены табуляцией:
+// модель, версия, хеш MDL, хеш VMT, цвета, выходные файлы через ';',
+// путь к VMT, размеры и mtime исходников, хеши VVD, VTX и PHY, хеши выходных файлов через ';'
+bool HammerCompiler::LoadModelCache()
+{
+    modelCache.clear();
+
+    std::string cachePath = vmfPath + ".color_cache.txt";
+    if (!fileSystem.Exists(cachePath))
+    {
+        std::cout << "No incremental cache found, full rebuild: " << cachePath << std::endl;
+        return false;
+    }
+
+    std::istringstream file(ReadFileContent(cachePath));
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::vector<std::string> fields;
+        std::istringstream iss(line);
+        std::string field;
+        while (std::getline(iss, field, '\t'))
+        {
+            fields.push_back(field);
+        }
+
+        if (fields.size() < 7)
+            continue;
+
+        ModelFingerprint fingerprint;
+        fingerprint.toolVersion = fields[1];
+        fingerprint.mdlHash = fields[2];
+        fingerprint.vmtHash = fields[3];
+        fingerprint.colors = fields[4];
+
+        if (fields.size() > 5)
+        {
+            std::istringstream outputs(fields[5]);
+            std::string output;
+            while (std::getline(outputs, output, ';'))
+            {
+                if (!output.empty())
+                    fingerprint.outputs.push_back(output);
+            }
+        }
+
+        if (fields.size() > 7)
+        {
+            fingerprint.vmtPath = fields[6];
+            fingerprint.sourceStamp = fields[7];
+        }
+
+        if (fields.size() > 8)
+        {
+            fingerprint.companionHashes = fields[8];
+        }
+
+        if (fields.size() > 9)
+        {
+            std::istringstream hashes(fields[9]);
+            std::string hash;
+            while (std::getline(hashes, hash, ';'))
+            {
+                fingerprint.outputHashes.push_back(hash);
+            }
+        }
+
+        modelCache[fields[0]] = fingerprint;
+    }
+
+    std::cout << "Loaded incremental cache: " << cachePath << " (" << modelCache.size() << " models)" << std::endl;
+    return true;
+}
+
+bool HammerCompiler::SaveModelCache()
+{
+    std::ostringstream oss;
+    for (const auto& [modelPath, fingerprint] : modelCache)
+    {
+        // Модели, которых больше нет на карте, в кеше не храним
+        if (modelData.find(modelPath) == modelData.end())
+            continue;
+
+        oss << modelPath << "\t" << fingerprint.toolVersion << "\t" << fingerprint.mdlHash << "\t"
+            << fingerprint.vmtHash << "\t" << fingerprint.colors << "\t";
+        for (size_t i = 0; i < fingerprint.outputs.size(); i++)
+        {
+            if (i > 0)
+                oss << ";";
+            oss << fingerprint.outputs[i];
+        }
+        oss << "\t" << fingerprint.vmtPath << "\t" << fingerprint.sourceStamp << "\t" << fingerprint.companionHashes << "\t";
+        for (size_t i = 0; i < fingerprint.outputHashes.size(); i++)
+        {
+            if (i > 0)
+                oss << ";";
+            oss << fingerprint.outputHashes[i];
+        }
+        oss << "\n";
+    }
+
+    std::string cachePath = vmfPath + ".color_cache.txt";
+    TrackOutput(cachePath);
+    return WriteFileContent(cachePath, oss.str());
+}
+
+// Обычная схема: <модель>_colored.mdl и <текстура>_<модель>_colorN, где N - номер
+// цвета в отсортированном наборе. Добавление цвета перенумеровывает остальные.
+// Схема --hashnames: суффиксы из хеша (модель, набор цветов) и (материал, цвет),
+// поэтому существующие файлы не меняют имён, а результат воспроизводим на любой машине.
+std::string HammerCompiler::GetColoredModelPath(const std::string& modelPath)
+{
+    std::string basePath = modelPath.substr(0, modelPath.find_last_of('.'));
+    if (!options.hashNames)
+    {
+        return basePath + "_colored.mdl";
+    }
+
+    std::vector<uint32_t> packedColors;
+    auto model = modelData.find(modelPath);
+    if (model != modelData.end())
+    {
+        for (const auto& color : model->second.colors)
+        {
+            packedColors.push_back(PackColor(color));
+        }
+    }
+    std::sort(packedColors.begin(), packedColors.end());
+
+    std::string normalizedPath = NormalizeAssetPath(modelPath);
+    uint64_t hash = HashBytes(normalizedPath.data(), normalizedPath.size());
+    for (uint32_t packedColor : packedColors)
+    {
+        hash = HashColor(packedColor, hash);
+    }
+
+    return basePath + "_colored_" + HashToHex(hash).substr(8) + ".mdl";
+}
+
+std::string HammerCompiler::GetColoredMaterialName(const std::string& baseTexturePath, const std::string& modelName, size_t colorIndex, const std::string& color)
+{
+    if (!options.hashNames)
+    {
+        return baseTexturePath + "_" + modelName + "_color" + std::to_string(colorIndex + 1);
+    }
+
+    std::string normalizedPath = NormalizeAssetPath(baseTexturePath);
+    uint32_t packedColor = PackColor(color);
+    uint64_t hash = HashBytes(normalizedPath.data(), normalizedPath.size());
+    hash = HashColor(packedColor, hash);
+
+    return baseTexturePath + "_color_" + HashToHex(hash).substr(8);
+}
+
+bool HammerCompiler::IsColoredModelPath(const std::string& modelPath, std::string* originalModelPath)
+{
+    size_t coloredPos = modelPath.rfind("_colored");
+    if (coloredPos == std::string::npos)
+    {
+        return false;
+    }
+
+    std::string tail = modelPath.substr(coloredPos + 8);
+    bool isColored = (tail == ".mdl");
+    if (!isColored && tail.length() == 13 && tail[0] == '_' && tail.compare(9, 4, ".mdl") == 0)
+    {
+        isColored = std::all_of(tail.begin() + 1, tail.begin() + 9,
+            [](char c) { return std::isxdigit(static_cast<unsigned char>(c)) != 0; });
+    }
+
+    if (isColored && originalModelPath)
+    {
+        *originalModelPath = modelPath.substr(0, coloredPos) + ".mdl";
+    }
+
+    return isColored;
+}
+
+bool HammerCompiler::CopyModelFiles(const std::string& originalModelPath, IOQueue& io)
+{
+    std::cout << "Looking for model: " << originalModelPath << std::endl;
+
+    std::string fullModelPath = FindGameFile(originalModelPath);
+    if (fullModelPath.empty())
+    {
+        std::cout << "Model file not found in search paths: " << originalModelPath << std::endl;
+        return false;
+    }
+
+    std::cout << "Found model: " << fullModelPath << std::endl;
+    std::string basePath = originalModelPath.substr(0, originalModelPath.find_last_of('.'));
+    std::string baseName = fs::path(fullModelPath).stem().string();
+
+    fs::path coloredModelPath = fs::path(outputDir + "/" + GetColoredModelPath(originalModelPath));
+    std::string coloredBaseName = coloredModelPath.stem().string();
+    fs::path coloredDir = coloredModelPath.parent_path();
+
+    std::cout << "Base name: " << baseName << std::endl;
+    std::cout << "Colored base name: " << coloredBaseName << std::endl;
+    std::cout << "Colored model path: " << coloredModelPath << std::endl;
+
+    // В обычном режиме компаньоны готовой модели уже скопированы; в инкрементальном
+    // проверяем их, так как исходники могли измениться, а после прерванного
+    // запуска - так как до них могло не дойти
+    bool coloredModelExists = fileSystem.Exists(coloredModelPath.string());
+    bool reuseCompanions = coloredModelExists && !options.incremental && !resumingJournal;
+
+    // Цветная модель пишется целиком после добавления материалов (ProcessModels),
+    // там же она попадает в созданные файлы и выходы модели
+    if (coloredModelExists)
+    {
+        std::cout << "Colored model already exists: " << coloredModelPath << std::endl;
+    }
+    else
+    {
+        fileSystem.CreateDirectories(coloredDir.string());
+        PlanCreatedFile(coloredModelPath.string());
+    }
+
+    for (const auto& ext : modelCompanionExtensions)
+    {
+        fs::path originalFile = FindGameFile(basePath + ext);
+        fs::path coloredFile = coloredDir / (coloredBaseName + ext);
+
+        std::cout << "Looking for: " << basePath + ext << std::endl;
+
+        if (!originalFile.empty())
+        {
+            TrackInput(originalFile.string());
+
+            // Модель могла создать другая карта: на её компаньоны эта карта тоже ссылается,
+            // а недостающие (та карта ещё их копирует) копирует сама
+            if (reuseCompanions && fileSystem.Exists(coloredFile.string()))
+            {
+                if (!options.overlay)
+                    AddCreatedFile(coloredFile.string());
+                modelOutputs[originalModelPath].push_back(coloredFile.string());
+                continue;
+            }
+
+            PlanCreatedFile(coloredFile.string());
+            io.Run([this, originalModelPath, originalFile, coloredFile]() -> IOQueue::Completion
+            {
+                WriteResult result = CopyFileIfChanged(fileSystem, originalFile.string(), coloredFile.string());
+                return [this, originalModelPath, originalFile, coloredFile, result]()
+                {
+                    if (result == WriteResult::Failed)
+                        return;
+
+                    if (result == WriteResult::Unchanged)
+                        std::cout << "Unchanged, skipped copy: " << coloredFile << std::endl;
+                    else
+                        std::cout << "Copied file: " << originalFile << " to " << coloredFile << std::endl;
+                    if (!options.overlay)
+                        AddCreatedFile(coloredFile.string());
+                    modelOutputs[originalModelPath].push_back(coloredFile.string());
+                };
+            });
+        }
+        else
+        {
+            std::cout << "File not found (this may be normal): " << basePath + ext << std::endl;
+        }
+    }
+
+    return true;
+}
+
+std::string HammerCompiler::CreateVMTContent(const std::string& originalContent, const std::string& newBaseTexture, const std::string& color)
+{
+    std::istringstream iss(originalContent);
+    std::ostringstream oss;
+    std::string line;
+
+    bool hasColor2 = false;
+    bool hasBlendTint = false;
+    bool hasBaseTexture = false;
+
+    // Извлекаем оригинальное имя текстуры из оригинального VMT
+    std::string originalBaseTexture;
+    std::istringstream issTemp(originalContent);
+    std::string tempLine;
+    while (std::getline(issTemp, tempLine)) {
+        std::string trimmedLine = tempLine;
+        trimmedLine.erase(0, trimmedLine.find_first_not_of(" \t"));
+        trimmedLine.erase(trimmedLine.find_last_not_of(" \t") + 1);
+
+        if (trimmedLine.find("\"$basetexture\"") == 0) {
+            size_t firstQuote = trimmedLine.find('"', 14);
+            size_t secondQuote = trimmedLine.find('"', firstQuote + 1);
+            if (firstQuote != std::string::npos && secondQuote != std::string::npos) {
+                originalBaseTexture = trimmedLine.substr(firstQuote + 1, secondQuote - firstQuote - 1);
+                break;
+            }
+        }
+    }
+
+    if (originalBaseTexture.empty()) {
+        originalBaseTexture = newBaseTexture;
+        size_t colorPos = originalBaseTexture.find("_color");
+        if (colorPos != std::string::npos) {
+            originalBaseTexture = originalBaseTexture.substr(0, colorPos);
+        }
+        size_t modelSuffixPos = originalBaseTexture.find_last_of('_');
+        if (modelSuffixPos != std::string::npos && !options.hashNames) {
+            std::string possibleSuffix = originalBaseTexture.substr(modelSuffixPos);
+            if (possibleSuffix.find("hr_") == std::string::npos &&
+                possibleSuffix.find("lr_") == std::string::npos) {
+                originalBaseTexture = originalBaseTexture.substr(0, modelSuffixPos);
+            }
+        }
+    }
+
+    iss.clear();
+    iss.str(originalContent);
+
+    while (std::getline(iss, line))
+    {
+        std::string trimmedLine = line;
+        trimmedLine.erase(0, trimmedLine.find_first_not_of(" \t"));
+        trimmedLine.erase(trimmedLine.find_last_not_of(" \t") + 1);
+
+        if (trimmedLine.find("\"$basetexture\"") == 0) {
+            size_t firstQuote = trimmedLine.find('"', 14);
+            size_t secondQuote = trimmedLine.find('"', firstQuote + 1);
+            if (firstQuote != std::string::npos && secondQuote != std::string::npos) {
+                line = "\t\"$basetexture\" \"" + originalBaseTexture + "\"";
+            }
+            hasBaseTexture = true;
+        }
+
+        else if (trimmedLine.find("\"$color2\"") == 0)
+        {
+            size_t firstBrace = trimmedLine.find('{');
+            size_t secondBrace = trimmedLine.find('}');
+            if (firstBrace != std::string::npos && secondBrace != std::string::npos)
+            {
+                line = "\t\"$color2\" \"{" + color + "}\"";
+            }
+            hasColor2 = true;
+        }
+
+        else if (trimmedLine.find("\"$blendtintbybasealpha\"") == 0)
+        {
+            size_t firstQuote = trimmedLine.find('"', 24);
+            size_t secondQuote = trimmedLine.find('"', firstQuote + 1);
+            if (firstQuote != std::string::npos && secondQuote != std::string::npos)
+            {
+                line = "\t\"$blendtintbybasealpha\" \"1\"";
+            }
+            hasBlendTint = true;
+        }
+
+        oss << line << "\n";
+    }
+
+    std::string result = oss.str();
+
+    if (!hasBaseTexture) {
+        size_t lastBrace = result.rfind('}');
+        if (lastBrace != std::string::npos) {
+            result.insert(lastBrace, "\n\t\"$basetexture\" \"" + originalBaseTexture + "\"");
+        }
+    }
+
+    if (!hasColor2)
+    {
+        size_t lastBrace = result.rfind('}');
+        if (lastBrace != std::string::npos)
+        {
+            result.insert(lastBrace, "\n\t\"$color2\" \"{" + color + "}\"");
+        }
+    }
+
+    if (!hasBlendTint)
+    {
+        size_t lastBrace = result.rfind('}');
+        if (lastBrace != std::string::npos)
+        {
+            result.insert(lastBrace, "\n\t\"$blendtintbybasealpha\" \"1\"");
+        }
+    }
+
+    return result;
+}
+
+// Номер скина цветной модели: цвета модели отсортированы, скин 0 остаётся исходным
+int HammerCompiler::GetColorSkinIndex(const EntityInfo& entity)
+{
+    auto colorInfo = modelData.find(entity.model);
+    if (colorInfo == modelData.end())
+        return -1;
+
+    int colorIndex = 1;
+    for (const auto& color : colorInfo->second.colors)
+    {
+        if (color == entity.rendercolor)
+            return colorIndex;
+        colorIndex++;
+    }
+    return -1;
+}
+
+// Пара "ключ" "значение" верхнего уровня сущности: позиции кавычек в тексте
+struct EntityKeyValue {
+    size_t keyStart;
+    size_t valueStart;
+    size_t valueEnd;        // после закрывающей кавычки
+    std::string key;
+    std::string value;
+};
+
+static std::vector<EntityKeyValue> ParseEntityKeyValues(std::string_view entityContent) {
+    std::vector<EntityKeyValue> result;
+
+    int depth = 0;
+    size_t pos = 0;
+    size_t pendingKey = std::string_view::npos;
+    std::string pendingKeyName;
+
+    while (pos < entityContent.size()) {
+        char c = entityContent[pos];
+        if (c == '{') {
+            depth++;
+            pendingKey = std::string_view::npos;
+        }
+        else if (c == '}') {
+            depth--;
+        }
+        else if (c == '"') {
+            size_t end = entityContent.find('"', pos + 1);
+            if (end == std::string_view::npos)
+                break;
+
+            // Ключи вложенных блоков (editor, connections) не трогаем
+            if (depth == 1) {
+                std::string token(entityContent.substr(pos + 1, end - pos - 1));
+                if (pendingKey == std::string_view::npos) {
+                    pendingKey = pos;
+                    pendingKeyName = token;
+                }
+                else {
+                    result.push_back({ pendingKey, pos, end + 1, pendingKeyName, token });
+                    pendingKey = std::string_view::npos;
+                }
+            }
+            pos = end;
+        }
+        pos++;
+    }
+
+    return result;
+}
+
+// Правка пары: замена значения, имени ключа или удаление пары целиком
+struct EntityEdit {
+    size_t start;
+    size_t length;
+    std::string replacement;
+};
+
+static EntityEdit RemoveKeyValue(std::string_view entityContent, const EntityKeyValue& keyValue) {
+    size_t start = keyValue.keyStart;
+    size_t end = keyValue.valueEnd;
+    while (end < entityContent.size() && (entityContent[end] == ' ' || entityContent[end] == '\t'))
+        end++;
+
+    size_t lineStart = start;
+    while (lineStart > 0 && (entityContent[lineStart - 1] == ' ' || entityContent[lineStart - 1] == '\t'))
+        lineStart--;
+
+    // Пара занимает всю строку: удаляем строку вместе с переводом строки
+    bool atLineStart = lineStart == 0 || entityContent[lineStart - 1] == '\n';
+    if (atLineStart && (end == entityContent.size() || entityContent[end] == '\r' || entityContent[end] == '\n')) {
+        start = lineStart;
+        if (end < entityContent.size() && entityContent[end] == '\r') end++;
+        if (end < entityContent.size() && entityContent[end] == '\n') end++;
+    }
+
+    return { start, end - start, "" };
+}
+
+// Совпадает ли файл на диске с результатом, собранным из кусков
+static bool FileMatchesSlices(FileSystem& fileSystem, const std::string& path, const std::vector<std::string_view>& slices)
+{
+    size_t totalSize = 0;
+    for (const auto& slice : slices)
+        totalSize += slice.size();
+
+    FileInfo info;
+    if (!fileSystem.Stat(path, info) || info.size != totalSize)
+        return false;
+
+    FileView existing;
+    if (!fileSystem.Map(path, existing))
+        return false;
+
+    const unsigned char* data = existing.GetData();
+    size_t offset = 0;
+    for (const auto& slice : slices)
+    {
+        if (memcmp(data + offset, slice.data(), slice.size()) != 0)
+            return false;
+        offset += slice.size();
+    }
+    return true;
+}
+
+// VMF переписывается за один проход: для каждой сущности собирается список правок
+// (смещение, длина, замена), а файл пишется кусками исходника вперемешку с заменами
+bool HammerCompiler::UpdateVMF() {
+    std::cout << "Updating VMF file..." << std::endl;
+
+    FileView input;
+    if (!fileSystem.Map(vmfPath, input))
+    {
+        std::cout << "Failed to open file: " << vmfPath << std::endl;
+        return false;
+    }
+
+    std::string_view content(reinterpret_cast<const char*>(input.GetData()), input.GetSize());
+    std::cout << "Original VMF content size: " << content.length() << " bytes" << std::endl;
+
+    std::vector<EntityInfo*> sortedEntities;
+    for (auto& entity : entities)
+    {
+        sortedEntities.push_back(&entity);
+    }
+
+    std::sort(sortedEntities.begin(), sortedEntities.end(),
+        [](const EntityInfo* a, const EntityInfo* b) { return a->startPos < b->startPos; });
+
+    std::cout << "Processing " << sortedEntities.size() << " entities for update" << std::endl;
+
+    std::vector<EntityEdit> edits;
+    int updatedCount = 0;
+
+    for (auto* entity : sortedEntities)
+    {
+        if (modelData.find(entity->model) == modelData.end())
+            continue;
+
+        if (entity->endPos > content.size())
+        {
+            std::cout << "Error: VMF changed since parsing: " << vmfPath << std::endl;
+            return false;
+        }
+
+        std::string_view entityContent = content.substr(entity->startPos, entity->endPos - entity->startPos);
+
+        int colorIndex = GetColorSkinIndex(*entity);
+        if (colorIndex == -1)
+        {
+            std::cout << "Error: Could not find color index for: " << entity->rendercolor << std::endl;
+            continue;
+        }
+
+        const EntityKeyValue* model = nullptr;
+        const EntityKeyValue* skin = nullptr;
+        const EntityKeyValue* color = nullptr;
+        std::vector<EntityKeyValue> keyValues = ParseEntityKeyValues(entityContent);
+        for (const auto& keyValue : keyValues)
+        {
+            if (keyValue.key == "model" && !model) model = &keyValue;
+            else if (keyValue.key == "skin" && !skin) skin = &keyValue;
+            else if (keyValue.key == "rendercolor" && !color) color = &keyValue;
+        }
+
+        // Новые строки встают сразу после строки модели, с её отступом и переводом строки
+        size_t lineEnd = model ? entityContent.find('\n', model->valueEnd) : std::string_view::npos;
+        if (lineEnd == std::string_view::npos)
+        {
+            std::cout << "Error: Could not find model line for entity " << entity->id << std::endl;
+            continue;
+        }
+
+        size_t lineStart = model->keyStart;
+        while (lineStart > 0 && (entityContent[lineStart - 1] == ' ' || entityContent[lineStart - 1] == '\t'))
+            lineStart--;
+        std::string indent(entityContent.substr(lineStart, model->keyStart - lineStart));
+        std::string newline = lineEnd > 0 && entityContent[lineEnd - 1] == '\r' ? "\r\n" : "\n";
+
+        std::cout << "Updating entity with model: " << entity->model << " and color: " << entity->rendercolor
+            << " (skin " << colorIndex << ")" << std::endl;
+
+        std::vector<EntityEdit> entityEdits;
+        entityEdits.push_back({ model->valueStart + 1, model->value.size(), GetColoredModelPath(entity->model) });
+
+        // Цвет остаётся на своём месте под ключом "$color": vbsp его не видит,
+        // а post-compile переименовывает обратно, и VMF восстанавливается побайтно
+        if (color)
+        {
+            entityEdits.push_back({ color->keyStart, color->key.size() + 2, "\"$color\"" });
+        }
+
+        std::string insertion;
+        if (skin)
+        {
+            // Исходный скин тоже сохраняется в маркере
+            entityEdits.push_back({ skin->valueStart + 1, skin->value.size(), std::to_string(colorIndex) });
+            insertion += indent + "\"$skin\" \"" + skin->value + "\"" + newline;
+        }
+        else
+        {
+            insertion += indent + "\"skin\" \"" + std::to_string(colorIndex) + "\"" + newline;
+        }
+
+        entityEdits.push_back({ lineEnd + 1, 0, insertion });
+
+        for (auto& edit : entityEdits)
+        {
+            edit.start += entity->startPos;
+            edits.push_back(std::move(edit));
+        }
+        updatedCount++;
+    }
+
+    std::stable_sort(edits.begin(), edits.end(), [](const EntityEdit& a, const EntityEdit& b) {
+        return a.start != b.start ? a.start < b.start : a.length < b.length;
+    });
+
+    std::vector<std::string_view> slices;
+    slices.reserve(edits.size() * 2 + 1);
+
+    size_t copiedUpTo = 0;
+    for (const auto& edit : edits)
+    {
+        if (edit.start < copiedUpTo)
+        {
+            std::cout << "Error: Overlapping VMF edits at offset " << edit.start << std::endl;
+            return false;
+        }
+
+        slices.push_back(content.substr(copiedUpTo, edit.start - copiedUpTo));
+        slices.push_back(edit.replacement);
+        copiedUpTo = edit.start + edit.length;
+    }
+    slices.push_back(content.substr(copiedUpTo));
+
+    // Производный VMF пишется всегда: его компилирует vbsp, даже если менять нечего
+    std::string outputPath = vmfPath;
+    if (options.derivedVmf)
+    {
+        outputPath = GetCompileVMFPath();
+        if (FileMatchesSlices(fileSystem, outputPath, slices))
+        {
+            std::cout << "Unchanged, skipped write: " << outputPath << std::endl;
+            AddCreatedFile(outputPath);
+            TrackOutput(outputPath);
+            return true;
+        }
+    }
+    else if (edits.empty())
+    {
+        std::cout << "No changes to save in VMF" << std::endl;
+        return true;
+    }
+
+    std::cout << "Writing updated VMF content: " << updatedCount << " entities, " << edits.size() << " edits" << std::endl;
+
+    std::unique_ptr<FileWriter> output = fileSystem.OpenWrite(outputPath);
+    if (!output)
+    {
+        return false;
+    }
+
+    output->WriteGather(slices);
+
+    // Отображение держит исходный файл, а Windows не даёт заменить такой файл
+    input.Close();
+    if (options.derivedVmf)
+        PlanCreatedFile(outputPath);
+    else
+        PlanStep("vmf", outputPath);
+
+    if (!output->Commit())
+    {
+        std::cout << "Failed to write VMF file: " << outputPath << std::endl;
+        return false;
+    }
+
+    std::cout << "Successfully updated VMF file: " << outputPath << " (" << output->GetTotalWritten() << " bytes)" << std::endl;
+    if (options.derivedVmf)
+    {
+        AddCreatedFile(outputPath);
+    }
+    else
+    {
+        FinishStep("vmf", outputPath);
+    }
+    TrackOutput(outputPath);
+    return true;
+}
+
+// Режим --patchbsp: VMF только читается, цветные модели создаются после vbsp,
+// а статические пропы переключаются на них прямо в игровом лампе sprp.
+// С --tint цвет пишется в m_DiffuseModulation пропа, и файлы не создаются вовсе
+bool HammerCompiler::PatchBSP(const std::string& bspPath)
+{
+    std::cout << "Patching static props in BSP: " << bspPath << std::endl;
+
+    if (!ParseVMF())
+    {
+        std::cout << "Failed to parse VMF file" << std::endl;
+        return false;
+    }
+
+    if (entities.empty())
+    {
+        std::cout << "No colored props, BSP was not modified" << std::endl;
+        return true;
+    }
+
+    BSPFile bsp;
+    if (!bsp.Load(bspPath))
+    {
+        return false;
+    }
+
+    std::vector<unsigned char> lumpData;
+    uint16_t lumpVersion = 0;
+    if (!bsp.ReadGameLump(GAMELUMP_STATIC_PROPS, lumpData, lumpVersion))
+    {
+        return false;
+    }
+
+    StaticPropLump staticProps;
+    if (!staticProps.Parse(lumpData, lumpVersion))
+    {
+        return false;
+    }
+
+    std::cout << "Static prop lump v" << lumpVersion << ": " << staticProps.GetPropCount() << " props, "
+        << staticProps.GetModelNames().size() << " models" << std::endl;
+
+    // Версия лампа одна на весь BSP, поэтому и выбор пути общий для всех пропов
+    usingTint = options.tint && staticProps.HasDiffuseModulation();
+    if (options.tint && !usingTint)
+    {
+        std::cout << clr::yellow << "Static prop lump v" << lumpVersion << " (" << staticProps.GetPropSize()
+            << "-byte entries) has no diffuse modulation, falling back to colored models" << clr::white << std::endl;
+    }
+
+    if (!usingTint && !ProcessModels())
+    {
+        std::cout << "Failed to process models" << std::endl;
+        return false;
+    }
+
+    std::vector<std::pair<const EntityInfo*, size_t>> matches;
+    int unmatchedCount = MatchStaticProps(staticProps, matches);
+
+    static const unsigned char noModulation[4] = { 255, 255, 255, 255 };
+    for (const auto& [entity, propIndex] : matches)
+    {
+        if (usingTint)
+        {
+            int r = 255, g = 255, b = 255;
+            sscanf(entity->rendercolor.c_str(), "%d %d %d", &r, &g, &b);
+            const unsigned char modulation[4] = {
+                static_cast<unsigned char>(std::clamp(r, 0, 255)),
+                static_cast<unsigned char>(std::clamp(g, 0, 255)),
+                static_cast<unsigned char>(std::clamp(b, 0, 255)),
+                255 };
+            staticProps.SetDiffuseModulation(propIndex, modulation);
+        }
+        else
+        {
+            staticProps.SetPropType(propIndex, staticProps.AddModelName(GetColoredModelPath(entity->model)));
+            staticProps.SetSkin(propIndex, GetColorSkinIndex(*entity));
+
+            // Цвет уже в материале: убираем модуляцию, которую vbsp взял из rendercolor
+            staticProps.SetDiffuseModulation(propIndex, noModulation);
+        }
+    }
+
+    std::cout << (usingTint ? "Tinted " : "Patched ") << matches.size() << " static props, "
+        << unmatchedCount << " not found in BSP" << std::endl;
+
+    std::vector<unsigned char> patchedData = staticProps.Serialize();
+    if (matches.empty() || patchedData == lumpData)
+    {
+        std::cout << "Static prop lump is already up to date, BSP was not modified" << std::endl;
+        return true;
+    }
+
+    if (!bsp.WriteWithGameLump(GAMELUMP_STATIC_PROPS, patchedData))
+    {
+        std::cout << "Failed to write static prop lump: " << bspPath << std::endl;
+        return false;
+    }
+
+    TrackOutput(bspPath);
+    return true;
+}
+
+static bool ParseVector(const std::string& value, float result[3])
+{
+    result[0] = result[1] = result[2] = 0.0f;
+    if (value.empty())
+        return true;
+
+    return sscanf(value.c_str(), "%f %f %f", &result[0], &result[1], &result[2]) == 3;
+}
+
+static bool IsSameAngle(float a, float b)
+{
+    float delta = std::fmod(std::fabs(a - b), 360.0f);
+    return std::min(delta, 360.0f - delta) < 0.01f;
+}
+
+// Сопоставляет цветные сущности VMF с пропами лампа по модели, origin и angles.
+// Возвращает число сущностей, для которых проп не найден
+int HammerCompiler::MatchStaticProps(const StaticPropLump& staticProps, std::vector<std::pair<const EntityInfo*, size_t>>& matches)
+{
+    // Пропы по исходной модели; уже исправленный BSP даёт те же ключи, поэтому повторный запуск безопасен
+    std::map<std::string, std::vector<size_t>> propsByModel;
+    for (size_t i = 0; i < staticProps.GetPropCount(); i++)
+    {
+        uint16_t propType = staticProps.GetPropType(i);
+        if (propType >= staticProps.GetModelNames().size())
+            continue;
+
+        std::string modelName = staticProps.GetModelNames()[propType];
+        std::string originalModel;
+        if (IsColoredModelPath(modelName, &originalModel))
+        {
+            modelName = originalModel;
+        }
+        propsByModel[NormalizeAssetPath(modelName)].push_back(i);
+    }
+
+    std::vector<bool> usedProps(staticProps.GetPropCount(), false);
+    int unmatchedCount = 0;
+
+    // Порядок пропов в лампе совпадает с порядком в VMF, поэтому при одинаковых
+    // ключах берётся первый свободный проп
+    for (const auto& entity : entities)
+    {
+        if (GetColorSkinIndex(entity) == -1)
+            continue;
+
+        float origin[3], angles[3];
+        if (!ParseVector(entity.origin, origin) || !ParseVector(entity.angles, angles))
+        {
+            std::cout << "Warning: Invalid origin or angles for entity " << entity.id << std::endl;
+            unmatchedCount++;
+            continue;
+        }
+
+        size_t propIndex = SIZE_MAX;
+        auto candidates = propsByModel.find(NormalizeAssetPath(entity.model));
+        if (candidates != propsByModel.end())
+        {
+            for (size_t candidate : candidates->second)
+            {
+                if (usedProps[candidate])
+                    continue;
+
+                float propOrigin[3], propAngles[3];
+                staticProps.GetOrigin(candidate, propOrigin);
+                staticProps.GetAngles(candidate, propAngles);
+
+                bool sameOrigin = std::fabs(propOrigin[0] - origin[0]) < 0.01f && std::fabs(propOrigin[1] - origin[1]) < 0.01f && std::fabs(propOrigin[2] - origin[2]) < 0.01f;
+                bool sameAngles = IsSameAngle(propAngles[0], angles[0]) && IsSameAngle(propAngles[1], angles[1]) && IsSameAngle(propAngles[2], angles[2]);
+                if (sameOrigin && sameAngles)
+                {
+                    propIndex = candidate;
+                    break;
+                }
+            }
+        }
+
+        if (propIndex == SIZE_MAX)
+        {
+            std::cout << "Warning: No static prop in BSP for entity " << entity.id << " (" << entity.model << " at " << entity.origin << ")" << std::endl;
+            unmatchedCount++;
+            continue;
+        }
+
+        usedProps[propIndex] = true;
+        matches.emplace_back(&entity, propIndex);
+    }
+
+    return unmatchedCount;
+}
+
+void HammerCompiler::TrackInput(const std::string& path, const std::string& hash, uintmax_t size)
+{
+    TrackedFile& tracked = inputFiles[path];
+    if (tracked.hash.empty() && !hash.empty())
+    {
+        tracked.hash = hash;
+        tracked.size = size;
+    }
+}
+
+void HammerCompiler::TrackInput(const std::string& path, const void* data, size_t size)
+{
+    if (options.manifestPath.empty())
+    {
+        TrackInput(path);
+        return;
+    }
+
+    TrackInput(path, HashToHex(HashBytes(data, size)), size);
+}
+
+void HammerCompiler::TrackOutput(const std::string& path)
+{
+    outputFiles.insert(path);
+}
+
+std::string HammerCompiler::HashFile(const std::string& path)
+{
+    FileView file;
+    if (!fileSystem.Map(path, file))
+    {
+        return "";
+    }
+
+    return HashToHex(HashBytes(file.GetData(), file.GetSize()));
+}
+
+static std::string EscapeDepfilePath(const std::string& path)
+{
+    std::string result;
+    for (char c : path)
+    {
+        if (c == ' ' || c == '#')
+            result += '\\';
+        else if (c == '$')
+            result += '$';
+        result += c;
+    }
+    return result;
+}
+
+static std::string EscapeJson(const std::string& value)
+{
+    std::string result;
+    for (char c : value)
+    {
+        switch (c)
+        {
+        case '"': result += "\\\""; break;
+        case '\\': result += "\\\\"; break;
+        case '\n': result += "\\n"; break;
+        case '\r': result += "\\r"; break;
+        case '\t': result += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char buffer[8];
+                snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                result += buffer;
+            }
+            else
+            {
+                result += c;
+            }
+        }
+    }
+    return result;
+}
+
+// Depfile в формате ninja/make: "цель: вход1 вход2 ..."
+bool HammerCompiler::WriteDepfile(const std::string& path, const std::string& target)
+{
+    std::ostringstream oss;
+    oss << EscapeDepfilePath(target) << ":";
+    for (const auto& [input, hash] : inputFiles)
+    {
+        oss << " \\\n  " << EscapeDepfilePath(input);
+    }
+    oss << "\n";
+
+    if (!WriteFileContent(path, oss.str()))
+    {
+        std::cout << "Failed to write depfile: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool HammerCompiler::WriteManifest(const std::string& path, const std::string& stage)
+{
+    // Хеш и размер входа фиксируются в момент чтения: VMF может быть затем перезаписан
+    auto writeFileList = [this](std::ostringstream& oss, const std::map<std::string, TrackedFile>& files)
+    {
+        bool first = true;
+        for (const auto& [file, tracked] : files)
+        {
+            FileInfo info;
+            bool missing = tracked.hash.empty() && !fileSystem.Stat(file, info);
+            uintmax_t size = tracked.hash.empty() ? info.size : tracked.size;
+            std::string hash = tracked.hash.empty() && !missing ? HashFile(file) : tracked.hash;
+
+            oss << (first ? "\n" : ",\n") << "    { \"path\": \"" << EscapeJson(file) << "\", ";
+            if (missing)
+                oss << "\"size\": null, \"hash\": null }";
+            else
+                oss << "\"size\": " << size << ", \"hash\": \"fnv1a64:" << hash << "\" }";
+            first = false;
+        }
+        oss << (files.empty() ? "]" : "\n  ]");
+    };
+
+    std::map<std::string, TrackedFile> outputs;
+    for (const auto& file : outputFiles)
+        outputs[file];
+    for (const auto& file : createdFiles)
+        outputs[file];
+
+    std::ostringstream oss;
+    oss << "{\n";
+    oss << "  \"tool\": \"PropColorCompiler\",\n";
+    oss << "  \"version\": \"" << PROPCOLOR_TOOL_VERSION << "\",\n";
+    oss << "  \"stage\": \"" << EscapeJson(stage) << "\",\n";
+    oss << "  \"vmf\": \"" << EscapeJson(vmfPath) << "\",\n";
+    oss << "  \"gamedir\": \"" << EscapeJson(gameDir) << "\",\n";
+    oss << "  \"inputs\": [";
+    writeFileList(oss, inputFiles);
+    oss << ",\n  \"outputs\": [";
+    writeFileList(oss, outputs);
+    oss << ",\n  \"pak\": [";
+    for (size_t i = 0; i < pakEntries.size(); i++)
+    {
+        oss << (i == 0 ? "\n" : ",\n") << "    \"" << EscapeJson(pakEntries[i]) << "\"";
+    }
+    oss << (pakEntries.empty() ? "]" : "\n  ]") << "\n}\n";
+
+    if (!WriteFileContent(path, oss.str()))
+    {
+        std::cout << "Failed to write manifest: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Текстовые файлы читаются и пишутся так же, как текстовыми потоками:
+// на Windows \r\n при чтении становится \n, а \n при записи снова \r\n
+std::string HammerCompiler::ReadFileContent(const std::string& path, std::ios::openmode mode)
+{
+    FileView file;
+    if (!fileSystem.Map(path, file))
+    {
+        std::cout << "Failed to open file: " << path << std::endl;
+        return "";
+    }
+
+    std::string content(reinterpret_cast<const char*>(file.GetData()), file.GetSize());
+    return (mode & std::ios::binary) ? content : DecodeText(std::move(content));
+}
+
+bool HammerCompiler::WriteFileContent(const std::string& path, const std::string& content)
+{
+    fs::path filePath(path);
+    if (filePath.has_parent_path())
+    {
+        fileSystem.CreateDirectories(filePath.parent_path().string());
+    }
+
+    std::string bytes = EncodeText(content);
+    WriteResult result = WriteFileIfChanged(fileSystem, path, bytes.data(), bytes.size());
+    if (result == WriteResult::Unchanged)
+    {
+        std::cout << "Unchanged, skipped write: " << path << std::endl;
+        return true;
+    }
+
+    if (result == WriteResult::Failed)
+    {
+        std::cout << "Failed to create file: " << path << std::endl;
+        return false;
+    }
+
+    std::cout << "Successfully wrote file: " << path << " (" << content.length() << " bytes)" << std::endl;
+    return true;
+}
+
+// Файл попадает в журнал до того, как начнётся его запись: --rollback удалит
+// и тот, что не успел дописаться
+void HammerCompiler::PlanCreatedFile(const std::string& filePath)
+{
+    journal.Plan("create", filePath);
+}
+
+void HammerCompiler::AddCreatedFile(const std::string& filePath) 
+{
+    if (!filePath.empty() && fileSystem.Exists(filePath)) {
+        createdFiles.push_back(filePath);
+        journal.Done("create", filePath);
+    }
+}
+
+bool HammerCompiler::SaveCreatedFilesList()
+{
+    std::string listPath = this->vmfPath + ".created_files.txt";
+
+    // После --resume файлы из журнала могут попасть в список второй раз
+    std::ostringstream oss;
+    std::set<std::string> listedFiles;
+    for (const auto& filePath : createdFiles) {
+        if (listedFiles.insert(filePath).second) {
+            oss << filePath << "\n";
+        }
+    }
+
+    if (!WriteFileContent(listPath, oss.str())) {
+        std::cout << "Failed to create files list: " << listPath << std::endl;
+        return false;
+    }
+
+    std::cout << "Saved created files list: " << listPath << " (" << listedFiles.size() << " files)" << std::endl;
+    TrackOutput(listPath);
+
+    // После этого уборка других карт видит, что файлы нужны и этой карте
+    if (!options.overlay) {
+        if (!outputRegistry.AddReferences(vmfPath, std::vector<std::string>(listedFiles.begin(), listedFiles.end()))) {
+            std::cout << "Warning: Failed to register created files, other maps may delete them" << std::endl;
+        }
+        outputRegistry.End();
+    }
+
+    // Устаревшие выходы удаляются уже после записи своих ссылок и под монопольной
+    // блокировкой, как при уборке: файл мог понадобиться другой карте
+    std::vector<std::string> staleFiles;
+    for (const auto& filePath : staleOutputs) {
+        if (listedFiles.find(filePath) == listedFiles.end()) {
+            staleFiles.push_back(filePath);
+        }
+    }
+
+    if (!staleFiles.empty()) {
+        int deletedCount = DeleteUnreferencedFiles(staleFiles);
+        std::cout << "Deleted " << deletedCount << " stale outputs of previous compiles" << std::endl;
+    }
+    return true;
+}
+
+bool HammerCompiler::DeleteCreatedFiles() 
+{
+    std::string listPath = this->vmfPath + ".created_files.txt";
+
+    if (!fileSystem.Exists(listPath)) {
+        std::cout << "No created files list found: " << listPath << std::endl;
+        return true;
+    }
+
+    std::istringstream file(ReadFileContent(listPath));
+
+    // Ссылки снимаются и с уже удалённых файлов, поэтому в список попадают все строки
+    std::vector<std::string> listedFiles;
+    std::string filePath;
+
+    while (std::getline(file, filePath)) {
+        if (!filePath.empty()) {
+            listedFiles.push_back(filePath);
+        }
+    }
+
+    int deletedCount = DeleteUnreferencedFiles(listedFiles);
+
+    fileSystem.Remove(listPath);
+
+    std::cout << "Deleted " << deletedCount << " created files" << std::endl;
+    return true;
+}
+
+// Удаление идёт под монопольной блокировкой выходов: файл, на который ещё
+// ссылается другая карта этого игрового каталога, остаётся на месте
+int HammerCompiler::DeleteUnreferencedFiles(const std::vector<std::string>& files)
+{
+    // В режиме --overlay счётчика нет: файлы принадлежат только этой карте
+    std::vector<std::string> unreferenced;
+    if (options.overlay) {
+        unreferenced = files;
+    }
+    else {
+        if (!outputRegistry.BeginCleanup()) {
+            std::cout << "Warning: Cannot lock shared outputs, created files are kept" << std::endl;
+            return 0;
+        }
+
+        if (!outputRegistry.RemoveReferences(vmfPath, files, unreferenced)) {
+            std::cout << "Warning: Cannot update output registry, created files are kept" << std::endl;
+            outputRegistry.End();
+            return 0;
         }
     }
 
-    return true;
-}
+    int deletedCount = 0;
+    for (const auto& path : unreferenced) {
+        if (!fileSystem.Exists(path))
+            continue;
 
-bool HammerCompiler::CopyModelFiles(const std::string& originalModelPath)
-{
-    std::string fullModelPath = gameDir + "/" + originalModelPath;
-    std::cout << "Looking for model: " << fullModelPath << std::endl;
+        if (fileSystem.Remove(path)) {
+            std::cout << "Deleted created file: " << path << std::endl;
+            deletedCount++;
+        }
+        else {
+            std::cout << "Failed to delete " << path << std::endl;
+        }
+    }
 
-    if (!fs::exists(fullModelPath))
-    {
-        std::cout << "Model file not found: " << fullModelPath << std::endl;
-        return false;
+    if (!options.overlay) {
+        outputRegistry.End();
     }
+    return deletedCount;
+}
 
-    fs::path modelPath(fullModelPath);
-    std::string baseName = modelPath.stem().string();
-    std::string extension = modelPath.extension().string();
-    fs::path parentDir = modelPath.parent_path();
+// Журнал этапа лежит рядом с VMF. Если прошлый запуск прерван после замены VMF
+// или упаковки BSP, новый запуск без --resume принял бы раскрашенный VMF за исходный,
+// поэтому он останавливается; прерванный до этого запуск просто продолжается
+bool HammerCompiler::BeginJournal(const std::string& stage)
+{
+    std::string journalPath = vmfPath + ".journal";
+    journalStage = stage;
+
+    bool interrupted = journal.Load(journalPath) && !journal.GetRecords().empty();
+    if (interrupted) {
+        const std::string& interruptedStage = journal.GetRecords().front().step;
+        if (interruptedStage != stage) {
+            std::cout << clr::red << "Error: Interrupted " << interruptedStage << " run found: " << journalPath << std::endl;
+            std::cout << "Run that step again with --resume to finish it or with --rollback to undo it" << std::endl;
+            return false;
+        }
 
-    std::string coloredBaseName = baseName + "_colored";
-    fs::path coloredModelPath = parentDir / (coloredBaseName + extension);
+        bool changedFiles = false;
+        for (const auto& record : journal.GetRecords()) {
+            if (record.step != stage && record.step != "create") {
+                changedFiles = true;
+            }
+        }
 
-    std::cout << "Base name: " << baseName << std::endl;
-    std::cout << "Colored base name: " << coloredBaseName << std::endl;
-    std::cout << "Colored model path: " << coloredModelPath << std::endl;
+        if (changedFiles && !options.resume) {
+            std::cout << clr::red << "Error: Interrupted " << stage << " run already changed the map files: " << journalPath << std::endl;
+            std::cout << "Run again with --resume to finish it or with --rollback to undo it" << std::endl;
+            return false;
+        }
 
-    if (fs::exists(coloredModelPath))
-    {
-        std::cout << "Colored model already exists: " << coloredModelPath << std::endl;
-        AddCreatedFile(coloredModelPath.string());
-        return true;
-    }
+        // Файлы, созданные до сбоя, снова попадают в список созданных
+        std::set<std::string> knownFiles;
+        for (const auto& record : journal.GetRecords()) {
+            if (record.step == "create" && knownFiles.insert(record.path).second) {
+                AddCreatedFile(record.path);
+            }
+        }
 
-    try
-    {
-        fs::copy_file(fullModelPath, coloredModelPath, fs::copy_options::overwrite_existing);
-        std::cout << "Copied MDL file to: " << coloredModelPath << std::endl;
-        AddCreatedFile(coloredModelPath.string());
+        resumingJournal = true;
+        std::cout << "Resuming interrupted " << stage << ": " << journal.GetRecords().size() << " journal records, "
+            << createdFiles.size() << " files already created" << std::endl;
     }
-    catch (const std::exception& e)
-    {
-        std::cout << "Failed to copy MDL file: " << e.what() << std::endl;
-        return false;
+    else if (options.resume) {
+        std::cout << "Nothing to resume, no journal found: " << journalPath << std::endl;
     }
 
-    std::vector<std::string> extensions = { ".dx90.vtx", ".vvd", ".phy" }; // добавить остальные, если потребуется (пропы из CS:GO имеют лишь это)
-    for (const auto& ext : extensions)
-    {
-        fs::path originalFile = parentDir / (baseName + ext);
-        fs::path coloredFile = parentDir / (coloredBaseName + ext);
+    if (!journal.Open(journalPath)) {
+        return false;
+    }
 
-        std::cout << "Looking for: " << originalFile << std::endl;
+    if (!interrupted) {
+        journal.Plan(stage, vmfPath);
+    }
+    journal.Sync();
 
-        if (fs::exists(originalFile))
-        {
-            try
-            {
-                fs::copy_file(originalFile, coloredFile, fs::copy_options::overwrite_existing);
-                std::cout << "Copied file: " << originalFile << " to " << coloredFile << std::endl;
-                AddCreatedFile(coloredFile.string());
-            }
-            catch (const std::exception& e)
-            {
-                std::cout << "Failed to copy file: " << originalFile << " - " << e.what() << std::endl;
-            }
-        }
-        else
-        {
-            std::cout << "File not found (this may be normal): " << originalFile << std::endl;
+    // VMF, раскрашенный до сбоя, возвращается к исходному виду и раскрашивается заново,
+    // если после него не успел записаться манифест
+    if (interrupted && stage == "precompile" && journal.FindLast("vmf") && !journal.IsDone("manifest")) {
+        if (!RestoreVMFAfterPostCompile()) {
+            std::cout << "Failed to restore VMF" << std::endl;
+            return false;
         }
     }
 
+    // Прерванная упаковка откатывается до того, как BSP откроет кто-то ещё
+    if (interrupted && stage == "postcompile" && !RevertInterruptedPak(false)) {
+        return false;
+    }
+
     return true;
 }
 
-std::string HammerCompiler::CreateVMTContent(const std::string& originalContent, const std::string& newBaseTexture, const std::string& color)
+void HammerCompiler::FinishJournal()
 {
-    std::istringstream iss(originalContent);
-    std::ostringstream oss;
-    std::string line;
+    journal.Done(journalStage, vmfPath);
+    journal.Sync();
+    journal.Remove();
+}
 
-    bool hasColor2 = false;
-    bool hasBlendTint = false;
-    bool hasBaseTexture = false;
+// Шаги, которые меняют VMF или BSP, - границы пачек: запись сразу сбрасывается на диск
+void HammerCompiler::PlanStep(const std::string& step, const std::string& path)
+{
+    journal.Plan(step, path);
+    journal.Sync();
+}
 
-    // Извлекаем оригинальное имя текстуры из оригинального VMT
-    std::string originalBaseTexture;
-    std::istringstream issTemp(originalContent);
-    std::string tempLine;
-    while (std::getline(issTemp, tempLine)) {
-        std::string trimmedLine = tempLine;
-        trimmedLine.erase(0, trimmedLine.find_first_not_of(" \t"));
-        trimmedLine.erase(trimmedLine.find_last_not_of(" \t") + 1);
+void HammerCompiler::FinishStep(const std::string& step, const std::string& path)
+{
+    journal.Done(step, path);
+    journal.Sync();
+}
 
-        if (trimmedLine.find("\"$basetexture\"") == 0) {
-            size_t firstQuote = trimmedLine.find('"', 14);
-            size_t secondQuote = trimmedLine.find('"', firstQuote + 1);
-            if (firstQuote != std::string::npos && secondQuote != std::string::npos) {
-                originalBaseTexture = trimmedLine.substr(firstQuote + 1, secondQuote - firstQuote - 1);
-                break;
-            }
+// Упаковка, прерванная на середине, откатывается по данным журнала, а после bspzip -
+// из резервной копии. revertCompleted откатывает и завершённую упаковку (--rollback)
+bool HammerCompiler::RevertInterruptedPak(bool revertCompleted)
+{
+    const Journal::Record* pak = journal.FindLast("pak");
+    if (!pak || (pak->done && !revertCompleted))
+        return true;
+
+    // BSP производного VMF мог успеть получить имя карты
+    std::string bspPath = journal.IsDone("rename") ? journal.FindLast("rename")->path : pak->path;
+    std::string backupPath = bspPath + ".backup";
+
+    std::error_code error;
+    if (fs::exists(backupPath) && (revertCompleted || !fs::exists(bspPath))) {
+        fs::rename(backupPath, bspPath, error);
+        if (error) {
+            std::cout << "Failed to restore BSP from backup: " << error.message() << std::endl;
+            return false;
         }
+        std::cout << "Restored BSP from backup: " << bspPath << std::endl;
+        return true;
     }
 
-    if (originalBaseTexture.empty()) {
-        originalBaseTexture = newBaseTexture;
-        size_t colorPos = originalBaseTexture.find("_color");
-        if (colorPos != std::string::npos) {
-            originalBaseTexture = originalBaseTexture.substr(0, colorPos);
-        }
-        size_t modelSuffixPos = originalBaseTexture.find_last_of('_');
-        if (modelSuffixPos != std::string::npos) {
-            std::string possibleSuffix = originalBaseTexture.substr(modelSuffixPos);
-            if (possibleSuffix.find("hr_") == std::string::npos &&
-                possibleSuffix.find("lr_") == std::string::npos) {
-                originalBaseTexture = originalBaseTexture.substr(0, modelSuffixPos);
-            }
+    std::vector<unsigned char> undo;
+    if (!journal.LoadUndo(undo)) {
+        // Без данных отката BSP переписывался целиком и атомарно
+        if (pak->done) {
+            std::cout << "Warning: BSP was repacked as a whole and keeps the packed files: " << bspPath << std::endl;
         }
+        return true;
     }
 
-    iss.clear();
-    iss.str(originalContent);
-
-    while (std::getline(iss, line))
-    {
-        std::string trimmedLine = line;
-        trimmedLine.erase(0, trimmedLine.find_first_not_of(" \t"));
-        trimmedLine.erase(trimmedLine.find_last_not_of(" \t") + 1);
+    if (!BSPFile::RevertPakfileUpdate(bspPath, undo)) {
+        return false;
+    }
 
-        if (trimmedLine.find("\"$basetexture\"") == 0) {
-            size_t firstQuote = trimmedLine.find('"', 14);
-            size_t secondQuote = trimmedLine.find('"', firstQuote + 1);
-            if (firstQuote != std::string::npos && secondQuote != std::string::npos) {
-                line = "\t\"$basetexture\" \"" + originalBaseTexture + "\"";
-            }
-            hasBaseTexture = true;
-        }
+    journal.RemoveUndo();
+    std::cout << "Reverted pakfile update: " << bspPath << std::endl;
+    return true;
+}
 
-        else if (trimmedLine.find("\"$color2\"") == 0)
-        {
-            size_t firstBrace = trimmedLine.find('{');
-            size_t secondBrace = trimmedLine.find('}');
-            if (firstBrace != std::string::npos && secondBrace != std::string::npos)
-            {
-                line = "\t\"$color2\" \"{" + color + "}\"";
-            }
-            hasColor2 = true;
-        }
+// Отмена запуска: pak, обновлённый на месте, убирается из BSP, VMF возвращается
+// к исходному виду, созданные файлы удаляются. Без журнала работает по списку
+// созданных файлов, например когда vbsp упал после первого шага
+bool HammerCompiler::Rollback()
+{
+    std::string journalPath = vmfPath + ".journal";
+    bool hasJournal = journal.Load(journalPath);
+    std::cout << "Rolling back " << (hasJournal ? "interrupted run: " + journalPath : "last run: " + vmfPath) << std::endl;
 
-        else if (trimmedLine.find("\"$blendtintbybasealpha\"") == 0)
-        {
-            size_t firstQuote = trimmedLine.find('"', 24);
-            size_t secondQuote = trimmedLine.find('"', firstQuote + 1);
-            if (firstQuote != std::string::npos && secondQuote != std::string::npos)
-            {
-                line = "\t\"$blendtintbybasealpha\" \"1\"";
-            }
-            hasBlendTint = true;
-        }
+    bool success = RevertInterruptedPak(true);
 
-        oss << line << "\n";
+    if (!RestoreVMFAfterPostCompile()) {
+        std::cout << "Failed to restore VMF" << std::endl;
+        success = false;
     }
 
-    std::string result = oss.str();
-
-    if (!hasBaseTexture) {
-        size_t lastBrace = result.rfind('}');
-        if (lastBrace != std::string::npos) {
-            result.insert(lastBrace, "\n\t\"$basetexture\" \"" + originalBaseTexture + "\"");
+    std::vector<std::string> journalFiles;
+    for (const auto& record : journal.GetRecords()) {
+        if (record.step == "create" || record.step == "manifest") {
+            journalFiles.push_back(record.path);
         }
     }
 
-    if (!hasColor2)
-    {
-        size_t lastBrace = result.rfind('}');
-        if (lastBrace != std::string::npos)
-        {
-            result.insert(lastBrace, "\n\t\"$color2\" \"{" + color + "}\"");
-        }
+    if (hasJournal) {
+        int deletedCount = DeleteUnreferencedFiles(journalFiles);
+        std::cout << "Deleted " << deletedCount << " files from journal" << std::endl;
     }
 
-    if (!hasBlendTint)
-    {
-        size_t lastBrace = result.rfind('}');
-        if (lastBrace != std::string::npos)
-        {
-            result.insert(lastBrace, "\n\t\"$blendtintbybasealpha\" \"1\"");
-        }
+    DeleteCreatedFiles();
+
+    if (fileSystem.Exists(GetOverlayDir()) && !RemoveOverlay()) {
+        success = false;
     }
 
-    return result;
+    // Журнал остаётся, пока откат не прошёл целиком: его можно повторить
+    if (success) {
+        journal.Remove();
+    }
+    return success;
 }
 
-bool HammerCompiler::UpdateVMF() {
-    std::cout << "Updating VMF file..." << std::endl;
+bool HammerCompiler::AddFilesToBSP(const std::string& bspPath) {
+    auto startTime = std::chrono::steady_clock::now();
 
-    std::string content = ReadFileContent(vmfPath);
-    if (content.empty())
-    {
-        return false;
+    std::vector<std::pair<std::string, std::string>> files;
+    if (pakPrepared) {
+        files.swap(preparedPakFiles);
+    }
+    else {
+        CollectPakFiles(files);
     }
 
-    std::cout << "Original VMF content size: " << content.length() << " bytes" << std::endl;
-
-    std::string tempOutputPath = vmfPath + ".tmp_colored";
-
-    std::vector<EntityInfo*> sortedEntities;
-    for (auto& entity : entities)
-    {
-        sortedEntities.push_back(&entity);
+    if (files.empty()) {
+        std::cout << "No files to add to BSP" << std::endl;
+        return true;
     }
 
-    std::sort(sortedEntities.begin(), sortedEntities.end(),
-        [](const EntityInfo* a, const EntityInfo* b) { return a->startPos > b->startPos; });
+    PlanStep("pak", bspPath);
+    bool result = options.useBspzip ? PackFilesWithBSPZIP(bspPath, files) : PackFilesNative(bspPath, files);
 
-    std::cout << "Processing " << sortedEntities.size() << " entities for update" << std::endl;
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime);
+    std::cout << "Packing " << files.size() << " files took " << elapsed.count() << " ms ("
+        << (options.useBspzip ? "bspzip" : "native") << ")" << std::endl;
 
-    bool hasChanges = false;
+    if (result) {
+        FinishStep("pak", bspPath);
+        std::cout << "BSP size after packing: " << fs::file_size(bspPath) << " bytes" << std::endl;
+        TrackOutput(bspPath);
+    }
 
-    for (auto* entity : sortedEntities)
-    {
-        if (modelData.find(entity->model) == modelData.end())
-            continue;
+    return result;
+}
 
-        const auto& colorInfo = modelData[entity->model];
-        std::string entityContent = content.substr(entity->startPos, entity->endPos - entity->startPos);
+// Файлы pak не зависят от BSP: -compile читает и сжимает их, пока vvis и vrad
+// ещё считают, и после vrad остаётся только дописать их в BSP
+bool HammerCompiler::PreparePakEntries() {
+    auto startTime = std::chrono::steady_clock::now();
 
-        std::cout << "Updating entity with model: " << entity->model << " and color: " << entity->rendercolor << std::endl;
+    CollectPakFiles(preparedPakFiles);
+    if (!ReadPakEntries(preparedPakFiles, preparedPakEntries)) {
+        preparedPakFiles.clear();
+        preparedPakEntries.clear();
+        return false;
+    }
 
-        std::vector<std::string> orderedColors(colorInfo.colors.begin(), colorInfo.colors.end());
+    if (options.pakCodec != PakCodec::Store) {
+        CompressNewEntries(preparedPakEntries);
+    }
+    pakPrepared = true;
 
-        int colorIndex = -1;
-        for (size_t i = 0; i < orderedColors.size(); i++)
-        {
-            if (orderedColors[i] == entity->rendercolor)
-            {
-                colorIndex = static_cast<int>(i) + 1;
-                break;
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime);
+    std::cout << "Prepared " << preparedPakEntries.size() << " pak entries in " << elapsed.count() << " ms" << std::endl;
+    return true;
+}
+
+// Собирает пары (путь внутри pak, путь на диске) для всех цветных моделей карты
+void HammerCompiler::CollectPakFiles(std::vector<std::pair<std::string, std::string>>& files) {
+    // Цвет записан в лампе пропов, паковать нечего
+    if (usingTint)
+        return;
+
+    if (pakManifestLoaded) {
+        for (uint32_t i = 0; i < pakManifest.GetFileCount(); i++) {
+            PakManifestFile file = pakManifest.GetFile(i);
+            std::string relativePath = pakManifest.GetString(file.pakPathOffset);
+            std::string fullPath = pakManifest.GetString(file.fullPathOffset);
+
+            files.emplace_back(relativePath, fullPath);
+            pakEntries.push_back(relativePath);
+            if (file.flags & PAK_MANIFEST_FILE_INLINE) {
+                const unsigned char* data = pakManifest.GetFileData(file);
+                generatedFiles.Store(relativePath, std::vector<unsigned char>(data, data + file.size));
+            }
+            else {
+                TrackInput(fullPath, HashToHex(file.hash), file.size);
             }
         }
 
-        if (colorIndex == -1)
-        {
-            std::cout << "Error: Could not find color index for: " << entity->rendercolor << std::endl;
-            continue;
-        }
+        std::cout << "Using pak manifest: " << pakManifest.GetModelCount() << " models, " << files.size() << " files" << std::endl;
 
-        std::cout << "Color index: " << colorIndex << std::endl;
+        // Строки уже скопированы; отображение мешало бы удалить манифест вместе с созданными файлами
+        pakManifest.Close();
+        return;
+    }
 
-        size_t modelPos = entityContent.find("\"model\"");
-        if (modelPos != std::string::npos)
-        {
-            size_t valueStart = entityContent.find("\"", modelPos + 8);
-            size_t valueEnd = entityContent.find("\"", valueStart + 1);
-            if (valueStart != std::string::npos && valueEnd != std::string::npos)
-            {
-                std::string newModelPath = entity->model;
-                size_t dotPos = newModelPath.find_last_of('.');
-                newModelPath = newModelPath.substr(0, dotPos) + "_colored.mdl";
+    std::vector<PakManifest::Model> models;
+    CollectColoredAssets(models);
 
-                entityContent.replace(valueStart + 1, valueEnd - valueStart - 1, newModelPath);
-                std::cout << "Updated model path to: " << newModelPath << std::endl;
+    for (const auto& model : models) {
+        for (const auto& file : model.files) {
+            files.emplace_back(file.pakPath, file.fullPath);
+            pakEntries.push_back(file.pakPath);
+            if (!file.isInline) {
+                TrackInput(file.fullPath);
             }
+            std::cout << "Added to list: " << file.pakPath << " -> " << (file.isInline ? "(memory)" : file.fullPath) << std::endl;
         }
+    }
+}
 
-        size_t skinPos = entityContent.find("\"skin\"");
-        if (skinPos != std::string::npos)
-        {
-            size_t valueStart = entityContent.find("\"", skinPos + 7);
-            size_t valueEnd = entityContent.find("\"", valueStart + 1);
-            if (valueStart != std::string::npos && valueEnd != std::string::npos)
-            {
-                entityContent.replace(valueStart + 1, valueEnd - valueStart - 1, std::to_string(colorIndex));
-                std::cout << "Updated skin to: " << colorIndex << std::endl;
-            }
+// Файлы каждой уникальной цветной модели: сама модель, сопутствующие файлы
+// и материалы _color. MDL читается один раз на модель, а не на каждый проп
+void HammerCompiler::CollectColoredAssets(std::vector<PakManifest::Model>& models) {
+    std::set<std::string> coloredModels;
+    for (const auto& entity : entities) {
+        // До vbsp и в режиме --patchbsp сущности ссылаются на исходные модели
+        std::string modelPath = IsColoredModelPath(entity.model) ? entity.model : GetColoredModelPath(entity.model);
+        if (IsColoredModelPath(modelPath)) {
+            coloredModels.insert(modelPath);
         }
-        else
-        {
-            size_t insertPos = entityContent.find("\"model\"");
-            if (insertPos != std::string::npos)
-            {
-                size_t lineEnd = entityContent.find("\n", insertPos);
-                if (lineEnd != std::string::npos)
-                {
-                    entityContent.insert(lineEnd + 1, "\t\"skin\" \"" + std::to_string(colorIndex) + "\"\n");
-                    std::cout << "Added skin parameter: " << colorIndex << std::endl;
-                }
+    }
+
+    std::set<std::string> addedFiles;
+    for (const auto& modelPath : coloredModels) {
+        PakManifest::Model model;
+        model.name = modelPath;
+
+        auto addFile = [&](const std::string& relativePath, const std::string& fullPath) {
+            if (addedFiles.insert(relativePath).second) {
+                PakManifest::File file;
+                file.pakPath = relativePath;
+                file.fullPath = fullPath;
+                model.files.push_back(file);
             }
+        };
+
+        std::string modelFullPath = outputDir + "/" + modelPath;
+        if (fileSystem.Exists(modelFullPath)) {
+            addFile(modelPath, modelFullPath);
         }
 
-        size_t colorPos = entityContent.find("\"rendercolor\"");
-        if (colorPos != std::string::npos)
-        {
-            size_t valueStart = entityContent.find("\"", colorPos + 14);
-            size_t valueEnd = entityContent.find("\"", valueStart + 1);
-            std::string originalColor;
-            if (valueStart != std::string::npos && valueEnd != std::string::npos) {
-                originalColor = entityContent.substr(valueStart + 1, valueEnd - valueStart - 1);
-            }
+        std::string basePath = modelPath.substr(0, modelPath.find_last_of('.'));
+        std::vector<std::string> extensions = { ".vvd", ".dx90.vtx", ".phy" };
 
-            size_t lineStart = entityContent.rfind("\n", colorPos);
-            if (lineStart == std::string::npos) lineStart = 0;
-            size_t lineEnd = entityContent.find("\n", colorPos);
-            if (lineEnd != std::string::npos)
-            {
-                entityContent.erase(lineStart, lineEnd - lineStart + 1);
-                std::cout << "Removed rendercolor parameter" << std::endl;
+        for (const auto& ext : extensions) {
+            std::string relatedFile = basePath + ext;
+            std::string relatedFullPath = outputDir + "/" + relatedFile;
+
+            if (fileSystem.Exists(relatedFullPath)) {
+                addFile(relatedFile, relatedFullPath);
             }
+        }
 
-            if (!originalColor.empty()) {
-                size_t insertPos = entityContent.find("\"model\"");
-                if (insertPos != std::string::npos)
-                {
-                    size_t lineEnd = entityContent.find("\n", insertPos);
-                    if (lineEnd != std::string::npos)
-                    {
-                        entityContent.insert(lineEnd + 1, "\t\"$color\" \"" + originalColor + "\"\n");
-                        std::cout << "Added $color marker for post-compile: " << originalColor << std::endl;
+        MDLFile mdl(fileSystem);
+        if (mdl.Load(modelFullPath)) {
+            auto textureNames = mdl.GetTextureNames();
+            for (const auto& texture : textureNames) {
+                if (texture.find("_color") != std::string::npos) {
+                    std::string vmtPath = "materials/" + texture + ".vmt";
+                    std::string vmtFullPath = gameDir + "/" + vmtPath;
+
+                    std::vector<unsigned char> content;
+                    if (generatedFiles.Read(vmtPath, content)) {
+                        if (addedFiles.insert(vmtPath).second) {
+                            PakManifest::File file;
+                            file.pakPath = vmtPath;
+                            file.isInline = true;
+                            file.content.assign(content.begin(), content.end());
+                            model.files.push_back(file);
+                        }
+                    }
+                    else if (fileSystem.Exists(vmtFullPath)) {
+                        addFile(vmtPath, vmtFullPath);
                     }
                 }
             }
         }
 
-        content.replace(entity->startPos, entity->endPos - entity->startPos, entityContent);
-        hasChanges = true;
-    }
-
-    if (!hasChanges)
-    {
-        std::cout << "No changes to save in VMF" << std::endl;
-        return true;
+        models.push_back(std::move(model));
     }
+}
 
-    std::cout << "Writing updated VMF content..." << std::endl;
+bool HammerCompiler::SavePakManifest() {
+    std::vector<PakManifest::Model> models;
+    CollectColoredAssets(models);
 
-    if (!WriteFileContent(tempOutputPath, content))
-    {
-        std::cout << "Failed to write temporary VMF file" << std::endl;
-        return false;
+    for (auto& model : models) {
+        for (auto& file : model.files) {
+            std::string content = file.isInline ? file.content : ReadFileContent(file.fullPath, std::ios::binary);
+            file.size = content.size();
+            file.hash = HashBytes(content.data(), content.size());
+        }
     }
 
-    try
-    {
-        fs::remove(vmfPath);
-        fs::rename(tempOutputPath, vmfPath);
-        std::cout << "Successfully updated VMF file: " << vmfPath << std::endl;
-    }
-    catch (const std::exception& e)
-    {
-        std::cout << "Failed to replace original VMF file: " << e.what() << std::endl;
+    std::string compileVmf = ReadFileContent(GetCompileVMFPath());
+    std::string manifestPath = vmfPath + ".propcolor.bin";
+    PlanStep("manifest", manifestPath);
+    if (!PakManifest::Write(fileSystem, manifestPath, HashBytes(compileVmf.data(), compileVmf.size()), models)) {
         return false;
     }
 
+    std::cout << "Saved pak manifest: " << manifestPath << " (" << models.size() << " models)" << std::endl;
+    AddCreatedFile(manifestPath);
+    FinishStep("manifest", manifestPath);
+    TrackOutput(manifestPath);
     return true;
 }
 
-std::string HammerCompiler::ReadFileContent(const std::string& path)
-{
-    std::ifstream file(path);
-    if (!file.is_open())
-    {
-        std::cout << "Failed to open file: " << path << std::endl;
-        return "";
+// Манифест годится, только если vbsp компилировал тот же VMF и файлы не менялись
+bool HammerCompiler::OpenPakManifest() {
+    std::string manifestPath = vmfPath + ".propcolor.bin";
+    if (!fileSystem.Exists(manifestPath) || !pakManifest.Open(fileSystem, manifestPath)) {
+        return false;
     }
 
-    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-    file.close();
-    return content;
-}
+    std::string compileVmfPath = GetCompileVMFPath();
+    std::string compileVmf = ReadFileContent(compileVmfPath);
+    if (HashBytes(compileVmf.data(), compileVmf.size()) != pakManifest.GetVMFHash()) {
+        std::cout << "Pak manifest is out of date with " << compileVmfPath << ", scanning VMF instead" << std::endl;
+        pakManifest.Close();
+        return false;
+    }
+    TrackInput(compileVmfPath, compileVmf.data(), compileVmf.size());
 
-bool HammerCompiler::WriteFileContent(const std::string& path, const std::string& content)
-{
-    fs::path filePath(path);
-    fs::create_directories(filePath.parent_path());
+    for (uint32_t i = 0; i < pakManifest.GetFileCount(); i++) {
+        PakManifestFile file = pakManifest.GetFile(i);
+        if (file.flags & PAK_MANIFEST_FILE_INLINE)
+            continue;
 
-    std::ofstream file(path);
-    if (!file.is_open())
-    {
-        std::cout << "Failed to create file: " << path << std::endl;
-        return false;
+        FileInfo info;
+        std::string fullPath = pakManifest.GetString(file.fullPathOffset);
+        if (!fileSystem.Stat(fullPath, info) || info.size != file.size) {
+            std::cout << "Pak manifest is out of date, file changed: " << fullPath << std::endl;
+            pakManifest.Close();
+            return false;
+        }
     }
 
-    file << content;
-    file.close();
-
-    std::cout << "Successfully wrote file: " << path << " (" << content.length() << " bytes)" << std::endl;
+    pakManifestLoaded = true;
     return true;
 }
 
-void HammerCompiler::AddCreatedFile(const std::string& filePath) 
-{
-    if (!filePath.empty() && fs::exists(filePath)) {
-        createdFiles.push_back(filePath);
-    }
-}
+// Встроенная запись LUMP_PAKFILE: без bspzip, временного списка и резервной копии.
+// BSP открывается через отображение в память. Если pak последний ламп, на месте
+// переписывается только хвост архива и заголовок; иначе BSP переписывается
+// целиком через временный файл с атомарным переименованием.
+bool HammerCompiler::PackFilesNative(const std::string& bspPath, const std::vector<std::pair<std::string, std::string>>& files) {
+    std::cout << "Adding files to BSP: " << bspPath << std::endl;
 
-bool HammerCompiler::SaveCreatedFilesList()
-{
-    std::string listPath = this->vmfPath + ".created_files.txt";
-    std::ofstream file(listPath);
+    BSPFile bsp;
+    if (!bsp.Load(bspPath)) {
+        return false;
+    }
 
-    if (!file.is_open()) {
-        std::cout << "Failed to create files list: " << listPath << std::endl;
+    // Заранее подготовленные записи уже сжаты
+    std::vector<PakEntry> newEntries;
+    if (pakPrepared) {
+        newEntries = std::move(preparedPakEntries);
+    }
+    else if (!ReadPakEntries(files, newEntries)) {
         return false;
     }
 
-    for (const auto& filePath : createdFiles) {
-        file << filePath << "\n";
+    PakFile existing;
+    if (!bsp.ReadPakfile(existing, false)) {
+        std::cout << "Failed to read pakfile lump: " << bspPath << std::endl;
+        return false;
     }
 
-    file.close();
-    std::cout << "Saved created files list: " << listPath << " (" << createdFiles.size() << " files)" << std::endl;
-    return true;
-}
+    // Файлы, которые уже лежат в pak с тем же содержимым, не переписываются
+    int addedCount = 0;
+    int replacedCount = 0;
+    int skippedCount = 0;
+
+    std::vector<PakEntry> changedEntries;
+    for (auto& entry : newEntries) {
+        const PakEntry* current = existing.FindEntry(entry.name);
+        if (!current) {
+            addedCount++;
+            changedEntries.push_back(std::move(entry));
+            continue;
+        }
 
-bool HammerCompiler::DeleteCreatedFiles() 
-{
-    std::string listPath = this->vmfPath + ".created_files.txt";
+        bool identical = current->crc32 == entry.crc32 && current->uncompressedSize == entry.uncompressedSize;
+        if (identical && options.pakVerify) {
+            // Сжатые записи без распаковки не сравнить, поэтому они перепаковываются
+            identical = current->compressionMethod == ZIP_METHOD_STORE && entry.compressionMethod == ZIP_METHOD_STORE
+                && memcmp(bsp.GetPakEntryData(*current), entry.data.data(), entry.data.size()) == 0;
+        }
 
-    if (!fs::exists(listPath)) {
-        std::cout << "No created files list found: " << listPath << std::endl;
+        if (identical) {
+            skippedCount++;
+        }
+        else {
+            replacedCount++;
+            changedEntries.push_back(std::move(entry));
+        }
+    }
+    newEntries = std::move(changedEntries);
+
+    std::cout << "Pakfile entries: " << addedCount << " added, " << replacedCount << " replaced, "
+        << skippedCount << " skipped (identical)" << std::endl;
+
+    if (newEntries.empty()) {
+        std::cout << "Pakfile is up to date, BSP was not modified" << std::endl;
         return true;
     }
 
-    std::ifstream file(listPath);
-    if (!file.is_open()) {
-        std::cout << "Failed to open created files list: " << listPath << std::endl;
-        return false;
+    if (options.pakCodec != PakCodec::Store && !pakPrepared) {
+        CompressNewEntries(newEntries);
     }
 
-    std::vector<std::string> filesToDelete;
-    std::string filePath;
+    if (bsp.IsPakfileLastLump()) {
+        // Запись на месте не атомарна: перезаписываемый хвост сначала уходит в журнал
+        PakfileUndoCallback saveUndo;
+        if (journal.IsOpen()) {
+            saveUndo = [this](const std::vector<unsigned char>& undo) { return journal.SaveUndo(undo); };
+        }
 
-    while (std::getline(file, filePath)) {
-        if (!filePath.empty() && fs::exists(filePath)) {
-            filesToDelete.push_back(filePath);
+        size_t bytesWritten = 0;
+        if (!bsp.UpdatePakfileInPlace(newEntries, bytesWritten, saveUndo)) {
+            return false;
         }
+
+        std::cout << "Updated pakfile in place, " << bytesWritten << " bytes written" << std::endl;
     }
-    file.close();
+    else {
+        std::cout << "Pakfile is not the last lump, falling back to full BSP rewrite" << std::endl;
 
-    int deletedCount = 0;
-    for (const auto& path : filesToDelete) {
-        try {
-            if (fs::exists(path)) {
-                fs::remove(path);
-                std::cout << "Deleted created file: " << path << std::endl;
-                deletedCount++;
+        PakFile pak;
+        if (!bsp.ReadPakfile(pak)) {
+            std::cout << "Failed to read pakfile lump: " << bspPath << std::endl;
+            return false;
+        }
+
+        std::cout << "Existing pakfile has " << pak.GetEntries().size() << " entries" << std::endl;
+
+        for (auto& entry : newEntries) {
+            pak.AddOrReplace(std::move(entry));
+        }
+
+        if (!bsp.WriteWithPakfile(pak.Serialize())) {
+            return false;
+        }
+    }
+
+    std::cout << "Successfully updated BSP with " << newEntries.size() << " files" << std::endl;
+    return true;
+}
+
+bool HammerCompiler::ReadPakEntries(const std::vector<std::pair<std::string, std::string>>& files, std::vector<PakEntry>& entries) {
+    for (const auto& [relativePath, fullPath] : files) {
+        // Пустой путь на диске: файл существует только в памяти (--overlay)
+        std::vector<unsigned char> data;
+        if (fullPath.empty()) {
+            if (!generatedFiles.Read(relativePath, data)) {
+                std::cout << "Failed to find generated file for packing: " << relativePath << std::endl;
+                return false;
             }
+            entries.push_back(PakFile::MakeEntry(relativePath, std::move(data)));
+            continue;
         }
-        catch (const std::exception& e) {
-            std::cout << "Failed to delete " << path << ": " << e.what() << std::endl;
+
+        if (!fileSystem.Read(fullPath, data)) {
+            std::cout << "Failed to open file for packing: " << fullPath << std::endl;
+            return false;
         }
+
+        entries.push_back(PakFile::MakeEntry(relativePath, std::move(data)));
+    }
+    return true;
+}
+
+void HammerCompiler::CompressNewEntries(std::vector<PakEntry>& entries) {
+    size_t uncompressedSize = 0;
+    for (const auto& entry : entries) {
+        uncompressedSize += entry.data.size();
     }
 
-    try {
-        if (fs::exists(listPath)) {
-            fs::remove(listPath);
+    auto compressStart = std::chrono::steady_clock::now();
+    CompressPakEntries(entries, options.pakCodec, options.pakMinSize);
+    auto compressTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - compressStart);
+
+    size_t compressedSize = 0;
+    int compressedCount = 0;
+    for (const auto& entry : entries) {
+        compressedSize += entry.data.size();
+        if (entry.compressionMethod != ZIP_METHOD_STORE) {
+            compressedCount++;
         }
     }
-    catch (...) {}
 
-    std::cout << "Deleted " << deletedCount << " created files" << std::endl;
-    return true;
+    std::cout << "Compressed " << compressedCount << " of " << entries.size() << " files with "
+        << GetPakCodecName(options.pakCodec) << ": " << uncompressedSize << " -> " << compressedSize
+        << " bytes in " << compressTime.count() << " ms" << std::endl;
 }
 
 // BSPZIP:
 // https://developer.valvesoftware.com/wiki/BSPZIP
 //
-bool HammerCompiler::AddFilesToBSP(const std::string& bspPath, const std::string& gameDir) {
+bool HammerCompiler::PackFilesWithBSPZIP(const std::string& bspPath, const std::vector<std::pair<std::string, std::string>>& files) {
     std::cout << "Adding files to BSP using BSPZIP: " << bspPath << std::endl;
 
-    char modulePath[MAX_PATH];
-    GetModuleFileNameA(NULL, modulePath, MAX_PATH);
-    fs::path exePath(modulePath);
-    fs::path exeDir = exePath.parent_path();
-    fs::path bspzipPath = exeDir / "bspzip.exe";
+    fs::path exeDir = fs::path(GetExecutablePath()).parent_path();
+    fs::path bspzipPath = exeDir / GetExecutableName("bspzip");
 
     if (!fs::exists(bspzipPath)) {
-        std::cout << "Error: bspzip.exe not found in: " << bspzipPath << std::endl;
+        std::cout << "Error: " << bspzipPath.filename().string() << " not found in: " << bspzipPath << std::endl;
         return false;
     }
 
     std::cout << "Found BSPZIP: " << bspzipPath << std::endl;
 
-    fs::path fileListPath = fs::temp_directory_path() / "bsp_files_list.txt";
+    // Общий временный каталог: имя уникально, чтобы параллельные компиляции не делили список
+    fs::path fileListPath = MakeTempPath((fs::temp_directory_path() / "bsp_files_list").string());
     std::ofstream fileList(fileListPath);
 
     if (!fileList.is_open()) {
@@ -1084,81 +3390,26 @@ bool HammerCompiler::AddFilesToBSP(const std::string& bspPath, const std::string
         return false;
     }
 
-    std::set<std::string> addedFiles;
     int totalCount = 0;
-
-    for (const auto& entity : entities) {
-        if (entity.model.find("_colored.mdl") != std::string::npos) 
-        {
-            std::string modelFullPath = gameDir + "/" + entity.model;
-            if (fs::exists(modelFullPath)) 
-            {
-                std::string relativePath = entity.model;
-
-                if (addedFiles.find(relativePath) == addedFiles.end()) 
-                {
-                    fileList << relativePath << "\n";
-                    fileList << modelFullPath << "\n";
-                    addedFiles.insert(relativePath);
-                    totalCount++;
-                    std::cout << "Added to list: " << relativePath << " -> " << modelFullPath << std::endl;
-                }
-            }
-
-            std::string basePath = entity.model.substr(0, entity.model.find_last_of('.'));
-            std::vector<std::string> extensions = { ".vvd", ".dx90.vtx", ".phy" };
-
-            for (const auto& ext : extensions) {
-                std::string relatedFile = basePath + ext;
-                std::string relatedFullPath = gameDir + "/" + relatedFile;
-
-                if (fs::exists(relatedFullPath)) {
-                    std::string relativePath = relatedFile;
-
-                    if (addedFiles.find(relativePath) == addedFiles.end()) {
-                        fileList << relativePath << "\n";
-                        fileList << relatedFullPath << "\n";
-                        addedFiles.insert(relativePath);
-                        totalCount++;
-                        std::cout << "Added to list: " << relativePath << " -> " << relatedFullPath << std::endl;
-                    }
-                }
-            }
-
-            std::string fullModelPath = gameDir + "/" + entity.model;
-            MDLFile mdl;
-            if (mdl.Load(fullModelPath)) {
-                auto textureNames = mdl.GetTextureNames();
-                for (const auto& texture : textureNames) {
-                    if (texture.find("_color") != std::string::npos) {
-                        std::string vmtPath = "materials/" + texture + ".vmt";
-                        std::string vmtFullPath = gameDir + "/" + vmtPath;
-
-                        if (fs::exists(vmtFullPath)) {
-                            std::string relativePath = "materials/" + texture + ".vmt";
-
-                            if (addedFiles.find(relativePath) == addedFiles.end()) {
-                                fileList << relativePath << "\n";
-                                fileList << vmtFullPath << "\n";
-                                addedFiles.insert(relativePath);
-                                totalCount++;
-                                std::cout << "Added to list: " << relativePath << " -> " << vmtFullPath << std::endl;
-                            }
-                        }
-                    }
-                }
+    for (const auto& [relativePath, fullPath] : files) {
+        // bspzip читает только файлы с диска: файлы из памяти кладём в каталог --overlay
+        std::string sourcePath = fullPath;
+        if (sourcePath.empty()) {
+            sourcePath = outputDir + "/" + relativePath;
+            std::vector<unsigned char> content;
+            if (!generatedFiles.Read(relativePath, content) || !WriteFileContent(sourcePath, std::string(content.begin(), content.end()))) {
+                fs::remove(fileListPath);
+                return false;
             }
         }
+
+        fileList << relativePath << "\n";
+        fileList << sourcePath << "\n";
+        totalCount++;
     }
 
     fileList.close();
 
-    if (totalCount == 0) {
-        std::cout << "No files to add to BSP" << std::endl;
-        fs::remove(fileListPath);
-        return true;
-    }
-
     std::cout << "Created file list with " << totalCount << " unique files: " << fileListPath << std::endl;
 
     std::ifstream checkFile(fileListPath);
@@ -1179,13 +3430,12 @@ bool HammerCompiler::AddFilesToBSP(const std::string& bspPath, const std::string
     }
     checkFile.close();
 
-    std::string tempBspPath = bspPath + ".tmp";
-
-    std::string command = "cmd /c \"\"" + bspzipPath.string() + "\" -addlist \"" + bspPath + "\" \"" + fileListPath.string() + "\" \"" + tempBspPath + "\"\"";
+    std::string tempBspPath = MakeTempPath(bspPath);
 
     std::cout << "Executing BSPZIP command..." << std::endl;
 
-    int result = std::system(command.c_str());
+    // Без командной оболочки: пути с пробелами и кавычками передаются как есть
+    int result = RunProcess(bspzipPath.string(), { "-addlist", bspPath, fileListPath.string(), tempBspPath });
 
     fs::remove(fileListPath);
 
@@ -1227,10 +3477,12 @@ bool HammerCompiler::AddFilesToBSP(const std::string& bspPath, const std::string
 }
 
 bool HammerCompiler::ParseVMFForPostCompile() {
-    std::string content = ReadFileContent(vmfPath);
+    std::string compileVmfPath = GetCompileVMFPath();
+    std::string content = ReadFileContent(compileVmfPath);
     if (content.empty()) {
         return false;
     }
+    TrackInput(compileVmfPath, content.data(), content.size());
 
     entities.clear();
     modelData.clear();
@@ -1256,301 +3508,708 @@ bool HammerCompiler::ParseVMFForPostCompile() {
             currentPos++;
         }
 
-        if (braceCount == 0) {
-            std::string entityContent = content.substr(entityStart, currentPos - entityStart);
+        if (braceCount == 0) {
+            std::string entityContent = content.substr(entityStart, currentPos - entityStart);
+
+            EntityInfo entity;
+            entity.startPos = entityStart;
+            entity.endPos = currentPos;
+
+            size_t classnamePos = entityContent.find("\"classname\"");
+            if (classnamePos != std::string::npos) {
+                size_t valueStart = entityContent.find("\"", classnamePos + 12);
+                size_t valueEnd = entityContent.find("\"", valueStart + 1);
+                if (valueStart != std::string::npos && valueEnd != std::string::npos) {
+                    std::string classname = entityContent.substr(valueStart + 1, valueEnd - valueStart - 1);
+                    if (classname == "prop_static") {
+                        size_t modelPos = entityContent.find("\"model\"");
+                        if (modelPos != std::string::npos) {
+                            size_t valueStart = entityContent.find("\"", modelPos + 8);
+                            size_t valueEnd = entityContent.find("\"", valueStart + 1);
+                            if (valueStart != std::string::npos && valueEnd != std::string::npos) {
+                                entity.model = entityContent.substr(valueStart + 1, valueEnd - valueStart - 1);
+                            }
+                        }
+
+                        size_t colorMarkerPos = entityContent.find("\"$color\"");
+                        if (colorMarkerPos != std::string::npos) {
+                            size_t valueStart = entityContent.find("\"", colorMarkerPos + 8);
+                            size_t valueEnd = entityContent.find("\"", valueStart + 1);
+                            if (valueStart != std::string::npos && valueEnd != std::string::npos) {
+                                entity.rendercolor = entityContent.substr(valueStart + 1, valueEnd - valueStart - 1);
+                            }
+                        }
+
+                        size_t skinPos = entityContent.find("\"skin\"");
+                        if (skinPos != std::string::npos) {
+                            size_t valueStart = entityContent.find("\"", skinPos + 6);
+                            size_t valueEnd = entityContent.find("\"", valueStart + 1);
+                            if (valueStart != std::string::npos && valueEnd != std::string::npos) {
+                                entity.skin = std::stoi(entityContent.substr(valueStart + 1, valueEnd - valueStart - 1));
+                            }
+                        }
+
+                        if (!entity.model.empty() && IsColoredModelPath(entity.model)) {
+                            entities.push_back(entity);
+                            if (!entity.rendercolor.empty()) {
+                                modelData[entity.model].colors.insert(entity.rendercolor);
+                            }
+                            modelData[entity.model].entities.push_back(&entities.back());
+                        }
+                    }
+                }
+            }
+
+            pos = currentPos;
+        }
+        else {
+            break;
+        }
+    }
+
+    std::cout << "Found " << modelData.size() << " colored models for post-compile restoration" << std::endl;
+    return true;
+}
+
+// Восстановление за один проход: файл отображается в память, неизменённые
+// участки копируются в буферизованный writer как есть, а переписываются только
+// сущности с маркером "$color", то есть изменённые этим инструментом
+bool HammerCompiler::RestoreVMFAfterPostCompile() {
+    std::cout << "Restoring original VMF after post-compile..." << std::endl;
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    FileView input;
+    if (!fileSystem.Map(vmfPath, input)) {
+        std::cout << "Failed to open file: " << vmfPath << std::endl;
+        return false;
+    }
+
+    std::string_view content(reinterpret_cast<const char*>(input.GetData()), input.GetSize());
+    std::unique_ptr<FileWriter> output;
+    size_t copiedUpTo = 0;
+    int restoredCount = 0;
+
+    size_t pos = 0;
+    while ((pos = content.find("entity", pos)) != std::string_view::npos) {
+        // Ключевое слово блока стоит в начале строки, а не внутри значения
+        size_t lineStart = pos;
+        while (lineStart > 0 && (content[lineStart - 1] == ' ' || content[lineStart - 1] == '\t'))
+            lineStart--;
+
+        size_t afterKeyword = pos + 6;
+        bool isBlock = (lineStart == 0 || content[lineStart - 1] == '\n')
+            && (afterKeyword == content.size() || isspace(static_cast<unsigned char>(content[afterKeyword])));
+        if (!isBlock) {
+            pos = afterKeyword;
+            continue;
+        }
+
+        size_t braceStart = content.find('{', afterKeyword);
+        if (braceStart == std::string_view::npos)
+            break;
+
+        int braceCount = 1;
+        bool inQuotes = false;
+        size_t currentPos = braceStart + 1;
+        while (braceCount > 0 && currentPos < content.size()) {
+            char c = content[currentPos++];
+            if (c == '"') inQuotes = !inQuotes;
+            else if (!inQuotes && c == '{') braceCount++;
+            else if (!inQuotes && c == '}') braceCount--;
+        }
+
+        if (braceCount != 0)
+            break;
+
+        std::string_view entityContent = content.substr(pos, currentPos - pos);
+        if (entityContent.find("\"$color\"") != std::string_view::npos) {
+            std::string restoredEntity = RestoreEntityContent(std::string(entityContent));
+            if (restoredEntity != entityContent) {
+                if (restoredCount == 0 && !(output = fileSystem.OpenWrite(vmfPath))) {
+                    return false;
+                }
+
+                output->Write(content.data() + copiedUpTo, pos - copiedUpTo);
+                output->Write(restoredEntity);
+                copiedUpTo = currentPos;
+                restoredCount++;
+            }
+        }
+
+        pos = currentPos;
+    }
+
+    if (restoredCount == 0) {
+        std::cout << "No changes to restore in VMF" << std::endl;
+        return true;
+    }
+
+    output->Write(content.data() + copiedUpTo, content.size() - copiedUpTo);
+
+    // Отображение держит исходный файл, а Windows не даёт заменить такой файл
+    input.Close();
+    PlanStep("restore", vmfPath);
+    if (!output->Commit()) {
+        return false;
+    }
+    FinishStep("restore", vmfPath);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime);
+    TrackOutput(vmfPath);
+    std::cout << "Successfully restored VMF: " << restoredCount << " entities restored, "
+        << output->GetTotalWritten() << " bytes written in " << elapsed.count() << " ms" << std::endl;
+    return true;
+}
+
+std::string HammerCompiler::RestoreEntityContent(const std::string& entityContent) {
+    std::vector<EntityKeyValue> keyValues = ParseEntityKeyValues(entityContent);
+
+    const EntityKeyValue* model = nullptr;
+    const EntityKeyValue* skin = nullptr;
+    const EntityKeyValue* originalSkin = nullptr;
+    const EntityKeyValue* colorMarker = nullptr;
+    for (const auto& keyValue : keyValues) {
+        if (keyValue.key == "model" && !model) model = &keyValue;
+        else if (keyValue.key == "skin" && !skin) skin = &keyValue;
+        else if (keyValue.key == "$skin" && !originalSkin) originalSkin = &keyValue;
+        else if (keyValue.key == "$color" && !colorMarker) colorMarker = &keyValue;
+    }
+
+    if (!colorMarker) {
+        return entityContent;
+    }
+
+    std::vector<EntityEdit> edits;
+
+    std::string originalModel;
+    if (model && IsColoredModelPath(model->value, &originalModel)) {
+        edits.push_back({ model->valueStart + 1, model->value.size(), originalModel });
+    }
+
+    // Скин, который был у сущности до компиляции, хранится в маркере "$skin";
+    // без маркера скин добавил инструмент, и он удаляется
+    if (originalSkin) {
+        if (skin) {
+            edits.push_back({ skin->valueStart + 1, skin->value.size(), originalSkin->value });
+        }
+        edits.push_back(RemoveKeyValue(entityContent, *originalSkin));
+    }
+    else if (skin) {
+        edits.push_back(RemoveKeyValue(entityContent, *skin));
+    }
+
+    edits.push_back({ colorMarker->keyStart, colorMarker->key.size() + 2, "\"rendercolor\"" });
+
+    std::sort(edits.begin(), edits.end(), [](const EntityEdit& a, const EntityEdit& b) { return a.start > b.start; });
+
+    std::string result = entityContent;
+    for (const auto& edit : edits) {
+        result.replace(edit.start, edit.length, edit.replacement);
+    }
+    return result;
+}
+
+// Тесты собирают этот файл без точки входа и шагов командной строки
+#ifndef PROPCOLOR_NO_MAIN
+
+// Первый шаг: раскраска VMF перед vbsp
+static int RunPrecompile(const std::string& vmfFile, const std::string& gameDir, CompilerOptions options,
+    CachingFileSystem& fileSystem, CountingFileSystem& countingFileSystem, bool printNextStep = true)
+{
+    std::cout << clr::white << "VMF File: " << vmfFile << std::endl;
+    std::cout << "Game Directory: " << gameDir << std::endl;
+
+    if (!fs::exists(vmfFile))
+    {
+        std::cout << "Error: VMF file not found: " << vmfFile << std::endl;
+        return 1;
+    }
+
+    if (!fs::exists(gameDir))
+    {
+        std::cout << "Error: Game directory not found: " << gameDir << std::endl;
+        return 1;
+    }
+
+    if (options.rollback)
+    {
+        HammerCompiler compiler(vmfFile, gameDir, options, fileSystem);
+        if (!compiler.Rollback())
+        {
+            std::cout << "Rollback finished with errors, run it again" << std::endl;
+            return 1;
+        }
+        std::cout << clr::green << "Rollback completed successfully!" << std::endl;
+        return 0;
+    }
+
+    if (options.patchBsp)
+    {
+        if (options.check)
+        {
+            options.incremental = false;
+            HammerCompiler compiler(vmfFile, gameDir, options, fileSystem);
+            if (!compiler.CheckVMF())
+            {
+                return 1;
+            }
+        }
+
+        if (!printNextStep) {
+            return 0;
+        }
+        std::cout << clr::green << "\nPatch mode: the VMF is not modified and there is nothing to do before vbsp." << std::endl;
+        std::cout << "Compile your map in Hammer, then run this program with -postcompile --patchbsp parameters!" << std::endl;
+        return 0;
+    }
+
+    std::cout << "Starting compilation process..." << std::endl;
+
+    HammerCompiler compiler(vmfFile, gameDir, options, fileSystem);
+    if (!compiler.BeginJournal("precompile"))
+    {
+        return 1;
+    }
+
+    // Манифест пишется сразу после VMF: если он есть, осталось сохранить список файлов
+    if (compiler.IsStepDone("manifest"))
+    {
+        std::cout << "VMF and pak manifest are already written, saving created files list" << std::endl;
+    }
+    else
+    {
+        if (!compiler.ProcessVMF())
+        {
+            std::cout << "Failed to process VMF file" << std::endl;
+            return 1;
+        }
+
+        if (!compiler.SavePakManifest()) {
+            std::cout << "Warning: Failed to save pak manifest, post-compile will scan the VMF" << std::endl;
+        }
+    }
 
-            EntityInfo entity;
-            entity.startPos = entityStart;
-            entity.endPos = currentPos;
+    if (!compiler.SaveCreatedFilesList()) {
+        std::cout << "Warning: Failed to save created files list" << std::endl;
+    }
 
-            size_t classnamePos = entityContent.find("\"classname\"");
-            if (classnamePos != std::string::npos) {
-                size_t valueStart = entityContent.find("\"", classnamePos + 12);
-                size_t valueEnd = entityContent.find("\"", valueStart + 1);
-                if (valueStart != std::string::npos && valueEnd != std::string::npos) {
-                    std::string classname = entityContent.substr(valueStart + 1, valueEnd - valueStart - 1);
-                    if (classname == "prop_static") {
-                        size_t modelPos = entityContent.find("\"model\"");
-                        if (modelPos != std::string::npos) {
-                            size_t valueStart = entityContent.find("\"", modelPos + 8);
-                            size_t valueEnd = entityContent.find("\"", valueStart + 1);
-                            if (valueStart != std::string::npos && valueEnd != std::string::npos) {
-                                entity.model = entityContent.substr(valueStart + 1, valueEnd - valueStart - 1);
-                            }
-                        }
+    if (!options.depfilePath.empty()) {
+        compiler.WriteDepfile(options.depfilePath, vmfFile + ".created_files.txt");
+    }
+    if (!options.manifestPath.empty()) {
+        compiler.WriteManifest(options.manifestPath, "precompile");
+    }
 
-                        size_t colorMarkerPos = entityContent.find("\"$color\"");
-                        if (colorMarkerPos != std::string::npos) {
-                            size_t valueStart = entityContent.find("\"", colorMarkerPos + 8);
-                            size_t valueEnd = entityContent.find("\"", valueStart + 1);
-                            if (valueStart != std::string::npos && valueEnd != std::string::npos) {
-                                entity.rendercolor = entityContent.substr(valueStart + 1, valueEnd - valueStart - 1);
-                            }
-                        }
+    compiler.FinishJournal();
 
-                        size_t skinPos = entityContent.find("\"skin\"");
-                        if (skinPos != std::string::npos) {
-                            size_t valueStart = entityContent.find("\"", skinPos + 6);
-                            size_t valueEnd = entityContent.find("\"", valueStart + 1);
-                            if (valueStart != std::string::npos && valueEnd != std::string::npos) {
-                                entity.skin = std::stoi(entityContent.substr(valueStart + 1, valueEnd - valueStart - 1));
-                            }
-                        }
+    if (options.fsStats) {
+        countingFileSystem.PrintStats();
+        fileSystem.PrintStats();
+    }
 
-                        if (!entity.model.empty() && entity.model.find("_colored.mdl") != std::string::npos) {
-                            entities.push_back(entity);
-                            if (!entity.rendercolor.empty()) {
-                                modelData[entity.model].colors.insert(entity.rendercolor);
-                            }
-                            modelData[entity.model].entities.push_back(&entities.back());
-                        }
-                    }
-                }
-            }
+    std::cout << clr::green << "\nCompilation completed successfully!" << std::endl;
+    if (!printNextStep) {
+        return 0;
+    }
+    if (options.derivedVmf) {
+        std::cout << "Now compile " << compiler.GetCompileVMFPath() << " with vbsp/vvis/vrad, then run this program with -postcompile --derivedvmf parameters!" << std::endl;
+    }
+    else {
+        std::cout << "Now compile your map in Hammer, then run this program with -postcompile parameter!" << std::endl;
+    }
+    return 0;
+}
 
-            pos = currentPos;
-        }
-        else {
-            break;
-        }
+// Второй шаг: упаковка файлов в BSP, восстановление VMF и уборка.
+// waitForTools (только -compile) ждёт vvis и vrad, пока готовятся файлы pak
+static int RunPostcompile(const std::string& vmfFile, const std::string& gameDir, const CompilerOptions& options,
+    CachingFileSystem& fileSystem, CountingFileSystem& countingFileSystem, const std::function<bool()>& waitForTools = nullptr)
+{
+    std::cout << clr::white << "\nPost-compilation started..." << std::endl;
+    std::cout << "VMF File: " << vmfFile << std::endl;
+    std::cout << "Game Directory: " << gameDir << std::endl;
+
+    if (!fs::exists(vmfFile))
+    {
+        std::cout << "Error: VMF file not found: " << vmfFile << std::endl;
+        return 1;
     }
 
-    std::cout << "Found " << modelData.size() << " colored models for post-compile restoration" << std::endl;
-    return true;
-}
+    if (!fs::exists(gameDir))
+    {
+        std::cout << "Error: Game directory not found: " << gameDir << std::endl;
+        return 1;
+    }
 
-bool HammerCompiler::RestoreVMFAfterPostCompile() {
-    std::cout << "Restoring original VMF after post-compile..." << std::endl;
+    HammerCompiler compiler(vmfFile, gameDir, options, fileSystem);
+    if (options.rollback) {
+        if (!compiler.Rollback()) {
+            std::cout << "Rollback finished with errors, run it again" << std::endl;
+            return 1;
+        }
+        std::cout << clr::green << "Rollback completed successfully!" << std::endl;
+        return 0;
+    }
 
-    std::string content = ReadFileContent(vmfPath);
-    if (content.empty()) {
-        return false;
+    if (!compiler.BeginJournal("postcompile")) {
+        return 1;
     }
 
-    bool hasChanges = false;
-    int restoredCount = 0;
+    std::string bspPath = vmfFile;
+    size_t dotPos = bspPath.find_last_of('.');
+    if (dotPos != std::string::npos) {
+        bspPath = bspPath.substr(0, dotPos) + ".bsp";
+    }
 
-    size_t pos = 0;
-    while (pos < content.length()) {
-        size_t entityStart = content.find("entity", pos);
-        if (entityStart == std::string::npos) break;
+    // vbsp компилировал <map>.colored.vmf, поэтому и BSP называется так же
+    std::string finalBspPath = bspPath;
+    if (options.derivedVmf && !options.patchBsp) {
+        std::string compileVmfPath = compiler.GetCompileVMFPath();
+        bspPath = compileVmfPath.substr(0, compileVmfPath.find_last_of('.')) + ".bsp";
+    }
 
-        size_t braceStart = content.find("{", entityStart);
-        if (braceStart == std::string::npos) break;
+    // Прерванный запуск успел переименовать BSP
+    if (bspPath != finalBspPath && compiler.IsStepDone("rename")) {
+        bspPath = finalBspPath;
+    }
 
-        int braceCount = 1;
-        size_t currentPos = braceStart + 1;
+    if (!fs::exists(bspPath)) {
+        std::cout << "BSP file not found: " << bspPath << std::endl;
+        return 1;
+    }
 
-        while (braceCount > 0 && currentPos < content.length()) {
-            if (content[currentPos] == '{') braceCount++;
-            else if (content[currentPos] == '}') braceCount--;
-            currentPos++;
-        }
+    std::cout << "BSP File: " << bspPath << std::endl;
 
-        if (braceCount == 0) {
-            std::string entityContent = content.substr(entityStart, currentPos - entityStart);
+    // Упаковка - последний шаг, которому нужны модели и манифест: после неё
+    // прерванный запуск доделывает только восстановление VMF и уборку
+    if (compiler.IsStepDone("pak")) {
+        std::cout << "Files are already packed into " << bspPath << ", skipping to cleanup" << std::endl;
+    }
+    else {
+        if (!options.patchBsp && !compiler.OpenPakManifest()) {
+            // Без манифеста материалов --overlay больше нигде нет
+            if (options.overlay) {
+                std::cout << "Error: --overlay needs an up-to-date pak manifest, run the first step again" << std::endl;
+                return 1;
+            }
+            if (!compiler.ParseVMFForPostCompile()) {
+                std::cout << "Failed to parse VMF for post-compile" << std::endl;
+                return 1;
+            }
+        }
 
-            if (entityContent.find("_colored.mdl") != std::string::npos) {
-                std::string restoredEntity = RestoreEntityContent(entityContent);
-                if (restoredEntity != entityContent) {
-                    content.replace(entityStart, currentPos - entityStart, restoredEntity);
-                    hasChanges = true;
-                    restoredCount++;
-                    std::cout << "Restored entity with colored model" << std::endl;
-                }
+        // -compile: пока vvis и vrad работают с BSP, файлы pak читаются и сжимаются;
+        // сам BSP меняется только после их завершения. Откатывает RunCompile
+        if (waitForTools) {
+            bool prepared = options.patchBsp || options.useBspzip || compiler.PreparePakEntries();
+            if (!waitForTools() || !prepared) {
+                return 1;
             }
+        }
 
-            pos = currentPos;
+        if (options.patchBsp && !compiler.PatchBSP(bspPath)) {
+            std::cout << "Failed to patch static props in BSP" << std::endl;
+            return 1;
         }
-        else {
-            break;
+
+        if (!compiler.AddFilesToBSP(bspPath)) {
+            std::cout << "Failed to add files to BSP" << std::endl;
+            return 1;
         }
     }
 
-    size_t coloredPos = 0;
-    int globalReplaceCount = 0;
-    while ((coloredPos = content.find("_colored.mdl", coloredPos)) != std::string::npos) {
-        size_t quoteBefore = content.rfind('"', coloredPos);
-        size_t quoteAfter = content.find('"', coloredPos);
+    if (!options.patchBsp && !options.derivedVmf && !compiler.RestoreVMFAfterPostCompile()) {
+        std::cout << "Failed to restore VMF" << std::endl;
+        return 1;
+    }
 
-        if (quoteBefore != std::string::npos && quoteAfter != std::string::npos) {
-            content.replace(coloredPos, 12, ".mdl");
-            globalReplaceCount++;
-            coloredPos += 4;
+    if (bspPath != finalBspPath) {
+        try {
+            compiler.PlanStep("rename", finalBspPath);
+            fs::rename(bspPath, finalBspPath);
+            compiler.FinishStep("rename", finalBspPath);
+            std::cout << "Renamed " << bspPath << " to " << finalBspPath << std::endl;
+            bspPath = finalBspPath;
         }
-        else {
-            coloredPos += 12;
+        catch (const std::exception& e) {
+            std::cout << "Failed to rename BSP: " << e.what() << std::endl;
+            return 1;
         }
     }
 
-    if (globalReplaceCount > 0) {
-        hasChanges = true;
-        std::cout << "Globally replaced " << globalReplaceCount << " remaining _colored.mdl references" << std::endl;
+    // В инкрементальном режиме созданные файлы остаются кешем для следующей компиляции
+    if (options.incremental) {
+        std::cout << "Incremental mode: keeping created files for the next compile" << std::endl;
     }
-
-    size_t skinPos = 0;
-    int skinRemoveCount = 0;
-    while ((skinPos = content.find("\"skin\"", skinPos)) != std::string::npos) {
-        size_t lineStart = content.rfind('\n', skinPos);
-        if (lineStart == std::string::npos) lineStart = 0;
-        size_t lineEnd = content.find('\n', skinPos);
-        if (lineEnd == std::string::npos) lineEnd = content.length();
-
-        std::string line = content.substr(lineStart, lineEnd - lineStart);
-        if (line.find("\"skin\"") != std::string::npos && line.find("\"") != std::string::npos) {
-            content.erase(lineStart, lineEnd - lineStart);
-            skinRemoveCount++;
+    else {
+        // В режиме --patchbsp файлы созданы в этом же запуске, список ещё не записан
+        if (options.patchBsp && !compiler.SaveCreatedFilesList()) {
+            std::cout << "Warning: Failed to save created files list" << std::endl;
         }
-        else {
-            skinPos = lineEnd;
+        if (!compiler.DeleteCreatedFiles()) {
+            std::cout << "Warning: Failed to delete some created files" << std::endl;
+        }
+        if (options.overlay && !compiler.RemoveOverlay()) {
+            std::cout << "Warning: Failed to remove overlay directory" << std::endl;
         }
     }
 
-    if (skinRemoveCount > 0) {
-        hasChanges = true;
-        std::cout << "Removed " << skinRemoveCount << " remaining skin parameters" << std::endl;
+    if (!options.depfilePath.empty()) {
+        compiler.WriteDepfile(options.depfilePath, bspPath);
     }
-
-    size_t globalColorPos = 0;
-    int globalColorReplaceCount = 0;
-    while ((globalColorPos = content.find("\"$color\"", globalColorPos)) != std::string::npos) {
-        content.replace(globalColorPos, 8, "\"rendercolor\"");
-        globalColorReplaceCount++;
-        globalColorPos += 12;
+    if (!options.manifestPath.empty()) {
+        compiler.WriteManifest(options.manifestPath, "postcompile");
     }
 
-    if (globalColorReplaceCount > 0) {
-        hasChanges = true;
-        std::cout << "Globally replaced " << globalColorReplaceCount << " remaining $color markers" << std::endl;
+    compiler.FinishJournal();
+
+    if (options.fsStats) {
+        countingFileSystem.PrintStats();
+        fileSystem.PrintStats();
     }
 
-    if (hasChanges) {
-        if (!WriteFileContent(vmfPath, content)) {
-            return false;
-        }
-        std::cout << "Successfully restored VMF: " << restoredCount << " entities restored, "
-            << globalReplaceCount << " global replacements, "
-            << skinRemoveCount << " skins removed, "
-            << globalColorReplaceCount << " $color markers replaced" << std::endl;
+    std::cout << clr::green << "Post-compilation completed successfully!" << std::endl;
+    return 0;
+}
+
+// vbsp, vvis и vrad лежат в --toolsdir, а без него - рядом с программой
+static std::string GetToolPath(const CompilerOptions& options, const std::string& exeDir, const std::string& name)
+{
+    fs::path dir = options.toolsDir.empty() ? fs::path(exeDir) : fs::path(options.toolsDir);
+    return (dir / GetExecutableName(name)).string();
+}
+
+// Аргументы --vbspargs и других делятся по пробелам, кавычки не поддерживаются
+static std::vector<std::string> SplitArguments(const std::string& text)
+{
+    std::istringstream stream(text);
+    std::vector<std::string> arguments;
+    std::string argument;
+    while (stream >> argument)
+    {
+        arguments.push_back(argument);
     }
-    else {
-        std::cout << "No changes to restore in VMF" << std::endl;
+    return arguments;
+}
+
+// Карта передаётся без расширения, как её передаёт Hammer
+static bool RunCompileTool(const std::string& toolPath, const std::string& extraArgs, const std::string& gameDir, const std::string& mapPath)
+{
+    std::vector<std::string> arguments = SplitArguments(extraArgs);
+    arguments.push_back("-game");
+    arguments.push_back(gameDir);
+    arguments.push_back(mapPath);
+
+    std::string toolName = fs::path(toolPath).filename().string();
+    std::cout << clr::cyan << "\nRunning " << toolPath << clr::white << std::endl;
+
+    auto startTime = std::chrono::steady_clock::now();
+    int exitCode = RunProcess(toolPath, arguments);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime);
+
+    if (exitCode != 0)
+    {
+        std::cout << clr::red << "Error: " << toolName << " failed with exit code " << exitCode << clr::white << std::endl;
+        return false;
     }
 
-    return hasChanges;
+    std::cout << toolName << " finished in " << elapsed.count() << " ms" << std::endl;
+    return true;
 }
 
-std::string HammerCompiler::RestoreEntityContent(const std::string& entityContent) {
-    std::string result = entityContent;
+// -compile: первый шаг, vbsp, vvis, vrad и второй шаг одним запуском. Сразу после vbsp
+// vvis и vrad уходят в отдельный поток, а второй шаг в это время читает и сжимает
+// файлы pak: после vrad остаётся только дописать их в BSP
+static int RunCompile(const std::string& vmfFile, const std::string& gameDir, const CompilerOptions& options,
+    CachingFileSystem& fileSystem, CountingFileSystem& countingFileSystem, const std::string& exeDir)
+{
+    if (options.resume || options.rollback)
+    {
+        std::cout << clr::red << "Error: --resume and --rollback work with the step that was interrupted, not with -compile" << std::endl;
+        return 1;
+    }
 
-    size_t modelPos = result.find("\"model\"");
-    if (modelPos != std::string::npos) {
-        size_t valueStart = result.find("\"", modelPos + 8);
-        size_t valueEnd = result.find("\"", valueStart + 1);
-        if (valueStart != std::string::npos && valueEnd != std::string::npos) {
-            std::string modelPath = result.substr(valueStart + 1, valueEnd - valueStart - 1);
-            size_t coloredPos = modelPath.find("_colored.mdl");
-            if (coloredPos != std::string::npos) {
-                std::string originalModel = modelPath.substr(0, coloredPos) + ".mdl";
-                result.replace(valueStart + 1, valueEnd - valueStart - 1, originalModel);
-            }
-        }
+    int result = RunPrecompile(vmfFile, gameDir, options, fileSystem, countingFileSystem, false);
+    if (result != 0)
+    {
+        return result;
     }
 
-    size_t skinPos = result.find("\"skin\"");
-    while (skinPos != std::string::npos) {
-        size_t lineStart = result.rfind("\n", skinPos);
-        if (lineStart == std::string::npos) lineStart = 0;
-        size_t lineEnd = result.find("\n", skinPos);
-        if (lineEnd != std::string::npos) {
-            result.erase(lineStart, lineEnd - lineStart + 1);
-        }
-        else {
-            result.erase(lineStart);
+    std::string compileVmf = HammerCompiler(vmfFile, gameDir, options, fileSystem).GetCompileVMFPath();
+    std::string mapPath = compileVmf.substr(0, compileVmf.find_last_of('.'));
+
+    if (!RunCompileTool(GetToolPath(options, exeDir, "vbsp"), options.vbspArgs, gameDir, mapPath))
+    {
+        // VMF уже раскрашен, а до второго шага дело не дойдёт
+        if (!options.patchBsp)
+        {
+            std::cout << clr::red << "Compilation failed, rolling back" << clr::white << std::endl;
+            HammerCompiler(vmfFile, gameDir, options, fileSystem).Rollback();
         }
-        skinPos = result.find("\"skin\"", skinPos);
+        return 1;
     }
 
-    size_t markerPos = result.find("\"$color\"");
-    if (markerPos != std::string::npos) {
-        result.replace(markerPos, 8, "\"rendercolor\"");
+    bool lightingDone = false;
+    std::thread lighting([&]()
+    {
+        lightingDone = RunCompileTool(GetToolPath(options, exeDir, "vvis"), options.vvisArgs, gameDir, mapPath) &&
+            RunCompileTool(GetToolPath(options, exeDir, "vrad"), options.vradArgs, gameDir, mapPath);
+    });
+
+    result = RunPostcompile(vmfFile, gameDir, options, fileSystem, countingFileSystem, [&]()
+    {
+        lighting.join();
+        return lightingDone;
+    });
+
+    // Второй шаг мог остановиться раньше, чем дождался vrad
+    if (lighting.joinable())
+    {
+        lighting.join();
     }
 
+    // Любая ошибка второго шага оставляет раскрашенный VMF и созданные файлы:
+    // откат после vrad, чтобы никто уже не писал в BSP
+    if (result != 0)
+    {
+        std::cout << clr::red << "Compilation failed, rolling back" << clr::white << std::endl;
+        HammerCompiler(vmfFile, gameDir, options, fileSystem).Rollback();
+    }
     return result;
 }
 
 int main(int argc, char* argv[])
 {
-    SetConsoleOutputCP(1251);
-    SetConsoleCP(1251);
+    InitConsole();
 
     std::cout << clr::cyan << "Satjo Interactive - PropColorCompiler.exe (Nov 28 2025)\n";
     std::cout << clr::cyan << "This program is created by Tirmiks and is provided AS IS.\n";
 
-    if (argc == 4 && std::string(argv[1]) == "-postcompile") 
+    CompilerOptions options;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++)
     {
-        std::string vmfFile = argv[2];
-        std::string gameDir = argv[3];
-
-        std::cout << clr::white << "\nPost-compilation started..." << std::endl;
-        std::cout << "VMF File: " << vmfFile << std::endl;
-        std::cout << "Game Directory: " << gameDir << std::endl;
-
-        if (!fs::exists(vmfFile))
+        std::string arg = argv[i];
+        if (arg == "--incremental")
         {
-            std::cout << "Error: VMF file not found: " << vmfFile << std::endl;
-            return 1;
+            options.incremental = true;
         }
-
-        if (!fs::exists(gameDir))
+        else if (arg == "--hashnames")
         {
-            std::cout << "Error: Game directory not found: " << gameDir << std::endl;
-            return 1;
+            options.hashNames = true;
         }
-
-        HammerCompiler compiler(vmfFile, gameDir);
-
-        std::string bspPath = vmfFile;
-        size_t dotPos = bspPath.find_last_of('.');
-        if (dotPos != std::string::npos) {
-            bspPath = bspPath.substr(0, dotPos) + ".bsp";
+        else if (arg == "--bspzip")
+        {
+            options.useBspzip = true;
         }
-
-        if (!fs::exists(bspPath)) {
-            std::cout << "BSP file not found: " << bspPath << std::endl;
-            return 1;
+        else if ((arg == "--depfile" || arg == "--manifest") && i + 1 < argc)
+        {
+            (arg == "--depfile" ? options.depfilePath : options.manifestPath) = argv[++i];
         }
-
-        std::cout << "BSP File: " << bspPath << std::endl;
-
-        if (!compiler.ParseVMFForPostCompile()) {
-            std::cout << "Failed to parse VMF for post-compile" << std::endl;
-            return 1;
+        else if (arg == "--pakcodec" && i + 1 < argc)
+        {
+            std::string codecName = argv[++i];
+            if (!ParsePakCodec(codecName, options.pakCodec))
+            {
+                std::cout << clr::red << "Error: Unknown pak codec: " << codecName << " (expected store, deflate or lzma)" << std::endl;
+                return 1;
+            }
+            if (!IsPakCodecAvailable(options.pakCodec))
+            {
+                std::cout << clr::yellow << "Warning: This build has no " << codecName << " support, pak entries will be stored" << std::endl;
+                options.pakCodec = PakCodec::Store;
+            }
         }
-
-        if (!compiler.AddFilesToBSP(bspPath, gameDir)) {
-            std::cout << "Failed to add files to BSP" << std::endl;
-            return 1;
+        else if (arg == "--pakverify")
+        {
+            options.pakVerify = true;
         }
-
-        if (!compiler.RestoreVMFAfterPostCompile()) {
-            std::cout << "Failed to restore VMF" << std::endl;
-            return 1;
+        else if (arg == "--patchbsp")
+        {
+            options.patchBsp = true;
         }
-
-        if (!compiler.DeleteCreatedFiles()) {
-            std::cout << "Warning: Failed to delete some created files" << std::endl;
+        else if (arg == "--derivedvmf")
+        {
+            options.derivedVmf = true;
+        }
+        else if (arg == "--overlay")
+        {
+            options.overlay = true;
+        }
+        else if (arg == "--fsstats")
+        {
+            options.fsStats = true;
+        }
+        else if (arg == "--fstrace")
+        {
+            options.fsTrace = true;
+            options.fsStats = true;
+        }
+        else if (arg == "--tint")
+        {
+            options.tint = true;
+            options.patchBsp = true;
+        }
+        else if (arg == "--pakminsize" && i + 1 < argc)
+        {
+            options.pakMinSize = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--resume")
+        {
+            options.resume = true;
+        }
+        else if (arg == "--rollback")
+        {
+            options.rollback = true;
+        }
+        else if (arg == "--check")
+        {
+            options.check = true;
+        }
+        else if (arg == "--toolsdir" && i + 1 < argc)
+        {
+            options.toolsDir = argv[++i];
+        }
+        else if ((arg == "--vbspargs" || arg == "--vvisargs" || arg == "--vradargs") && i + 1 < argc)
+        {
+            (arg == "--vbspargs" ? options.vbspArgs : arg == "--vvisargs" ? options.vvisArgs : options.vradArgs) = argv[++i];
+        }
+        else if (arg.rfind("--", 0) == 0)
+        {
+            std::cout << clr::yellow << "Warning: Unknown option ignored: " << arg << std::endl;
+        }
+        else
+        {
+            args.push_back(arg);
         }
+    }
 
-        std::cout << clr::green << "Post-compilation completed successfully!" << std::endl;
-        return 0;
+    // Материалы --overlay живут только до упаковки, кешировать между компиляциями нечего
+    if (options.overlay && options.incremental)
+    {
+        std::cout << clr::yellow << "Warning: --incremental is not supported with --overlay and is ignored" << std::endl;
+        options.incremental = false;
+    }
+
+    // custom/* монтирует overlay всех карт сразу, поэтому одинаковое имя файла
+    // в них должно означать одинаковое содержимое
+    if (options.overlay)
+    {
+        options.hashNames = true;
     }
-    else if (argc == 3) {
-        std::string vmfFile = argv[1];
-        std::string gameDir = argv[2];
 
-        std::cout << clr::white << "VMF File: " << vmfFile << std::endl;
-        std::cout << "Game Directory: " << gameDir << std::endl;
+    // Все обращения шагов к файлам идут через кеш метаданных и счётчик под ним, поэтому
+    // статистика показывает то, что дошло до диска; BSP и bspzip работают с диском напрямую.
+    // Архивы VPK из поисковых путей читаются как каталоги поверх диска
+    VPKFileSystem packedFileSystem(GetDiskFileSystem());
+    CountingFileSystem countingFileSystem(packedFileSystem, options.fsTrace);
+    CachingFileSystem fileSystem(countingFileSystem);
+
+    if (args.size() == 3 && args[0] == "-check")
+    {
+        std::string vmfFile = args[1];
+        std::string gameDir = args[2];
 
         if (!fs::exists(vmfFile))
         {
@@ -1564,32 +4223,61 @@ int main(int argc, char* argv[])
             return 1;
         }
 
-        std::cout << "Starting compilation process..." << std::endl;
-
-        HammerCompiler compiler(vmfFile, gameDir);
-        if (!compiler.ProcessVMF())
+        // Проверка ничего не пишет, поэтому и таблица сущностей --incremental не обновляется
+        options.incremental = false;
+        HammerCompiler compiler(vmfFile, gameDir, options, fileSystem);
+        if (!compiler.CheckVMF())
         {
-            std::cout << "Failed to process VMF file" << std::endl;
             return 1;
         }
 
-        if (!compiler.SaveCreatedFilesList()) {
-            std::cout << "Warning: Failed to save created files list" << std::endl;
-        }
-
-        std::cout << clr::green << "\nCompilation completed successfully!" << std::endl;
-        std::cout << "Now compile your map in Hammer, then run this program with -postcompile parameter!" << std::endl;
+        std::cout << clr::green << "Pre-flight check passed!" << std::endl;
         return 0;
     }
+    else if (args.size() == 3 && args[0] == "-postcompile") 
+    {
+        return RunPostcompile(args[1], args[2], options, fileSystem, countingFileSystem);
+    }
+    else if (args.size() == 3 && args[0] == "-compile")
+    {
+        return RunCompile(args[1], args[2], options, fileSystem, countingFileSystem, fs::path(GetExecutablePath()).parent_path().string());
+    }
+    else if (args.size() == 2) {
+        return RunPrecompile(args[0], args[1], options, fileSystem, countingFileSystem);
+    }
     else
     {
         std::cout << clr::white << "\nProp Static Color Compiler for Hammer++" << std::endl;
         std::cout << "Usage: " << argv[0] << " <vmf_file> <game_dir>" << std::endl;
         std::cout << "Post-compile: " << argv[0] << " -postcompile <vmf_file> <game_dir>" << std::endl;
+        std::cout << "Check only: " << argv[0] << " -check <vmf_file> <game_dir>" << std::endl;
+        std::cout << "Full compile: " << argv[0] << " -compile <vmf_file> <game_dir> [--toolsdir <dir>]" << std::endl;
+        std::cout << "\nOptions:" << std::endl;
+        std::cout << "  --incremental    Reuse colored models whose inputs and colors are unchanged (pass to both steps)" << std::endl;
+        std::cout << "  --hashnames      Name generated models and materials by content hash instead of color order" << std::endl;
+        std::cout << "  --depfile <path> Write a ninja/make depfile listing every file the step read" << std::endl;
+        std::cout << "  --manifest <path> Write a JSON manifest of inputs, outputs (with hashes) and pak entries" << std::endl;
+        std::cout << "  --bspzip         Pack files with bspzip.exe instead of the built-in pakfile writer" << std::endl;
+        std::cout << "  --pakcodec <store|deflate|lzma> Compress packed files (built-in writer only, default store)" << std::endl;
+        std::cout << "  --pakminsize <bytes> Do not compress files smaller than this (default 1024)" << std::endl;
+        std::cout << "  --pakverify      Compare pak entries byte by byte, not only by CRC32 and size, before skipping them" << std::endl;
+        std::cout << "  --patchbsp       Leave the VMF alone and patch static props in the BSP during -postcompile" << std::endl;
+        std::cout << "  --tint           Like --patchbsp, but write colors into the static prop lump without creating any files" << std::endl;
+        std::cout << "  --derivedvmf     Write <map>.colored.vmf for vbsp instead of modifying the VMF (pass to both steps)" << std::endl;
+        std::cout << "  --overlay        Stage models in custom/_propcolor_<map> and keep materials in memory (pass to both steps)" << std::endl;
+        std::cout << "  --fsstats        Print how many file system operations the step performed" << std::endl;
+        std::cout << "  --fstrace        Like --fsstats, and also log every file access" << std::endl;
+        std::cout << "  --resume         Finish an interrupted step from its journal (<map>.vmf.journal)" << std::endl;
+        std::cout << "  --check          Check models, materials and skin limits first and stop before changing anything if one fails" << std::endl;
+        std::cout << "  --toolsdir <dir> Folder with vbsp, vvis and vrad for -compile (default: folder of this program)" << std::endl;
+        std::cout << "  --vbspargs, --vvisargs, --vradargs \"<args>\" Extra arguments for the compile tools in -compile" << std::endl;
+        std::cout << "  --rollback       Undo an interrupted or the last run: restore the VMF and BSP pak, delete created files" << std::endl;
         std::cout << "Example: " << argv[0] << " C:\\mapsrc\\map.vmf C:\\game\\mission_borealis" << std::endl;
         std::cout << "Post-compile example: " << argv[0] << " -postcompile C:\\mapsrc\\map.vmf C:\\game\\mission_borealis" << std::endl;
         std::cout << "\nSet these parameters in Hammer++ for first compilation: $path\\$file.$ext $gamedir" << std::endl;
         std::cout << "\nSet these parameters in Hammer++ for post-compilation: -postcompile $path\\$file.$ext $gamedir" << std::endl;
         return 1;
     }
-}
\ No newline at end of file
+}
+
+#endif // PROPCOLOR_NO_MAIN
@@ -12,15 +12,36 @@
 #include <vector>
 #include <string>
 #include <cstring>
-#include <windows.h>
+#include <cstdint>
+#include <cctype>
 #include <algorithm>
 #include <map>
 #include <set>
 #include <sstream>
 #include <filesystem>
 
+#include "BSPFile.h"
+#include "PakManifest.h"
+#include "FileSystem.h"
+#include "SearchPaths.h"
+#include "AsyncIO.h"
+#include "Journal.h"
+#include "OutputRegistry.h"
+
 namespace fs = std::filesystem;
 
+// Версия инструмента входит в отпечаток инкрементальной сборки:
+// при изменении формата генерируемых файлов её нужно поднять.
+#define PROPCOLOR_TOOL_VERSION "1.1"
+
+// Предел семейств скинов модели в движке (MAXSTUDIOSKINS)
+#define MAXSTUDIOSKINS 32
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL);
+std::string HashToHex(uint64_t hash);
+uint32_t PackColor(const std::string& color);
+std::string NormalizeAssetPath(const std::string& path);
+
 #pragma pack(push, 1)
 
 struct Vector
@@ -148,6 +169,7 @@ struct PostCompilePropInfo {
 class MDLFile
 {
 private:
+    FileSystem* fileSystem;
     std::vector<unsigned char> fileData;
     std::vector<unsigned char> newFileData;
     StudioHdr* header;
@@ -162,14 +184,22 @@ private:
     int alreadyEditedOffset;
 
 public:
+    explicit MDLFile(FileSystem& fileSystem = GetDiskFileSystem()) : fileSystem(&fileSystem) {}
+
     bool Load(const std::string& filename);
+    bool Load(const std::string& filename, std::vector<unsigned char> data);    // уже прочитанный файл
     bool Save(const std::string& filename);
     bool AddMaterial(const std::string& materialPath);
     bool AddMaterialWithSkin(const std::string& materialPath);
     bool AddMultipleMaterialsWithSkins(const std::vector<std::string>& materialPaths);
 
+    // Заголовок и таблицы материалов и скинов лежат внутри файла; error - причина, если нет
+    static bool Validate(const std::vector<unsigned char>& data, std::string& error);
+
     std::vector<std::string> GetTextureNames() const { return textureNames; }
     std::vector<std::string> GetTextureDirs() const { return textureDirs; }
+    const std::vector<unsigned char>& GetFileData() const { return fileData; }
+    const std::vector<unsigned char>& GetNewFileData() const { return newFileData; }
 
 private:
     void ParseTextures();
@@ -184,20 +214,65 @@ private:
         const std::vector<std::string>& newTextureDirs);
 };
 
+struct CompilerOptions
+{
+    bool incremental = false;   // --incremental: переиспользовать неизменившиеся модели между компиляциями
+    bool hashNames = false;     // --hashnames: имена сгенерированных файлов из хеша содержимого, а не порядкового номера
+    std::string depfilePath;    // --depfile <path>: depfile в формате ninja/make
+    std::string manifestPath;   // --manifest <path>: JSON со всеми входами, выходами и содержимым pak
+    bool useBspzip = false;     // --bspzip: упаковка через bspzip.exe вместо встроенной записи pak
+    PakCodec pakCodec = PakCodec::Store;    // --pakcodec <store|deflate|lzma>: сжатие записей pak
+    size_t pakMinSize = 1024;               // --pakminsize <bytes>: файлы меньше этого размера не сжимаются
+    bool pakVerify = false;                 // --pakverify: побайтовая проверка совпавших по CRC32 записей pak
+    bool patchBsp = false;                  // --patchbsp: не трогать VMF, а исправить статические пропы прямо в BSP
+    bool tint = false;                      // --tint: цвет в m_DiffuseModulation пропа вместо новых моделей и материалов
+    bool derivedVmf = false;                // --derivedvmf: писать <map>.colored.vmf вместо изменения исходного VMF
+    bool overlay = false;                   // --overlay: модели в custom/_propcolor_<map>, материалы только в памяти и манифесте
+    bool fsStats = false;                   // --fsstats: в конце шага напечатать число обращений к файлам
+    bool fsTrace = false;                   // --fstrace: печатать каждое обращение к файлам
+    bool resume = false;                    // --resume: доделать прерванный этап по журналу
+    bool rollback = false;                  // --rollback: отменить всё, что сделали прерванный или прошлый запуск
+    bool check = false;                     // --check: проверить модели и материалы до того, как что-то изменится
+    std::string toolsDir;                   // --toolsdir <dir>: каталог vbsp, vvis и vrad для -compile
+    std::string vbspArgs;                   // --vbspargs "<args>": дополнительные аргументы vbsp
+    std::string vvisArgs;                   // --vvisargs "<args>": дополнительные аргументы vvis
+    std::string vradArgs;                   // --vradargs "<args>": дополнительные аргументы vrad
+};
+
 class HammerCompiler
 {
 private:
     std::string vmfPath;
     std::string gameDir;
+    std::string outputDir;      // куда пишутся цветные модели: gameDir или каталог --overlay
+    CompilerOptions options;
+    FileSystem& fileSystem;
+    SearchPathIndex searchPaths;        // строится при первом поиске исходного файла
+    bool searchPathsBuilt = false;
 
     std::vector<PostCompilePropInfo> postCompileProps;
 
     struct EntityInfo {
+        int id = 0;
         std::string model;
         std::string rendercolor;
         int skin = 0;
+        std::string origin;
+        std::string angles;
         size_t startPos;
         size_t endPos;
+        uint64_t contentHash = 0;
+    };
+
+    // Запись таблицы сущностей прошлой компиляции (только prop_static)
+    struct EntityFingerprint
+    {
+        uint64_t contentHash = 0;
+        std::string model;
+        std::string rendercolor;
+        int skin = 0;
+        std::string origin;
+        std::string angles;
     };
 
     struct ModelColorInfo
@@ -206,13 +281,69 @@ private:
         std::vector<EntityInfo*> entities;
     };
 
+    // Отпечаток цветной модели для инкрементальной сборки
+    struct ModelFingerprint
+    {
+        std::string toolVersion;
+        std::string mdlHash;
+        std::string vmtHash;
+        std::string colors;
+        std::vector<std::string> outputs;
+        std::string vmtPath;
+        std::string sourceStamp;    // размер и mtime исходных MDL, VMT, VVD, VTX и PHY
+        std::string companionHashes;    // "расширение=хеш;" для каждого найденного компаньона
+        std::vector<std::string> outputHashes;      // хеши outputs в том же порядке
+
+        bool SameInputs(const ModelFingerprint& other) const
+        {
+            return toolVersion == other.toolVersion && mdlHash == other.mdlHash &&
+                vmtHash == other.vmtHash && colors == other.colors && companionHashes == other.companionHashes;
+        }
+    };
+
     std::vector<std::string> createdFiles;
     std::vector<EntityInfo> entities;
     std::map<std::string, ModelColorInfo> modelData;
+    std::map<std::string, ModelFingerprint> modelCache;
+    std::map<std::string, std::vector<std::string>> modelOutputs;
+    std::vector<std::string> staleOutputs;     // выходы прошлой компиляции, не нужные этой
+    std::map<int, EntityFingerprint> entityCache;
+    std::set<std::string> dirtyModels;
+    bool usingTint = false;     // --tint применён: цвета в лампе пропов, файлов нет
+
+    PakManifest pakManifest;
+    bool pakManifestLoaded = false;
+
+    // Сгенерированные VMT в режиме --overlay до упаковки, по пути внутри pak
+    MemoryFileSystem generatedFiles;
+
+    // -compile: файлы pak прочитаны и сжаты заранее, пока работали vvis и vrad
+    std::vector<std::pair<std::string, std::string>> preparedPakFiles;
+    std::vector<PakEntry> preparedPakEntries;
+    bool pakPrepared = false;
+
+    // Входы и выходы запуска для --depfile/--manifest; пустой хеш досчитывается при записи
+    struct TrackedFile
+    {
+        std::string hash;
+        uintmax_t size = 0;
+    };
+
+    std::map<std::string, TrackedFile> inputFiles;
+    std::set<std::string> outputFiles;
+    std::vector<std::string> pakEntries;
+
+    Journal journal;
+    std::string journalStage;
+    bool resumingJournal = false;       // этап продолжает прерванный запуск
+
+    OutputRegistry outputRegistry;      // ссылки карт игрового каталога на общие файлы
 
 public:
-    HammerCompiler(const std::string& vmfPath, const std::string& gameDir);
+    HammerCompiler(const std::string& vmfPath, const std::string& gameDir, const CompilerOptions& options = CompilerOptions(),
+        FileSystem& fileSystem = GetDiskFileSystem());
     bool ProcessVMF();
+    bool CheckVMF();
     bool ProcessModels();
     bool UpdateVMF();
 
@@ -220,14 +351,61 @@ public:
     bool SaveCreatedFilesList();
     bool DeleteCreatedFiles();
     bool ParseVMFForPostCompile();
-    bool AddFilesToBSP(const std::string& bspPath, const std::string& gameDir);
+    bool AddFilesToBSP(const std::string& bspPath);
+    bool PreparePakEntries();
     bool RestoreVMFAfterPostCompile();
+    bool PatchBSP(const std::string& bspPath);
+    std::string GetCompileVMFPath() const;
+    bool SavePakManifest();
+    bool OpenPakManifest();
+    std::string GetOverlayDir() const;
+    bool RemoveOverlay();
     std::string RestoreEntityContent(const std::string& entityContent);
+    bool WriteDepfile(const std::string& path, const std::string& target);
+    bool WriteManifest(const std::string& path, const std::string& stage);
+
+    // Журнал этапа: --resume продолжает прерванный, без него прерванный запуск - ошибка
+    bool BeginJournal(const std::string& stage);
+    void FinishJournal();
+    bool IsStepDone(const std::string& step) const { return journal.IsDone(step); }
+    void PlanStep(const std::string& step, const std::string& path);
+    void FinishStep(const std::string& step, const std::string& path);
+    bool Rollback();
+
+    static bool IsColoredModelPath(const std::string& modelPath, std::string* originalModelPath = nullptr);
 
 private:
     bool ParseVMF();
-    bool CopyModelFiles(const std::string& originalModelPath);
+    bool CheckAssets();
+    int MatchStaticProps(const StaticPropLump& staticProps, std::vector<std::pair<const EntityInfo*, size_t>>& matches);
+    int GetColorSkinIndex(const EntityInfo& entity);
+    std::string FindGameFile(const std::string& relativePath);
+    bool CopyModelFiles(const std::string& originalModelPath, IOQueue& io);
+    void PlanCreatedFile(const std::string& filePath);
+    int DeleteUnreferencedFiles(const std::vector<std::string>& files);
+    bool RevertInterruptedPak(bool revertCompleted);
+    void CollectPakFiles(std::vector<std::pair<std::string, std::string>>& files);
+    void CollectColoredAssets(std::vector<PakManifest::Model>& models);
+    bool PackFilesNative(const std::string& bspPath, const std::vector<std::pair<std::string, std::string>>& files);
+    bool ReadPakEntries(const std::vector<std::pair<std::string, std::string>>& files, std::vector<PakEntry>& entries);
+    void CompressNewEntries(std::vector<PakEntry>& entries);
+    bool PackFilesWithBSPZIP(const std::string& bspPath, const std::vector<std::pair<std::string, std::string>>& files);
+    bool ComputeModelFingerprint(const std::string& modelPath, const std::set<std::string>& colors, ModelFingerprint& fingerprint);
+    bool IsModelUpToDate(const std::string& modelPath, const ModelFingerprint& fingerprint);
+    bool LoadModelCache();
+    bool SaveModelCache();
+    bool LoadEntityCache();
+    bool SaveEntityCache();
+    bool IsCleanModelUpToDate(const std::string& modelPath, const std::set<std::string>& colors);
+    std::string PackColorList(const std::set<std::string>& colors);
+    std::string GetSourceStamp(const std::string& modelPath, const std::string& vmtPath);
+    std::string GetColoredModelPath(const std::string& modelPath);
+    std::string GetColoredMaterialName(const std::string& baseTexturePath, const std::string& modelName, size_t colorIndex, const std::string& color);
     std::string CreateVMTContent(const std::string& originalContent, const std::string& newBaseTexture, const std::string& color);
-    std::string ReadFileContent(const std::string& path);
+    void TrackInput(const std::string& path, const std::string& hash = "", uintmax_t size = 0);
+    void TrackInput(const std::string& path, const void* data, size_t size);
+    void TrackOutput(const std::string& path);
+    std::string HashFile(const std::string& path);
+    std::string ReadFileContent(const std::string& path, std::ios::openmode mode = std::ios::in);
     bool WriteFileContent(const std::string& path, const std::string& content);
 };
\ No newline at end of file
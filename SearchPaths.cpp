@@ -0,0 +1,288 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#include "SearchPaths.h"
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+std::string SearchPathIndex::NormalizePath(const std::string& path)
+{
+    std::string result = path;
+    for (char& c : result)
+    {
+        if (c == '\\')
+            c = '/';
+        else
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+
+    size_t start = 0;
+    while (result.compare(start, 2, "./") == 0)
+        start += 2;
+    return result.substr(start);
+}
+
+bool SearchPathIndex::IsArchiveRoot(const std::string& root)
+{
+    std::string lowerRoot = NormalizePath(root);
+    return lowerRoot.size() >= 8 && lowerRoot.compare(lowerRoot.size() - 8, 8, "_dir.vpk") == 0;
+}
+
+// Токены KeyValues: строки в кавычках, слова и скобки; комментарии // пропускаются
+static std::vector<std::string> TokenizeKeyValues(const std::string& content)
+{
+    std::vector<std::string> tokens;
+    size_t pos = 0;
+    while (pos < content.size())
+    {
+        char c = content[pos];
+        if (isspace(static_cast<unsigned char>(c)))
+        {
+            pos++;
+        }
+        else if (c == '/' && pos + 1 < content.size() && content[pos + 1] == '/')
+        {
+            pos = content.find('\n', pos);
+            if (pos == std::string::npos)
+                break;
+        }
+        else if (c == '{' || c == '}')
+        {
+            tokens.push_back(std::string(1, c));
+            pos++;
+        }
+        else if (c == '"')
+        {
+            size_t end = content.find('"', pos + 1);
+            if (end == std::string::npos)
+                end = content.size();
+            tokens.push_back(content.substr(pos + 1, end - pos - 1));
+            pos = end + 1;
+        }
+        else
+        {
+            size_t end = pos;
+            while (end < content.size() && !isspace(static_cast<unsigned char>(content[end]))
+                && content[end] != '{' && content[end] != '}' && content[end] != '"')
+                end++;
+            tokens.push_back(content.substr(pos, end - pos));
+            pos = end;
+        }
+    }
+    return tokens;
+}
+
+static bool IsGameSearchPath(const std::string& key)
+{
+    std::string lowerKey = SearchPathIndex::NormalizePath(key);
+    size_t start = 0;
+    while (start <= lowerKey.size())
+    {
+        size_t end = lowerKey.find('+', start);
+        if (end == std::string::npos)
+            end = lowerKey.size();
+        if (lowerKey.compare(start, end - start, "game") == 0)
+            return true;
+        start = end + 1;
+    }
+    return false;
+}
+
+void SearchPathIndex::AddRoot(const std::string& path)
+{
+    std::string root = fs::path(path).lexically_normal().generic_string();
+    while (root.size() > 1 && root.back() == '/')
+        root.pop_back();
+
+    if (std::find(roots.begin(), roots.end(), root) == roots.end())
+        roots.push_back(root);
+}
+
+bool SearchPathIndex::ParseGameInfo(const std::string& content, const std::string& gameDir)
+{
+    std::vector<std::string> tokens = TokenizeKeyValues(content);
+
+    auto block = std::find_if(tokens.begin(), tokens.end(),
+        [](const std::string& token) { return NormalizePath(token) == "searchpaths"; });
+    if (block == tokens.end() || block + 1 == tokens.end() || *(block + 1) != "{")
+        return false;
+
+    // |all_source_engine_paths| и относительные пути отсчитываются от каталога движка,
+    // в котором лежит каталог мода
+    std::string baseDir = fs::path(gameDir).lexically_normal().parent_path().generic_string();
+    if (baseDir.empty())
+        baseDir = ".";
+
+    for (auto it = block + 2; it != tokens.end() && *it != "}"; )
+    {
+        std::string key = *it++;
+        if (it == tokens.end() || *it == "}")
+            break;
+        std::string value = *it++;
+
+        // Условия вида [$WIN32] относятся к предыдущей паре
+        if (it != tokens.end() && !it->empty() && (*it)[0] == '[')
+            it++;
+
+        if (!IsGameSearchPath(key))
+            continue;
+
+        // "hl2/hl2_misc.vpk" в gameinfo.txt - это каталог архива hl2/hl2_misc_dir.vpk
+        std::string lowerValue = NormalizePath(value);
+        if (lowerValue.size() >= 4 && lowerValue.compare(lowerValue.size() - 4, 4, ".vpk") == 0
+            && !IsArchiveRoot(value))
+        {
+            value = value.substr(0, value.size() - 4) + "_dir.vpk";
+        }
+
+        std::string path;
+        if (value.compare(0, 15, "|gameinfo_path|") == 0)
+            path = gameDir + "/" + value.substr(15);
+        else if (value.compare(0, 25, "|all_source_engine_paths|") == 0)
+            path = baseDir + "/" + value.substr(25);
+        else if (fs::path(value).is_absolute())
+            path = value;
+        else
+            path = baseDir + "/" + value;
+
+        // custom/* подключает каждый подкаталог по алфавиту
+        if (path.size() >= 2 && path.compare(path.size() - 2, 2, "/*") == 0)
+        {
+            std::string parent = path.substr(0, path.size() - 2);
+            std::vector<std::string> subFiles;
+            std::vector<std::string> subDirectories;
+            if (fileSystem.ListDirectory(parent, subFiles, subDirectories))
+            {
+                std::sort(subDirectories.begin(), subDirectories.end());
+                for (const auto& directory : subDirectories)
+                    AddRoot(parent + "/" + directory);
+            }
+            continue;
+        }
+
+        AddRoot(path);
+    }
+
+    return true;
+}
+
+// Обход одного корня: пути файлов относительно корня
+void SearchPathIndex::IndexRoot(const std::string& root, std::vector<std::string>& relativePaths)
+{
+    std::vector<std::string> pending = { "" };
+    while (!pending.empty())
+    {
+        std::string relativeDir = pending.back();
+        pending.pop_back();
+
+        std::vector<std::string> fileNames;
+        std::vector<std::string> directoryNames;
+        if (!fileSystem.ListDirectory(relativeDir.empty() ? root : root + "/" + relativeDir, fileNames, directoryNames))
+            continue;
+
+        std::string prefix = relativeDir.empty() ? "" : relativeDir + "/";
+        for (const auto& name : fileNames)
+            relativePaths.push_back(prefix + name);
+        for (const auto& name : directoryNames)
+            pending.push_back(prefix + name);
+    }
+}
+
+bool SearchPathIndex::Build(const std::string& gameDir, unsigned int threadCount)
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    roots.clear();
+    files.clear();
+
+    std::string gameInfoPath = gameDir + "/gameinfo.txt";
+    std::vector<unsigned char> gameInfo;
+    if (!fileSystem.Read(gameInfoPath, gameInfo)
+        || !ParseGameInfo(std::string(gameInfo.begin(), gameInfo.end()), gameDir))
+    {
+        std::cout << "No SearchPaths in " << gameInfoPath << ", using the game directory only" << std::endl;
+    }
+
+    // Каталог мода ищется всегда, даже если gameinfo.txt его не перечисляет
+    AddRoot(gameDir);
+
+    // Как и движок, каталог поискового пути подключает лежащий в нём pak01_dir.vpk
+    std::vector<std::string> listedRoots;
+    listedRoots.swap(roots);
+    for (const auto& root : listedRoots)
+    {
+        AddRoot(root);
+        if (!IsArchiveRoot(root) && fileSystem.Exists(root + "/pak01_dir.vpk"))
+            AddRoot(root + "/pak01_dir.vpk");
+    }
+
+    std::vector<std::vector<std::string>> rootFiles(roots.size());
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min<unsigned int>(threadCount, static_cast<unsigned int>(roots.size()));
+
+    std::atomic<size_t> nextRoot{ 0 };
+    auto worker = [&]()
+    {
+        for (size_t i = nextRoot++; i < roots.size(); i = nextRoot++)
+        {
+            IndexRoot(roots[i], rootFiles[i]);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < threadCount; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads)
+        thread.join();
+
+    // Слияние в порядке поисковых путей: первый найденный файл побеждает.
+    // Сначала каталоги, потом архивы: распакованный файл перекрывает файл из VPK
+    size_t totalCount = 0;
+    for (const auto& list : rootFiles)
+        totalCount += list.size();
+    files.reserve(totalCount);
+
+    size_t archiveCount = 0;
+    for (bool archives : { false, true })
+    {
+        for (size_t i = 0; i < roots.size(); i++)
+        {
+            if (IsArchiveRoot(roots[i]) != archives)
+                continue;
+
+            archiveCount += archives;
+            for (const auto& relativePath : rootFiles[i])
+            {
+                files.emplace(NormalizePath(relativePath), roots[i] + "/" + relativePath);
+            }
+        }
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime);
+    std::cout << "Indexed " << files.size() << " files in " << roots.size() << " search paths ("
+        << archiveCount << " VPK) in " << elapsed.count() << " ms" << std::endl;
+    for (const auto& root : roots)
+    {
+        std::cout << "  Search path: " << root << std::endl;
+    }
+    return true;
+}
+
+const std::string* SearchPathIndex::Find(const std::string& relativePath) const
+{
+    auto it = files.find(NormalizePath(relativePath));
+    return it != files.end() ? &it->second : nullptr;
+}
@@ -0,0 +1,50 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+#include "FileSystem.h"
+
+// Поисковые пути игры из блока SearchPaths файла gameinfo.txt:
+// https://developer.valvesoftware.com/wiki/Gameinfo.txt#SearchPaths
+//
+// Учитываются пути с идентификатором game: |gameinfo_path|, |all_source_engine_paths|,
+// относительные пути от каталога движка, шаблоны вида custom/* и архивы VPK (через
+// VPKFileSystem архив выглядит как каталог *_dir.vpk). Все файлы всех путей один раз
+// заносятся в хеш-таблицу (каждый корень обходится в своём потоке), после чего поиск
+// модели или материала - одна проба таблицы. Распакованный файл всегда побеждает файл
+// из архива, среди путей одного вида побеждает более ранний.
+class SearchPathIndex
+{
+private:
+    FileSystem& fileSystem;
+    std::vector<std::string> roots;
+    std::unordered_map<std::string, std::string> files;    // нормализованный путь -> путь на диске
+
+public:
+    explicit SearchPathIndex(FileSystem& fileSystem) : fileSystem(fileSystem) {}
+
+    bool Build(const std::string& gameDir, unsigned int threadCount = 0);
+
+    // Путь на диске для пути относительно игры или nullptr, если файла нет
+    const std::string* Find(const std::string& relativePath) const;
+
+    const std::vector<std::string>& GetRoots() const { return roots; }
+    size_t GetFileCount() const { return files.size(); }
+
+    static std::string NormalizePath(const std::string& path);
+    static bool IsArchiveRoot(const std::string& root);
+
+private:
+    bool ParseGameInfo(const std::string& content, const std::string& gameDir);
+    void AddRoot(const std::string& path);
+    void IndexRoot(const std::string& root, std::vector<std::string>& relativePaths);
+};
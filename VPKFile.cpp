@@ -0,0 +1,484 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#include "VPKFile.h"
+
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+
+std::string VPKArchive::NormalizePath(const std::string& path)
+{
+    std::string result = path;
+    for (char& c : result)
+    {
+        if (c == '\\')
+            c = '/';
+        else
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+
+    size_t start = result.find_first_not_of('/');
+    return start == std::string::npos ? std::string() : result.substr(start);
+}
+
+bool VPKArchive::Open(const std::string& path)
+{
+    dirPath = path;
+    chunkPrefix = path.substr(0, path.size() - 7);     // "pak01_dir.vpk" -> "pak01_"
+
+    dirView = std::make_shared<FileView>();
+    if (!fileSystem.Map(dirPath, *dirView))
+    {
+        std::cout << "Error: Cannot open VPK file " << dirPath << std::endl;
+        return false;
+    }
+
+    const unsigned char* data = dirView->GetData();
+    size_t size = dirView->GetSize();
+    if (size < sizeof(VPKHeader))
+    {
+        std::cout << "Error: VPK file is too small: " << dirPath << std::endl;
+        return false;
+    }
+
+    VPKHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.signature != VPK_SIGNATURE)
+    {
+        std::cout << "Error: Invalid VPK signature: " << dirPath << std::endl;
+        return false;
+    }
+
+    size_t headerSize = sizeof(VPKHeader);
+    if (header.version == 2)
+        headerSize += sizeof(VPKHeaderV2Extra);
+    else if (header.version != 1)
+    {
+        std::cout << "Error: Unsupported VPK version " << header.version << ": " << dirPath << std::endl;
+        return false;
+    }
+
+    if (headerSize + header.treeSize > size)
+    {
+        std::cout << "Error: VPK directory tree is out of file bounds: " << dirPath << std::endl;
+        return false;
+    }
+
+    dataOffset = headerSize + header.treeSize;
+
+    FileInfo info;
+    if (fileSystem.Stat(dirPath, info))
+        mtime = info.mtime;
+
+    entries.clear();
+    directories.clear();
+    directories[""];
+
+    if (!ParseTree(data + headerSize, header.treeSize))
+    {
+        std::cout << "Error: Corrupted VPK directory tree: " << dirPath << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Дерево: расширение -> каталог -> имя файла, каждый уровень заканчивается пустой строкой.
+// " " вместо каталога или расширения означает их отсутствие.
+bool VPKArchive::ParseTree(const unsigned char* tree, size_t treeSize)
+{
+    size_t pos = 0;
+    auto readString = [&](std::string& value) -> bool
+    {
+        const void* end = memchr(tree + pos, 0, treeSize - pos);
+        if (!end)
+            return false;
+
+        size_t length = static_cast<const unsigned char*>(end) - (tree + pos);
+        value.assign(reinterpret_cast<const char*>(tree + pos), length);
+        pos += length + 1;
+        return true;
+    };
+
+    std::string extension;
+    std::string directory;
+    std::string name;
+    while (true)
+    {
+        if (!readString(extension))
+            return false;
+        if (extension.empty())
+            break;
+
+        while (true)
+        {
+            if (!readString(directory))
+                return false;
+            if (directory.empty())
+                break;
+
+            while (true)
+            {
+                if (!readString(name))
+                    return false;
+                if (name.empty())
+                    break;
+
+                VPKDirectoryEntry raw;
+                if (pos + sizeof(raw) > treeSize)
+                    return false;
+                memcpy(&raw, tree + pos, sizeof(raw));
+                pos += sizeof(raw);
+
+                if (raw.terminator != VPK_ENTRY_TERMINATOR || pos + raw.preloadBytes > treeSize)
+                    return false;
+
+                Entry entry;
+                entry.archiveIndex = raw.archiveIndex;
+                entry.offset = raw.entryOffset;
+                entry.length = raw.entryLength;
+                entry.preload = raw.preloadBytes ? tree + pos : nullptr;
+                entry.preloadBytes = raw.preloadBytes;
+                pos += raw.preloadBytes;
+
+                std::string path = directory == " " ? name : directory + "/" + name;
+                if (extension != " ")
+                    path += "." + extension;
+
+                path = NormalizePath(path);
+                if (entries.emplace(path, entry).second)
+                    AddToDirectory(path);
+            }
+        }
+    }
+
+    return true;
+}
+
+void VPKArchive::AddToDirectory(const std::string& path)
+{
+    size_t slash = path.find_last_of('/');
+    std::string parent = slash == std::string::npos ? "" : path.substr(0, slash);
+
+    // Недостающие каталоги цепочки заносятся в своих родителей
+    std::string current = parent;
+    std::string childName;
+    while (true)
+    {
+        auto [it, inserted] = directories.try_emplace(current);
+        if (!childName.empty())
+            it->second.directories.push_back(childName);
+        if (!inserted || current.empty())
+            break;
+
+        size_t separator = current.find_last_of('/');
+        childName = separator == std::string::npos ? current : current.substr(separator + 1);
+        current = separator == std::string::npos ? "" : current.substr(0, separator);
+    }
+
+    directories[parent].files.push_back(path.substr(slash + 1));
+}
+
+const VPKArchive::Entry* VPKArchive::FindEntry(const std::string& path) const
+{
+    auto it = entries.find(NormalizePath(path));
+    return it != entries.end() ? &it->second : nullptr;
+}
+
+const VPKArchive::Directory* VPKArchive::FindDirectory(const std::string& path) const
+{
+    auto it = directories.find(NormalizePath(path));
+    return it != directories.end() ? &it->second : nullptr;
+}
+
+std::shared_ptr<const FileView> VPKArchive::GetChunk(const Entry& entry, size_t& offset)
+{
+    if (entry.archiveIndex == VPK_DIR_ARCHIVE_INDEX)
+    {
+        offset = dataOffset + entry.offset;
+        return dirView;
+    }
+
+    offset = entry.offset;
+
+    std::lock_guard<std::mutex> lock(chunkMutex);
+    auto it = chunks.find(entry.archiveIndex);
+    if (it != chunks.end())
+        return it->second;
+
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "%03u.vpk", static_cast<unsigned int>(entry.archiveIndex));
+
+    std::shared_ptr<FileView> chunk = std::make_shared<FileView>();
+    if (!fileSystem.Map(chunkPrefix + suffix, *chunk))
+    {
+        std::cout << "Error: Cannot open VPK archive " << chunkPrefix + suffix << std::endl;
+        chunk.reset();
+    }
+
+    chunks[entry.archiveIndex] = chunk;
+    return chunk;
+}
+
+VPKArchive* VPKFileSystem::FindArchive(const std::string& path, std::string& entryPath, bool archiveRoot)
+{
+    // Ищем компонент пути, который заканчивается на _dir.vpk
+    std::string normalized = VPKArchive::NormalizePath(path);
+    size_t offset = path.size() - normalized.size();
+    size_t end = std::string::npos;
+    for (size_t pos = normalized.find("_dir.vpk"); pos != std::string::npos; pos = normalized.find("_dir.vpk", pos + 1))
+    {
+        if (pos + 8 == normalized.size() || normalized[pos + 8] == '/')
+        {
+            end = pos + 8;
+            break;
+        }
+    }
+
+    if (end == std::string::npos)
+        return nullptr;
+
+    entryPath = end < normalized.size() ? normalized.substr(end + 1) : "";
+    if (entryPath.empty() && !archiveRoot)
+        return nullptr;
+
+    std::string archiveKey = normalized.substr(0, end);
+
+    std::lock_guard<std::mutex> lock(archiveMutex);
+    auto it = archives.find(archiveKey);
+    if (it != archives.end())
+        return it->second.get();
+
+    std::unique_ptr<VPKArchive> archive = std::make_unique<VPKArchive>(inner);
+    if (archive->Open(path.substr(0, offset + end)))
+    {
+        std::cout << "Mounted VPK: " << path.substr(0, offset + end) << " (" << archive->GetEntryCount() << " files)" << std::endl;
+    }
+    else
+    {
+        archive.reset();
+    }
+
+    VPKArchive* result = archive.get();
+    archives[archiveKey] = std::move(archive);
+    return result;
+}
+
+bool VPKFileSystem::Exists(const std::string& path)
+{
+    std::string entryPath;
+    VPKArchive* archive = FindArchive(path, entryPath);
+    if (!archive)
+        return inner.Exists(path);
+
+    return archive->FindEntry(entryPath) || archive->FindDirectory(entryPath);
+}
+
+bool VPKFileSystem::Stat(const std::string& path, FileInfo& info)
+{
+    std::string entryPath;
+    VPKArchive* archive = FindArchive(path, entryPath);
+    if (!archive)
+        return inner.Stat(path, info);
+
+    // Время изменения у всех файлов архива одно - время его каталога
+    info.mtime = archive->GetModificationTime();
+    if (const VPKArchive::Entry* entry = archive->FindEntry(entryPath))
+    {
+        info.size = entry->preloadBytes + entry->length;
+        info.isDirectory = false;
+        return true;
+    }
+
+    info.size = 0;
+    info.isDirectory = true;
+    return archive->FindDirectory(entryPath) != nullptr;
+}
+
+bool VPKFileSystem::Read(const std::string& path, std::vector<unsigned char>& data)
+{
+    std::string entryPath;
+    if (!FindArchive(path, entryPath))
+        return inner.Read(path, data);
+
+    FileView view;
+    if (!Map(path, view))
+        return false;
+
+    data.assign(view.GetData(), view.GetData() + view.GetSize());
+    return true;
+}
+
+bool VPKFileSystem::Map(const std::string& path, FileView& view)
+{
+    std::string entryPath;
+    VPKArchive* archive = FindArchive(path, entryPath);
+    if (!archive)
+        return inner.Map(path, view);
+
+    const VPKArchive::Entry* entry = archive->FindEntry(entryPath);
+    if (!entry)
+        return false;
+
+    view.Close();
+
+    // Маленькие файлы целиком лежат в дереве каталога
+    if (entry->length == 0)
+    {
+        view.source = archive->GetDirectoryView();
+        view.data = entry->preload;
+        view.size = entry->preloadBytes;
+        return true;
+    }
+
+    size_t offset = 0;
+    std::shared_ptr<const FileView> chunk = archive->GetChunk(*entry, offset);
+    if (!chunk || offset + entry->length > chunk->GetSize())
+    {
+        std::cout << "Error: VPK entry is out of archive bounds: " << path << std::endl;
+        return false;
+    }
+
+    if (entry->preloadBytes == 0)
+    {
+        view.source = chunk;
+        view.data = chunk->GetData() + offset;
+        view.size = entry->length;
+        return true;
+    }
+
+    // Начало файла в дереве, остальное в части архива: без копии не склеить
+    auto buffer = std::make_shared<std::vector<unsigned char>>();
+    buffer->reserve(entry->preloadBytes + entry->length);
+    buffer->insert(buffer->end(), entry->preload, entry->preload + entry->preloadBytes);
+    buffer->insert(buffer->end(), chunk->GetData() + offset, chunk->GetData() + offset + entry->length);
+
+    view.buffer = buffer;
+    view.data = buffer->data();
+    view.size = buffer->size();
+    return true;
+}
+
+std::unique_ptr<FileWriter> VPKFileSystem::OpenWrite(const std::string& path)
+{
+    std::string entryPath;
+    if (!FindArchive(path, entryPath))
+        return inner.OpenWrite(path);
+
+    std::cout << "Error: Cannot write into VPK archive: " << path << std::endl;
+    return nullptr;
+}
+
+bool VPKFileSystem::Copy(const std::string& source, const std::string& destination)
+{
+    std::string entryPath;
+    if (FindArchive(destination, entryPath))
+    {
+        std::cout << "Error: Cannot write into VPK archive: " << destination << std::endl;
+        return false;
+    }
+
+    if (!FindArchive(source, entryPath))
+        return inner.Copy(source, destination);
+
+    // Из архива копия пишется прямо из отображения
+    FileView view;
+    if (!Map(source, view))
+    {
+        std::cout << "Failed to copy file: " << source << " - not found" << std::endl;
+        return false;
+    }
+
+    return inner.Write(destination, view.GetData(), view.GetSize());
+}
+
+bool VPKFileSystem::Remove(const std::string& path)
+{
+    std::string entryPath;
+    return !FindArchive(path, entryPath) && inner.Remove(path);
+}
+
+uintmax_t VPKFileSystem::RemoveAll(const std::string& path)
+{
+    std::string entryPath;
+    return FindArchive(path, entryPath) ? 0 : inner.RemoveAll(path);
+}
+
+bool VPKFileSystem::Rename(const std::string& from, const std::string& to)
+{
+    std::string entryPath;
+    if (FindArchive(from, entryPath) || FindArchive(to, entryPath))
+    {
+        std::cout << "Error: Cannot write into VPK archive: " << to << std::endl;
+        return false;
+    }
+
+    return inner.Rename(from, to);
+}
+
+bool VPKFileSystem::CreateDirectories(const std::string& path)
+{
+    std::string entryPath;
+    return !FindArchive(path, entryPath) && inner.CreateDirectories(path);
+}
+
+bool VPKFileSystem::ListDirectory(const std::string& path, std::vector<std::string>& files, std::vector<std::string>& directories)
+{
+    std::string entryPath;
+    VPKArchive* archive = FindArchive(path, entryPath, true);
+    if (!archive)
+        return inner.ListDirectory(path, files, directories);
+
+    const VPKArchive::Directory* directory = archive->FindDirectory(entryPath);
+    if (!directory)
+        return false;
+
+    files.insert(files.end(), directory->files.begin(), directory->files.end());
+    directories.insert(directories.end(), directory->directories.begin(), directory->directories.end());
+    return true;
+}
+
+bool VPKFileSystem::ScanDirectory(const std::string& path, std::vector<DirectoryEntry>& entries)
+{
+    std::string entryPath;
+    if (!FindArchive(path, entryPath, true))
+        return inner.ScanDirectory(path, entries);
+
+    // Внутри архива метаданные уже в памяти
+    return FileSystem::ScanDirectory(path, entries);
+}
+
+// Файлы из архивов отдаются из отображения, остальная пачка уходит вложенной системе целиком
+void VPKFileSystem::ReadBatch(std::vector<ReadRequest>& requests)
+{
+    std::vector<ReadRequest> innerRequests;
+    std::vector<size_t> innerIndices;
+    for (size_t i = 0; i < requests.size(); i++)
+    {
+        std::string entryPath;
+        if (FindArchive(requests[i].path, entryPath))
+        {
+            requests[i].result = Read(requests[i].path, requests[i].data);
+            continue;
+        }
+
+        innerRequests.push_back(ReadRequest());
+        innerRequests.back().path = requests[i].path;
+        innerIndices.push_back(i);
+    }
+
+    if (innerRequests.empty())
+        return;
+
+    inner.ReadBatch(innerRequests);
+    for (size_t i = 0; i < innerRequests.size(); i++)
+    {
+        requests[innerIndices[i]].data = std::move(innerRequests[i].data);
+        requests[innerIndices[i]].result = innerRequests[i].result;
+    }
+}
@@ -0,0 +1,144 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+#include "FileSystem.h"
+
+// VPK:
+// https://developer.valvesoftware.com/wiki/VPK_(file_format)
+//
+#define VPK_SIGNATURE           0x55aa1234
+#define VPK_DIR_ARCHIVE_INDEX   0x7fff      // данные лежат в самом _dir.vpk после дерева
+#define VPK_ENTRY_TERMINATOR    0xffff
+
+#pragma pack(push, 1)
+
+struct VPKHeader
+{
+    uint32_t signature;
+    uint32_t version;
+    uint32_t treeSize;
+};
+
+// Версия 2 добавляет размеры разделов после дерева
+struct VPKHeaderV2Extra
+{
+    uint32_t fileDataSectionSize;
+    uint32_t archiveMD5SectionSize;
+    uint32_t otherMD5SectionSize;
+    uint32_t signatureSectionSize;
+};
+
+struct VPKDirectoryEntry
+{
+    uint32_t crc32;
+    uint16_t preloadBytes;
+    uint16_t archiveIndex;
+    uint32_t entryOffset;
+    uint32_t entryLength;
+    uint16_t terminator;
+};
+
+#pragma pack(pop)
+
+// Каталог одного архива (*_dir.vpk): дерево разбирается один раз в хеш-таблицу
+// путь -> (номер части, смещение, размер), части архива отображаются в память при
+// первом обращении. Данные файлов отдаются прямо из отображения, без копирования.
+class VPKArchive
+{
+public:
+    struct Entry
+    {
+        uint16_t archiveIndex = 0;
+        uint32_t offset = 0;            // в части архива или от конца дерева для VPK_DIR_ARCHIVE_INDEX
+        uint32_t length = 0;
+        const unsigned char* preload = nullptr;
+        uint16_t preloadBytes = 0;
+    };
+
+    struct Directory
+    {
+        std::vector<std::string> files;
+        std::vector<std::string> directories;
+    };
+
+private:
+    FileSystem& fileSystem;
+    std::string dirPath;
+    std::string chunkPrefix;            // путь без "dir.vpk": к нему добавляется "000.vpk"
+    std::shared_ptr<FileView> dirView;
+    size_t dataOffset = 0;              // начало данных внутри _dir.vpk
+    int64_t mtime = 0;
+
+    std::unordered_map<std::string, Entry> entries;         // нормализованный путь внутри архива
+    std::unordered_map<std::string, Directory> directories; // "" - корень архива
+
+    std::mutex chunkMutex;
+    std::map<uint16_t, std::shared_ptr<FileView>> chunks;
+
+public:
+    explicit VPKArchive(FileSystem& fileSystem) : fileSystem(fileSystem) {}
+
+    bool Open(const std::string& dirPath);
+
+    const Entry* FindEntry(const std::string& path) const;
+    const Directory* FindDirectory(const std::string& path) const;
+    size_t GetEntryCount() const { return entries.size(); }
+    int64_t GetModificationTime() const { return mtime; }
+    std::shared_ptr<const FileView> GetDirectoryView() const { return dirView; }
+
+    // Вид части архива, в которой лежат данные записи, и смещение в нём
+    std::shared_ptr<const FileView> GetChunk(const Entry& entry, size_t& offset);
+
+    static std::string NormalizePath(const std::string& path);
+
+private:
+    bool ParseTree(const unsigned char* tree, size_t treeSize);
+    void AddToDirectory(const std::string& path);
+};
+
+// Архивы как каталоги только для чтения поверх другой файловой системы:
+// путь "hl2/hl2_misc_dir.vpk/models/props/crate.mdl" читается из архива,
+// всё остальное передаётся вложенной файловой системе. Архив открывается
+// при первом обращении к его пути.
+class VPKFileSystem : public FileSystem
+{
+private:
+    FileSystem& inner;
+    std::mutex archiveMutex;
+    std::map<std::string, std::unique_ptr<VPKArchive>> archives;   // nullptr - архив не открылся
+
+public:
+    explicit VPKFileSystem(FileSystem& inner) : inner(inner) {}
+
+    bool Exists(const std::string& path) override;
+    bool Stat(const std::string& path, FileInfo& info) override;
+    bool Read(const std::string& path, std::vector<unsigned char>& data) override;
+    bool Map(const std::string& path, FileView& view) override;
+    std::unique_ptr<FileWriter> OpenWrite(const std::string& path) override;
+    bool Copy(const std::string& source, const std::string& destination) override;
+    bool Remove(const std::string& path) override;
+    uintmax_t RemoveAll(const std::string& path) override;
+    bool Rename(const std::string& from, const std::string& to) override;
+    bool CreateDirectories(const std::string& path) override;
+    bool ListDirectory(const std::string& path, std::vector<std::string>& files, std::vector<std::string>& directories) override;
+    bool ScanDirectory(const std::string& path, std::vector<DirectoryEntry>& entries) override;
+    void ReadBatch(std::vector<ReadRequest>& requests) override;
+
+private:
+    // archiveRoot = true: путь может указывать на сам архив (корень его каталога)
+    VPKArchive* FindArchive(const std::string& path, std::string& entryPath, bool archiveRoot = false);
+};
@@ -81,6 +81,32 @@ enum class clr : uint8_t {
     on_black = 0xF1,
     reset = 0xFF,
 };
+#else
+// Коды ANSI для терминалов Linux и macOS
+enum class clr : uint8_t {
+    red = 91,
+    yellow = 93,
+    green = 92,
+    cyan = 96,
+    blue = 94,
+    magenta = 95,
+    white = 97,
+    gray = 37,
+    darkgray = 90,
+    black = 30,
+    on_red = 41,
+    on_yellow = 103,
+    on_green = 42,
+    on_cyan = 46,
+    on_blue = 44,
+    on_magenta = 45,
+    on_white = 107,
+    on_gray = 47,
+    on_darkgray = 100,
+    on_black = 40,
+    reset = 0,
+};
+#endif
 
 #if defined(_WIN32)
 namespace colored_cout_impl {
@@ -161,6 +187,4 @@ type& operator<<(type& ostream, const clr color) {
 #     endif
     }
     return ostream;
-}
-
-#endif // COLORED_COUT_H
\ No newline at end of file
+}
\ No newline at end of file
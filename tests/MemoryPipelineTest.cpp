@@ -0,0 +1,129 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#include "PropColorCompiler.h"
+#include "TestFiles.h"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+static bool failed = false;
+
+static void Check(bool condition, const std::string& message)
+{
+    if (!condition)
+    {
+        std::cout << "Error: " << message << std::endl;
+        failed = true;
+    }
+}
+
+static void StoreText(MemoryFileSystem& memory, const std::string& path, const std::string& text)
+{
+    memory.Store(path, std::vector<unsigned char>(text.begin(), text.end()));
+}
+
+static std::string ReadText(MemoryFileSystem& memory, const std::string& path)
+{
+    std::vector<unsigned char> data;
+    memory.Read(path, data);
+    return std::string(data.begin(), data.end());
+}
+
+static std::string MakePropEntity(int id, const std::string& color, const std::string& origin)
+{
+    return "entity\n{\n\t\"id\" \"" + std::to_string(id) + "\"\n\t\"classname\" \"prop_static\"\n"
+        "\t\"angles\" \"0 0 0\"\n\t\"model\" \"models/props/crate.mdl\"\n"
+        "\t\"rendercolor\" \"" + color + "\"\n\t\"origin\" \"" + origin + "\"\n}\n";
+}
+
+// Весь первый шаг и упаковка идут через MemoryFileSystem: модели, материалы,
+// VMF и overlay живут в памяти, на диске только BSP (BSPFile отображает файл)
+int main()
+{
+    MemoryFileSystem memory;
+    memory.Store("game/models/props/crate.mdl", MakeTestModel("props/crate01", "props/"));
+    for (const char* ext : { ".vvd", ".dx90.vtx", ".phy" })
+    {
+        StoreText(memory, std::string("game/models/props/crate") + ext, std::string("crate") + ext);
+    }
+    StoreText(memory, "game/materials/props/crate01.vmt", "\"VertexLitGeneric\"\n{\n\t\"$basetexture\" \"props/crate01\"\n}\n");
+
+    std::string vmf = "versioninfo\n{\n\t\"editorversion\" \"400\"\n}\nworld\n{\n\t\"id\" \"1\"\n\t\"classname\" \"worldspawn\"\n}\n";
+    vmf += MakePropEntity(2, "255 0 0", "0 0 0");
+    vmf += MakePropEntity(3, "0 255 0", "64 0 0");
+    StoreText(memory, "mapsrc/test.vmf", vmf);
+
+    ZipEndOfCentralDirectory emptyPak = {};
+    emptyPak.signature = 0x06054b50;
+    std::vector<unsigned char> pakData(reinterpret_cast<const unsigned char*>(&emptyPak),
+        reinterpret_cast<const unsigned char*>(&emptyPak) + sizeof(emptyPak));
+    std::vector<unsigned char> bspData = MakeTestBSP(pakData);
+
+    std::string bspPath = MakeTempPath((fs::temp_directory_path() / "propcolor_pipeline.bsp").string());
+    {
+        std::ofstream bspFile(bspPath, std::ios::binary);
+        bspFile.write(reinterpret_cast<const char*>(bspData.data()), bspData.size());
+    }
+
+    CompilerOptions options;
+    options.overlay = true;
+    options.hashNames = true;
+
+    HammerCompiler compiler("mapsrc/test.vmf", "game", options, memory);
+    Check(compiler.ProcessVMF(), "ProcessVMF failed");
+    Check(compiler.AddFilesToBSP(bspPath), "AddFilesToBSP failed");
+
+    std::string coloredVmf = ReadText(memory, "mapsrc/test.vmf");
+    Check(coloredVmf.find("models/props/crate_colored_") != std::string::npos, "VMF does not reference the colored model");
+    Check(memory.Exists(compiler.GetOverlayDir() + "/models/props"), "Colored model is not staged in the overlay");
+
+    BSPFile bsp;
+    PakFile pak;
+    Check(bsp.Load(bspPath) && bsp.ReadPakfile(pak), "Packed BSP cannot be read");
+
+    int modelCount = 0;
+    int companionCount = 0;
+    int materialCount = 0;
+    for (const auto& entry : pak.GetEntries())
+    {
+        std::string content(entry.data.begin(), entry.data.end());
+        if (entry.name.rfind("models/props/crate_colored_", 0) != 0 && entry.name.rfind("materials/props/crate01_color_", 0) != 0)
+        {
+            Check(false, "Unexpected pak entry " + entry.name);
+        }
+        else if (entry.name.size() > 4 && entry.name.compare(entry.name.size() - 4, 4, ".mdl") == 0)
+        {
+            modelCount++;
+        }
+        else if (entry.name.size() > 4 && entry.name.compare(entry.name.size() - 4, 4, ".vmt") == 0)
+        {
+            materialCount++;
+            Check(content.find("\"$color2\"") != std::string::npos, "Colored material has no $color2: " + entry.name);
+        }
+        else
+        {
+            companionCount++;
+        }
+    }
+
+    Check(modelCount == 1, "Expected 1 colored model in pak, got " + std::to_string(modelCount));
+    Check(companionCount == 3, "Expected 3 companion files in pak, got " + std::to_string(companionCount));
+    Check(materialCount == 2, "Expected 2 colored materials in pak, got " + std::to_string(materialCount));
+
+    // Ничего из игрового каталога и VMF не должно оказаться на диске
+    Check(!fs::exists("game") && !fs::exists("mapsrc"), "Pipeline wrote to disk");
+
+    bsp.Close();
+    std::error_code error;
+    fs::remove(bspPath, error);
+
+    return failed ? 1 : 0;
+}
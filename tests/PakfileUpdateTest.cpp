@@ -0,0 +1,117 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#include "BSPFile.h"
+#include "FileSystem.h"
+#include "TestFiles.h"
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+static bool failed = false;
+
+static void Check(bool condition, const std::string& message)
+{
+    if (!condition)
+    {
+        std::cout << "Error: " << message << std::endl;
+        failed = true;
+    }
+}
+
+static std::vector<unsigned char> MakeData(const std::string& text)
+{
+    return std::vector<unsigned char>(text.begin(), text.end());
+}
+
+static std::vector<unsigned char> ReadAll(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<unsigned char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// Замена средней записи pak на месте: первая запись остаётся на своём месте, последняя
+// сдвигается на место заменённой, новая дописывается в конец; откат возвращает исходные байты
+int main()
+{
+    PakFile original;
+    original.AddOrReplace("materials/a.vmt", MakeData("first entry"));
+    original.AddOrReplace("materials/b.vmt", MakeData("middle entry, replaced by the test"));
+    original.AddOrReplace("materials/c.vmt", MakeData("last entry"));
+    std::vector<unsigned char> pakData = original.Serialize();
+    std::vector<unsigned char> bspData = MakeTestBSP(pakData);
+
+    // Смещения записей до обновления
+    PakFile parsedOriginal;
+    Check(parsedOriginal.Parse(pakData.data(), pakData.size()), "Original pakfile cannot be parsed");
+    const PakEntry* firstBefore = parsedOriginal.FindEntry("materials/a.vmt");
+    const PakEntry* middleBefore = parsedOriginal.FindEntry("materials/b.vmt");
+    Check(firstBefore && middleBefore, "Original pakfile lost entries");
+    if (failed)
+        return 1;
+
+    std::string bspPath = MakeTempPath((fs::temp_directory_path() / "propcolor_pakfile.bsp").string());
+    {
+        std::ofstream bspFile(bspPath, std::ios::binary);
+        bspFile.write(reinterpret_cast<const char*>(bspData.data()), bspData.size());
+    }
+
+    std::vector<unsigned char> undo;
+    std::vector<unsigned char> replacement = MakeData("replacement for the middle entry");
+    {
+        BSPFile bsp;
+        Check(bsp.Load(bspPath), "Test BSP cannot be loaded");
+        Check(bsp.IsPakfileLastLump(), "Pakfile is not the last lump of the test BSP");
+
+        size_t bytesWritten = 0;
+        PakfileUndoCallback saveUndo = [&undo](const std::vector<unsigned char>& data) { undo = data; return true; };
+        Check(bsp.UpdatePakfileInPlace({ PakFile::MakeEntry("materials/b.vmt", replacement) }, bytesWritten, saveUndo),
+            "UpdatePakfileInPlace failed");
+        Check(!undo.empty(), "Undo data was not saved");
+    }
+
+    {
+        BSPFile bsp;
+        PakFile pak;
+        Check(bsp.Load(bspPath) && bsp.ReadPakfile(pak), "Updated BSP cannot be read");
+
+        const BSPLump& pakLump = bsp.GetHeader().lumps[LUMP_PAKFILE];
+        Check(static_cast<uintmax_t>(pakLump.fileofs) + pakLump.filelen == fs::file_size(bspPath), "BSP size does not end at the pakfile");
+
+        const std::vector<PakEntry>& entries = pak.GetEntries();
+        Check(entries.size() == 3, "Expected 3 pak entries, got " + std::to_string(entries.size()));
+        if (entries.size() == 3)
+        {
+            const char* names[] = { "materials/a.vmt", "materials/c.vmt", "materials/b.vmt" };
+            const char* contents[] = { "first entry", "last entry", "replacement for the middle entry" };
+            for (size_t i = 0; i < entries.size(); i++)
+            {
+                Check(entries[i].name == names[i], "Unexpected pak entry order: " + entries[i].name);
+                Check(entries[i].data == MakeData(contents[i]), "Wrong data for " + entries[i].name);
+                Check(entries[i].crc32 == CRC32(entries[i].data.data(), entries[i].data.size()), "Wrong CRC for " + entries[i].name);
+            }
+
+            // Записи лежат подряд: нетронутая на старом месте, сдвинутая на месте заменённой
+            Check(entries[0].localHeaderOffset == firstBefore->localHeaderOffset, "Untouched entry moved");
+            Check(entries[1].localHeaderOffset == middleBefore->localHeaderOffset, "Shifted entry is not at the replaced offset");
+            Check(entries[2].localHeaderOffset == entries[1].localHeaderOffset + entries[1].recordSize, "New entry does not follow the shifted one");
+            Check(pak.GetCentralDirectoryOffset() == entries[2].localHeaderOffset + entries[2].recordSize, "Central directory does not follow the entries");
+        }
+    }
+
+    Check(BSPFile::RevertPakfileUpdate(bspPath, undo), "RevertPakfileUpdate failed");
+    Check(ReadAll(bspPath) == bspData, "Reverted BSP differs from the original");
+
+    std::error_code error;
+    fs::remove(bspPath, error);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,104 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#include "BSPFile.h"
+
+#include <iostream>
+#include <cstring>
+
+// Ламп sprp из одной модели и двух пропов; поле по смещению 64 заполнено маркером
+static std::vector<unsigned char> MakeLump(size_t propSize, std::vector<unsigned char>& marker)
+{
+    std::vector<unsigned char> data;
+    auto appendInt = [&data](int value)
+    {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+        data.insert(data.end(), bytes, bytes + sizeof(value));
+    };
+
+    appendInt(1);
+    std::vector<unsigned char> name(128, 0);
+    memcpy(name.data(), "models/props/test.mdl", 21);
+    data.insert(data.end(), name.begin(), name.end());
+
+    appendInt(0);
+    appendInt(2);
+
+    marker = { 0x01, 0x02, 0x00, 0x00 };
+    for (int i = 0; i < 2; i++)
+    {
+        std::vector<unsigned char> prop(propSize, 0);
+        memcpy(prop.data() + 64, marker.data(), marker.size());
+        data.insert(data.end(), prop.begin(), prop.end());
+    }
+
+    return data;
+}
+
+static bool CheckLayout(uint16_t version, size_t propSize, bool expectModulation)
+{
+    std::vector<unsigned char> marker;
+    std::vector<unsigned char> data = MakeLump(propSize, marker);
+
+    StaticPropLump lump;
+    if (!lump.Parse(data, version))
+    {
+        std::cout << "Error: sprp v" << version << " (" << propSize << " bytes) failed to parse" << std::endl;
+        return false;
+    }
+
+    if (lump.HasDiffuseModulation() != expectModulation)
+    {
+        std::cout << "Error: sprp v" << version << " (" << propSize << " bytes) reports diffuse modulation "
+            << (expectModulation ? "missing" : "present") << std::endl;
+        return false;
+    }
+
+    const unsigned char white[4] = { 0xFF, 0xFF, 0xFF, 0xFF };
+    for (size_t i = 0; i < lump.GetPropCount(); i++)
+    {
+        lump.SetDiffuseModulation(i, white);
+    }
+
+    std::vector<unsigned char> result = lump.Serialize();
+    if (result.size() != data.size())
+    {
+        std::cout << "Error: sprp v" << version << " (" << propSize << " bytes) changed size on serialize" << std::endl;
+        return false;
+    }
+
+    size_t propStart = data.size() - propSize * 2;
+    for (size_t i = 0; i < 2; i++)
+    {
+        const unsigned char* field = result.data() + propStart + i * propSize + 64;
+        const unsigned char* expected = expectModulation ? white : marker.data();
+        if (memcmp(field, expected, 4) != 0)
+        {
+            std::cout << "Error: sprp v" << version << " (" << propSize << " bytes) has wrong bytes at offset 64" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main()
+{
+    bool ok = true;
+
+    // m_DiffuseModulation по смещению 64
+    ok &= CheckLayout(7, 68, true);
+    ok &= CheckLayout(8, 68, true);
+    ok &= CheckLayout(9, 72, true);
+    ok &= CheckLayout(10, 76, true);
+    ok &= CheckLayout(11, 80, true);
+
+    // v10 из SDK 2013: по смещению 64 лежат m_Flags, их трогать нельзя
+    ok &= CheckLayout(10, 72, false);
+
+    return ok ? 0 : 1;
+}
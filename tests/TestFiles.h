@@ -0,0 +1,100 @@
+﻿//========= Copyright Satjo Interactive 2025, All rights reserved. ============//
+//
+//      Оригинальный код написан: Tirmiks
+//      Отдельные благодарности: ugo_zapad, Ambiabstract, MyCbEH
+//
+//=============================================================================//
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+
+#include "BSPFile.h"
+
+// Синтетические файлы для тестов: минимальные MDL и BSP, которые принимают загрузчики
+
+inline void PutInt(std::vector<unsigned char>& data, size_t offset, int value)
+{
+    memcpy(data.data() + offset, &value, sizeof(value));
+}
+
+inline void AppendBytes(std::vector<unsigned char>& data, const void* bytes, size_t size)
+{
+    const unsigned char* begin = static_cast<const unsigned char*>(bytes);
+    data.insert(data.end(), begin, begin + size);
+}
+
+inline void AppendString(std::vector<unsigned char>& data, const std::string& text)
+{
+    data.insert(data.end(), text.begin(), text.end());
+    data.push_back(0);
+}
+
+// MDL версии 48 с одной текстурой, одним каталогом текстур и одним семейством скинов
+inline std::vector<unsigned char> MakeTestModel(const std::string& textureName, const std::string& textureDir)
+{
+    const size_t headerSize = 408;
+    std::vector<unsigned char> data(headerSize, 0);
+    memcpy(data.data(), "IDST", 4);
+    PutInt(data, 4, 48);
+
+    // mstudiotexture_t: имя отсчитывается от начала структуры
+    size_t textureIndex = data.size();
+    std::vector<unsigned char> texture(64, 0);
+    PutInt(texture, 0, 64);
+    PutInt(texture, 8, 1);
+    AppendBytes(data, texture.data(), texture.size());
+    AppendString(data, textureName);
+
+    size_t cdTextureIndex = data.size();
+    int textureDirOffset = static_cast<int>(cdTextureIndex + sizeof(int));
+    AppendBytes(data, &textureDirOffset, sizeof(textureDirOffset));
+    AppendString(data, textureDir);
+
+    size_t skinIndex = data.size();
+    data.push_back(0);
+    data.push_back(0);
+
+    size_t surfacePropIndex = data.size();
+    AppendString(data, "default");
+    data.resize(data.size() + 16, 0);
+
+    PutInt(data, 204, 1);
+    PutInt(data, 208, static_cast<int>(textureIndex));
+    PutInt(data, 212, 1);
+    PutInt(data, 216, static_cast<int>(cdTextureIndex));
+    PutInt(data, 220, 1);
+    PutInt(data, 224, 1);
+    PutInt(data, 228, static_cast<int>(skinIndex));
+    PutInt(data, 308, static_cast<int>(surfacePropIndex));
+    PutInt(data, 76, static_cast<int>(data.size()));
+    return data;
+}
+
+// BSP версии 20 с лампом сущностей и LUMP_PAKFILE последним в файле
+inline std::vector<unsigned char> MakeTestBSP(const std::vector<unsigned char>& pakData)
+{
+    BSPHeader header = {};
+    header.ident = BSP_IDENT;
+    header.version = 20;
+    header.mapRevision = 1;
+
+    std::vector<unsigned char> data(sizeof(header), 0);
+
+    std::string entities = "{\n\"classname\" \"worldspawn\"\n}\n";
+    header.lumps[0].fileofs = static_cast<int>(data.size());
+    header.lumps[0].filelen = static_cast<int>(entities.size() + 1);
+    AppendString(data, entities);
+    while (data.size() % 4 != 0)
+        data.push_back(0);
+
+    header.lumps[LUMP_PAKFILE].fileofs = static_cast<int>(data.size());
+    header.lumps[LUMP_PAKFILE].filelen = static_cast<int>(pakData.size());
+    AppendBytes(data, pakData.data(), pakData.size());
+
+    memcpy(data.data(), &header, sizeof(header));
+    return data;
+}